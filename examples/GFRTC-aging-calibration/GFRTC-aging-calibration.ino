@@ -0,0 +1,65 @@
+/**
+   GeekFactory - "INNOVATING TOGETHER"
+   Distribucion de materiales para el desarrollo e innovacion tecnologica
+   www.geekfactory.mx
+
+   This example shows how to calibrate the aging offset register of the DS3231
+   or DS3232 against the PPS output of a GPS receiver connected to pin 2. A
+   sample is taken every hour, after one day of measurement the drift of the
+   RTC is cancelled by writing the aging offset register. On the DS3232 the
+   measurement is kept on NVRAM so it survives a reset.
+*/
+#include <GFRTC.h>
+#include <GFRTCCalib.h>
+
+// pin connected to the PPS output of the GPS receiver
+const uint8_t ppsPin = 2;
+
+void onPps() {
+  GFRTCCalib.ppsEdge();
+}
+
+void setup() {
+  // prepare serial interface
+  Serial.begin(115200);
+  while (!Serial);
+
+  // show message on serial monitor
+  Serial.println(F("----------------------------------------------------"));
+  Serial.println(F("             GFRTC LIBRARY TEST PROGRAM             "));
+  Serial.println(F("             https://www.geekfactory.mx             "));
+  Serial.println(F("----------------------------------------------------"));
+
+  // prepare the GFRTC class, this also calls Wire.begin()
+  GFRTC.begin(true);
+
+  // check if we can communicate with RTC
+  if (GFRTC.isPresent()) {
+    Serial.println(F("RTC connected and ready."));
+  } else {
+    Serial.println(F("Check RTC connections and try again."));
+    for (;;);
+  }
+
+  // keep calibration state on the first bytes of NVRAM when available
+  uint8_t offset = (GFRTC.getNVRAMSize() >= GFRTC_CALIB_NVRAM_SIZE) ? 0 : GFRTC_CALIB_NO_NVRAM;
+  if (!GFRTCCalib.begin(E_CALIB_PPS, offset)) {
+    Serial.println(F("This RTC has no aging offset register."));
+    for (;;);
+  }
+
+  pinMode(ppsPin, INPUT);
+  attachInterrupt(digitalPinToInterrupt(ppsPin), onPps, RISING);
+}
+
+void loop() {
+  // takes a sample when due, this may wait up to one second for the RTC
+  if (GFRTCCalib.update()) {
+    Serial.print(F("Drift (0.01 ppm): "));
+    Serial.print(GFRTCCalib.getDrift());
+    Serial.print(F(" measured seconds: "));
+    Serial.print(GFRTCCalib.getSpan());
+    Serial.print(F(" aging offset: "));
+    Serial.println(GFRTCCalib.getAging());
+  }
+}
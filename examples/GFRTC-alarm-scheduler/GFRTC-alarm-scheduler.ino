@@ -0,0 +1,66 @@
+/**
+   GeekFactory - "INNOVATING TOGETHER"
+   Distribucion de materiales para el desarrollo e innovacion tecnologica
+   www.geekfactory.mx
+
+   Example that shows how to schedule many alarms on DS3231 and DS3232
+   devices using a single hardware alarm.
+
+   The scheduler programs the nearest deadline on alarm 1 and the INT/SQW pin
+   signals when it is due, so the RTC is only accessed when an alarm fires.
+   Connect INT/SQW to pin 2.
+*/
+#include <GFRTC.h>
+#include <GFRTCScheduler.h>
+
+void setup() {
+  // prepare serial interface
+  Serial.begin(115200);
+  while (!Serial);
+
+  // show message on serial monitor
+  Serial.println(F("----------------------------------------------------"));
+  Serial.println(F("             GFRTC LIBRARY TEST PROGRAM             "));
+  Serial.println(F("             https://www.geekfactory.mx             "));
+  Serial.println(F("----------------------------------------------------"));
+
+  // prepare the GFRTC class, this also calls Wire.begin()
+  GFRTC.begin(true);
+
+  // check if we can communicate with RTC
+  if (GFRTC.isPresent()) {
+    Serial.println(F("RTC connected and ready."));
+  } else {
+    Serial.println(F("Check RTC connections and try again."));
+    for (;;);
+  }
+
+  // start the scheduler, alarms are signaled on pin 2
+  if (!GFRTCScheduler.begin(2)) {
+    Serial.println(F("Cannot start the scheduler, DS1307 has no alarms."));
+    for (;;);
+  }
+
+  // one alarm every 10 seconds, one every 90 seconds and one in 5 minutes
+  timelib_t now = GFRTC.get();
+  GFRTCScheduler.add(now + 10, 10, alarmHandler);
+  GFRTCScheduler.add(now + 90, 90, alarmHandler);
+  GFRTCScheduler.add(now + 300, 0, alarmHandler);
+}
+
+void loop()
+{
+  // dispatch alarms and program the next one, no bus traffic unless needed
+  GFRTCScheduler.update();
+}
+
+/**
+   Called from update() when an alarm is due
+*/
+void alarmHandler(uint8_t id)
+{
+  Serial.print(F("Alarm "));
+  Serial.print(id);
+  Serial.print(F(" at "));
+  Serial.println(GFRTC.get());
+}
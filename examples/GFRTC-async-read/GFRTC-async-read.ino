@@ -0,0 +1,71 @@
+/**
+   GeekFactory - "INNOVATING TOGETHER"
+   Distribucion de materiales para el desarrollo e innovacion tecnologica
+   www.geekfactory.mx
+
+   This example shows how to read the time and temperature without blocking the
+   main loop. Each call to GFRTCAsync.poll() performs at most one phase of the
+   I2C transfer and returns, so other tasks keep running while the RTC is read.
+*/
+#include <GFRTC.h>
+#include <GFRTCAsync.h>
+
+uint32_t loops = 0;
+uint32_t lastRequest = 0;
+
+void onComplete(enum gfrtc_async_ops op, bool success) {
+  if (!success) {
+    Serial.println(F("Transfer failed, check RTC connections."));
+    return;
+  }
+
+  if (op == E_ASYNC_READ_TIME) {
+    Serial.print(F("Unix time: "));
+    Serial.print(GFRTCAsync.getTime());
+    Serial.print(F(" loops while reading: "));
+    Serial.println(loops);
+    // chain the temperature read
+    GFRTCAsync.beginReadTemperature(onComplete);
+  } else if (op == E_ASYNC_READ_TEMPERATURE) {
+    Serial.print(F("Temperature: "));
+    Serial.println(GFRTCAsync.getTemperature());
+  }
+}
+
+void setup() {
+  // prepare serial interface
+  Serial.begin(115200);
+  while (!Serial);
+
+  // show message on serial monitor
+  Serial.println(F("----------------------------------------------------"));
+  Serial.println(F("             GFRTC LIBRARY TEST PROGRAM             "));
+  Serial.println(F("             https://www.geekfactory.mx             "));
+  Serial.println(F("----------------------------------------------------"));
+
+  // prepare the GFRTC class, this also calls Wire.begin()
+  GFRTC.begin(true);
+
+  // check if we can communicate with RTC
+  if (GFRTC.isPresent()) {
+    Serial.println(F("RTC connected and ready."));
+  } else {
+    Serial.println(F("Check RTC connections and try again."));
+    for (;;);
+  }
+}
+
+void loop() {
+  // start a new read every second
+  if (!GFRTCAsync.isBusy() && millis() - lastRequest >= 1000) {
+    lastRequest = millis();
+    loops = 0;
+    GFRTCAsync.beginReadTime(onComplete);
+  }
+
+  // drive the transfer, returns after a single bus phase
+  GFRTCAsync.poll();
+
+  // other work runs here while the transfer is in progress
+  loops++;
+}
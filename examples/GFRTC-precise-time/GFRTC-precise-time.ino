@@ -0,0 +1,62 @@
+/**
+   GeekFactory - "INNOVATING TOGETHER"
+   Distribucion de materiales para el desarrollo e innovacion tecnologica
+   www.geekfactory.mx
+
+   This example shows how to obtain time with sub-second resolution using the
+   square wave output of the DS3231 and DS3232.
+
+   The INT/SQW pin is configured to output 1024 Hz and every falling edge is
+   counted on an interrupt, the RTC is only read to synchronize and to check
+   periodically that no edges were lost. Connect the INT/SQW pin to digital
+   pin 2.
+*/
+#include <GFRTC.h>
+#include <GFRTCSqw.h>
+
+void setup() {
+  // prepare serial interface
+  Serial.begin(115200);
+  while (!Serial);
+
+  // show message on serial monitor
+  Serial.println(F("----------------------------------------------------"));
+  Serial.println(F("             GFRTC LIBRARY TEST PROGRAM             "));
+  Serial.println(F("             https://www.geekfactory.mx             "));
+  Serial.println(F("----------------------------------------------------"));
+
+  // prepare the GFRTC class, this also calls Wire.begin()
+  GFRTC.begin(true);
+
+  // check if we can communicate with RTC
+  if (GFRTC.isPresent()) {
+    Serial.println(F("RTC connected and ready."));
+  } else {
+    Serial.println(F("Check RTC connections and try again."));
+    for (;;);
+  }
+
+  // start the timestamp engine on pin 2 with 1024 Hz resolution
+  if (!GFRTCSqw.begin(2, E_SQRWAVE_1024_HZ)) {
+    Serial.println(F("Cannot synchronize with the square wave output."));
+    for (;;);
+  }
+}
+
+void loop()
+{
+  struct gfrtc_precise_time t;
+
+  // keeps the engine synchronized, only reads the RTC when a check is due
+  GFRTCSqw.update();
+
+  // get time without accessing the I2C bus
+  if (GFRTCSqw.getPrecise(t)) {
+    Serial.print(t.seconds);
+    Serial.print('.');
+    // convert fraction to milliseconds
+    Serial.println(((uint32_t) t.fraction * 1000UL) >> 16);
+  }
+
+  delay(250);
+}
@@ -0,0 +1,601 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+
+/**
+ * Host benchmark of the GFRTC API.
+ *
+ * Every case runs once against the simulated bus to account START conditions
+ * and bytes, the time on the wire is modeled at 100 kHz, 400 kHz and 1 MHz
+ * from the same counters. The case is then repeated to measure the host CPU
+ * time per call, which includes the simulator and is only meaningful to
+ * compare runs on the same computer.
+ *
+ * Usage: GFRTCBench [--json] [--check baseline.csv]
+ *
+ * With --check the bus counters are compared against the thresholds on the
+ * baseline file and the program exits with status 1 if any case needs more
+ * transactions or bytes than allowed. The time codec is also compared against
+ * timelib on every day from 2000 to 2099 at every hour, with the second moving
+ * from day to day, and on every second of a day.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <Wire.h>
+#include "GFRTC.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Number of calls used to measure the host CPU time of each case
+ */
+#define BENCH_ITERATIONS	1000
+
+/**
+ * Maximum number of cases on the baseline file
+ */
+#define BENCH_MAX_BASELINE	64
+
+/**
+ * Unix timestamps of 2000-01-01 and 2100-01-01, range of the codec check
+ */
+#define BENCH_CODEC_FIRST	946684800UL
+#define BENCH_CODEC_LAST	4102444800UL
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * A benchmarked call
+ */
+struct bench_case {
+	/** Name used on the report and the baseline */
+	const char * name;
+	/** Prepares the state needed by the call, not measured */
+	void (*setup)();
+	/** Performs the call */
+	void (*run)();
+};
+
+/**
+ * Result of one case
+ */
+struct bench_result {
+	uint32_t hostNs;
+	uint32_t transactions;
+	uint32_t bytes;
+	uint32_t us100k;
+	uint32_t us400k;
+	uint32_t us1m;
+};
+
+/**
+ * Threshold read from the baseline file
+ */
+struct bench_threshold {
+	char name[32];
+	uint32_t transactions;
+	uint32_t bytes;
+};
+
+/*-------------------------------------------------------------*
+ *		Simulated hardware				*
+ *-------------------------------------------------------------*/
+
+/**
+ * DS3231 driven by the GFRTC instance and DS3232 for the NVRAM cases and
+ * the wake cycle of the DS3232
+ */
+static GFRTCSimDevice rtc(E_SIM_DS3231);
+static GFRTCSimDevice sram(E_SIM_DS3232);
+static GFRTCClass nvrtc(Wire1);
+
+static uint8_t buffer[SRAM_SIZE];
+static struct gfrtc_snapshot snapshot;
+static volatile uint32_t sink;
+
+/*-------------------------------------------------------------*
+ *		Benchmark cases					*
+ *-------------------------------------------------------------*/
+static void setupNone()
+{
+}
+
+static void setupCached()
+{
+	GFRTC.setCachedMode(true);
+	GFRTC.sync();
+}
+
+static void setupWriteBack()
+{
+	GFRTC.setShadowMode(E_SHADOW_WRITE_BACK);
+}
+
+static void setupFlags()
+{
+	rtc.poke(GFRTC_REG_STATUS, rtc.peek(GFRTC_REG_STATUS) | 0x03);
+}
+
+static void setupWake()
+{
+	uint8_t i;
+
+	// alarm 1 always needs to be armed again
+	for (i = GFRTC_REG_ALM1_SECONDS; i <= GFRTC_REG_ALM1_DAYDATE; i++)
+		rtc.poke(i, 0x00);
+	setupFlags();
+}
+
+static void setupWakeDS3232()
+{
+	uint8_t i;
+
+	for (i = GFRTC_REG_ALM1_SECONDS; i <= GFRTC_REG_ALM1_DAYDATE; i++)
+		sram.poke(i, 0x00);
+	sram.poke(GFRTC_REG_STATUS, sram.peek(GFRTC_REG_STATUS) | 0x03);
+}
+
+static void setupSnapshot()
+{
+	GFRTC.readSnapshot(snapshot);
+	setupFlags();
+}
+
+static void runBegin()
+{
+	GFRTC.begin(false);
+}
+
+static void runGet()
+{
+	sink = GFRTC.get();
+}
+
+static void runSet()
+{
+	GFRTC.set(1700000000UL);
+}
+
+static void runRead()
+{
+	struct timelib_tm dt;
+
+	GFRTC.read(dt);
+}
+
+static void runWrite()
+{
+	struct timelib_tm dt;
+
+	timelib_break(1700000000UL, &dt);
+	GFRTC.write(dt);
+}
+
+static void runSync()
+{
+	GFRTC.sync();
+}
+
+static void runReadRegister()
+{
+	sink = GFRTC.readRegister(GFRTC_REG_CONTROL);
+}
+
+static void runWriteRegister()
+{
+	GFRTC.writeRegister(GFRTC_REG_AGING, (uint8_t) 0);
+}
+
+static void runReadBit()
+{
+	sink = GFRTC.readBit(GFRTC_REG_CONTROL, GFRTC_BIT_INTCN);
+}
+
+static void runWriteBit()
+{
+	GFRTC.writeBit(GFRTC_REG_CONTROL, GFRTC_BIT_INTCN, true);
+}
+
+static void runWriteBitFlush()
+{
+	GFRTC.writeBit(GFRTC_REG_CONTROL, GFRTC_BIT_A1IE, true);
+	GFRTC.writeBit(GFRTC_REG_CONTROL, GFRTC_BIT_A2IE, true);
+	GFRTC.flush();
+}
+
+static void runSetAlarm()
+{
+	GFRTC.setAlarm(E_ALM1_MATCH_HOURS, 12, 30, 0, 1);
+}
+
+static void runSetAlarms()
+{
+	struct gfrtc_alarm a1 = { E_ALM1_MATCH_HOURS, 12, 30, 0, 1, true };
+	struct gfrtc_alarm a2 = { E_ALM2_MATCH_MINUTES, 0, 15, 0, 1, false };
+
+	GFRTC.setAlarms(a1, a2);
+}
+
+static void runSetAlarmInterrupt()
+{
+	GFRTC.setAlarmInterrupt(E_ALARM_1, true);
+}
+
+static void runSetIntSqwMode()
+{
+	GFRTC.setIntSqwMode(E_INTERRUPT_OUTPUT);
+}
+
+static void runGetAlarmInterruptFlag()
+{
+	sink = GFRTC.getAlarmInterruptFlag(E_ALARM_1);
+}
+
+static void runServiceAlarms()
+{
+	sink = GFRTC.serviceAlarms();
+}
+
+static void runWakeLegacy()
+{
+	struct timelib_tm dt;
+
+	sink = GFRTC.getAlarmInterruptFlag(E_ALARM_1);
+	GFRTC.read(dt);
+	sink = GFRTC.getOscillatorStopFlag();
+	GFRTC.setAlarm(E_ALM1_MATCH_SECONDS, 0, 0, 30, 0);
+}
+
+static void runWake()
+{
+	struct gfrtc_alarm next = { E_ALM1_MATCH_SECONDS, 0, 0, 30, 0, true };
+	struct gfrtc_wake state;
+
+	GFRTC.wake(state, &next, true);
+	sink = state.alarms;
+}
+
+static void runWakeDS3232()
+{
+	struct gfrtc_alarm next = { E_ALM1_MATCH_SECONDS, 0, 0, 30, 0, true };
+	struct gfrtc_wake state;
+
+	nvrtc.wake(state, &next, true);
+	sink = state.alarms;
+}
+
+static void runGetOscillatorStopFlag()
+{
+	sink = GFRTC.getOscillatorStopFlag();
+}
+
+static void runGetTemperature()
+{
+	sink = GFRTC.getTemperature();
+}
+
+static void runReadTemperature()
+{
+	int16_t quarters;
+
+	GFRTC.readTemperature(quarters);
+}
+
+static void runReadSnapshot()
+{
+	GFRTC.readSnapshot(snapshot);
+}
+
+static void runClearFlags()
+{
+	GFRTC.clearFlags(snapshot, (1 << GFRTC_BIT_A1F) | (1 << GFRTC_BIT_A2F));
+}
+
+static void runReadNVRAM()
+{
+	nvrtc.readNVRAM(0, buffer, sizeof(buffer));
+}
+
+static void runWriteNVRAM()
+{
+	nvrtc.writeNVRAM(0, buffer, sizeof(buffer));
+}
+
+static void runRegs2Time()
+{
+	static const uint8_t regs[7] = { 0x20, 0x13, 0x22, 0x03, 0x14, 0x11, 0x23 };
+
+	sink = gfrtc_regs2time(regs);
+}
+
+static void runTime2Regs()
+{
+	uint8_t regs[7];
+
+	gfrtc_time2regs(1700000000UL + sink % 2, regs);
+	sink = regs[0];
+}
+
+static void runTimelibBreak()
+{
+	struct timelib_tm dt;
+
+	timelib_break(1700000000UL + sink % 2, &dt);
+	sink = dt.tm_sec;
+}
+
+static const struct bench_case cases[] = {
+	{ "begin", setupNone, runBegin },
+	{ "get", setupNone, runGet },
+	{ "get_cached", setupCached, runGet },
+	{ "set", setupNone, runSet },
+	{ "read", setupNone, runRead },
+	{ "write", setupNone, runWrite },
+	{ "sync", setupCached, runSync },
+	{ "readRegister", setupNone, runReadRegister },
+	{ "writeRegister", setupNone, runWriteRegister },
+	{ "readBit", setupNone, runReadBit },
+	{ "writeBit", setupNone, runWriteBit },
+	{ "writeBit_flush", setupWriteBack, runWriteBitFlush },
+	{ "setAlarm", setupNone, runSetAlarm },
+	{ "setAlarms", setupNone, runSetAlarms },
+	{ "setAlarmInterrupt", setupNone, runSetAlarmInterrupt },
+	{ "setIntSqwMode", setupNone, runSetIntSqwMode },
+	{ "getAlarmInterruptFlag", setupFlags, runGetAlarmInterruptFlag },
+	{ "serviceAlarms", setupFlags, runServiceAlarms },
+	{ "wake_legacy", setupWake, runWakeLegacy },
+	{ "wake", setupWake, runWake },
+	{ "wake_ds3232", setupWakeDS3232, runWakeDS3232 },
+	{ "getOscillatorStopFlag", setupNone, runGetOscillatorStopFlag },
+	{ "getTemperature", setupNone, runGetTemperature },
+	{ "readTemperature", setupNone, runReadTemperature },
+	{ "readSnapshot", setupNone, runReadSnapshot },
+	{ "clearFlags", setupSnapshot, runClearFlags },
+	{ "readNVRAM_236", setupNone, runReadNVRAM },
+	{ "writeNVRAM_236", setupNone, runWriteNVRAM },
+	{ "codec_regs2time", setupNone, runRegs2Time },
+	{ "codec_time2regs", setupNone, runTime2Regs },
+	{ "timelib_break", setupNone, runTimelibBreak },
+};
+
+#define BENCH_CASES	(sizeof(cases) / sizeof(cases[0]))
+
+/*-------------------------------------------------------------*
+ *		Codec check					*
+ *-------------------------------------------------------------*/
+
+/**
+ * Encodes and decodes a timestamp with the codec and with timelib.
+ *
+ * @return Returns true if both agree.
+ */
+static bool checkCodecTime(timelib_t t)
+{
+	struct timelib_tm dt;
+	uint8_t regs[7], expect[7];
+	uint8_t year;
+	uint8_t i;
+
+	timelib_break(t, &dt);
+	year = timelib_tm2y2k(dt.tm_year);
+	expect[0] = gfrtc_dec2bcd(dt.tm_sec);
+	expect[1] = gfrtc_dec2bcd(dt.tm_min);
+	expect[2] = gfrtc_dec2bcd(dt.tm_hour);
+	expect[3] = dt.tm_wday;
+	expect[4] = gfrtc_dec2bcd(dt.tm_mday);
+	expect[5] = gfrtc_dec2bcd(dt.tm_mon);
+	expect[6] = gfrtc_dec2bcd(year);
+
+	gfrtc_time2regs(t, regs);
+	for (i = 0; i < sizeof(regs); i++) {
+		if (regs[i] != expect[i])
+			return false;
+	}
+	return gfrtc_regs2time(expect) == t && timelib_make(&dt) == t;
+}
+
+/**
+ * Compares the codec against timelib on the range supported by the chips.
+ *
+ * @return The number of timestamps where they disagree.
+ */
+static uint32_t checkCodec()
+{
+	uint32_t failures = 0;
+	timelib_t day, t;
+	uint32_t second;
+
+	// every hour of every day, the second moves with the day to cover all
+	for (day = BENCH_CODEC_FIRST; day < BENCH_CODEC_LAST; day += 86400UL) {
+		for (second = 0; second < 86400UL; second += 3600UL) {
+			t = day + second + (day / 86400UL * 7 + second / 3600UL) % 3600UL;
+			if (!checkCodecTime(t) && failures++ < 10)
+				fprintf(stderr, "codec: %lu\n", (unsigned long) t);
+		}
+		// the first and last seconds of the day
+		if (!checkCodecTime(day) || !checkCodecTime(day + 86399UL)) {
+			if (failures++ < 10)
+				fprintf(stderr, "codec: day %lu\n", (unsigned long) day);
+		}
+	}
+
+	// every second of a day, on a leap day
+	for (t = 951782400UL; t < 951782400UL + 86400UL; t++) {
+		if (!checkCodecTime(t) && failures++ < 10)
+			fprintf(stderr, "codec: %lu\n", (unsigned long) t);
+	}
+	return failures;
+}
+
+/*-------------------------------------------------------------*
+ *		Runner						*
+ *-------------------------------------------------------------*/
+static uint64_t hostTimeNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void restoreDefaults()
+{
+	GFRTC.setCachedMode(false);
+	GFRTC.setShadowMode(E_SHADOW_DISABLED);
+}
+
+static void measure(const struct bench_case & c, struct bench_result & r)
+{
+	struct gfrtc_sim_stats s0, s1;
+	uint64_t start;
+	uint32_t i;
+
+	// bus cost of a single call, both buses are accounted
+	restoreDefaults();
+	c.setup();
+	Wire.resetStats();
+	Wire1.resetStats();
+	c.run();
+	Wire.getStats(s0);
+	Wire1.getStats(s1);
+	s0.starts += s1.starts;
+	s0.bytesWritten += s1.bytesWritten;
+	s0.bytesRead += s1.bytesRead;
+	s0.bits += s1.bits;
+	r.transactions = s0.starts;
+	r.bytes = s0.bytesWritten + s0.bytesRead;
+	r.us100k = gfrtc_sim_bus_time_us(s0, 100000UL);
+	r.us400k = gfrtc_sim_bus_time_us(s0, 400000UL);
+	r.us1m = gfrtc_sim_bus_time_us(s0, 1000000UL);
+
+	// host time, the setup is repeated so every call does the same work
+	start = hostTimeNs();
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		c.setup();
+		c.run();
+	}
+	r.hostNs = (uint32_t) ((hostTimeNs() - start) / BENCH_ITERATIONS);
+	restoreDefaults();
+}
+
+static int loadBaseline(const char * path, struct bench_threshold * t)
+{
+	char line[128];
+	int count = 0;
+	FILE * f = fopen(path, "r");
+
+	if (f == NULL)
+		return -1;
+	while (count < BENCH_MAX_BASELINE && fgets(line, sizeof(line), f) != NULL) {
+		// comments and the header line are skipped
+		if (line[0] == '#' || !strncmp(line, "name,", 5))
+			continue;
+		if (sscanf(line, "%31[^,],%u,%u", t[count].name, &t[count].transactions, &t[count].bytes) == 3)
+			count++;
+	}
+	fclose(f);
+	return count;
+}
+
+int main(int argc, char ** argv)
+{
+	static struct bench_result results[BENCH_CASES];
+	static struct bench_threshold baseline[BENCH_MAX_BASELINE];
+	const char * check = NULL;
+	bool json = false;
+	int i, j, count = 0, failures = 0;
+	uint32_t codec;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--json")) {
+			json = true;
+		} else if (!strcmp(argv[i], "--check") && i + 1 < argc) {
+			check = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--json] [--check baseline.csv]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (check != NULL && (count = loadBaseline(check, baseline)) < 0) {
+		fprintf(stderr, "cannot open %s\n", check);
+		return 2;
+	}
+
+	Wire.attach(rtc);
+	Wire1.attach(sram);
+	rtc.setTime(1700000000UL);
+	sram.setTime(1700000000UL);
+	GFRTC.begin(true);
+	nvrtc.begin(true);
+
+	for (i = 0; i < (int) BENCH_CASES; i++) {
+		measure(cases[i], results[i]);
+	}
+
+	// report
+	if (json) {
+		printf("[\n");
+	} else {
+		printf("name,host_ns,transactions,bytes,us_100k,us_400k,us_1m\n");
+	}
+	for (i = 0; i < (int) BENCH_CASES; i++) {
+		const struct bench_result & r = results[i];
+
+		if (json) {
+			printf("  {\"name\": \"%s\", \"host_ns\": %u, \"transactions\": %u, \"bytes\": %u, "
+				"\"us_100k\": %u, \"us_400k\": %u, \"us_1m\": %u}%s\n",
+				cases[i].name, r.hostNs, r.transactions, r.bytes, r.us100k, r.us400k, r.us1m,
+				(i + 1 < (int) BENCH_CASES) ? "," : "");
+		} else {
+			printf("%s,%u,%u,%u,%u,%u,%u\n", cases[i].name, r.hostNs, r.transactions, r.bytes,
+				r.us100k, r.us400k, r.us1m);
+		}
+	}
+	if (json)
+		printf("]\n");
+
+	// compare against thresholds, cases missing from the baseline are not checked
+	for (j = 0; j < count; j++) {
+		for (i = 0; i < (int) BENCH_CASES; i++) {
+			if (!strcmp(cases[i].name, baseline[j].name))
+				break;
+		}
+		if (i == (int) BENCH_CASES) {
+			fprintf(stderr, "%s: not found\n", baseline[j].name);
+			failures++;
+		} else if (results[i].transactions > baseline[j].transactions || results[i].bytes > baseline[j].bytes) {
+			fprintf(stderr, "%s: %u transactions / %u bytes, baseline allows %u / %u\n", baseline[j].name,
+				results[i].transactions, results[i].bytes, baseline[j].transactions, baseline[j].bytes);
+			failures++;
+		}
+	}
+	if (check != NULL) {
+		fprintf(stderr, "%d of %d thresholds exceeded\n", failures, count);
+		codec = checkCodec();
+		fprintf(stderr, "%u timestamps where the codec disagrees with timelib\n", codec);
+		if (codec != 0)
+			failures++;
+	}
+	return (failures != 0) ? 1 : 0;
+}
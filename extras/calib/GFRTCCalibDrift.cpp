@@ -0,0 +1,181 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+
+/**
+ * Drift scenario of the GFRTCCalib engine on the host simulator.
+ *
+ * A DS3231 with a crystal that runs a few ppm fast keeps time for a device
+ * that resyncs from the network whenever the RTC is more than half a second
+ * away from the real time. Every resync passes the network timestamp to
+ * GFRTCCalib.addReference() before the RTC is set and once more after it, so
+ * the time between two resyncs is a drift sample. Once the engine writes the
+ * aging offset the resyncs become much less frequent, the program prints the
+ * interval before each of them as CSV.
+ *
+ * Usage: GFRTCCalibDrift [days] [ppm]
+ *
+ * The program exits with status 1 if the longest interval between resyncs
+ * after the calibration is not at least DRIFT_GAIN times the first one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <Wire.h>
+#include "GFRTC.h"
+#include "GFRTCCalib.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Default days simulated and drift of the crystal
+ */
+#define DRIFT_DAYS	365
+#define DRIFT_PPM	4.73
+
+/**
+ * Real time when the simulation starts, 2026-01-01 00:00:00
+ */
+#define DRIFT_START	1767225600UL
+
+/**
+ * Seconds between checks of the RTC against the real time
+ */
+#define DRIFT_CHECK	60
+
+/**
+ * Required growth of the interval between resyncs
+ */
+#define DRIFT_GAIN	10
+
+#define NS_PER_SECOND	1000000000ULL
+
+/*-------------------------------------------------------------*
+ *		Simulated hardware				*
+ *-------------------------------------------------------------*/
+static GFRTCSimDevice rtc(E_SIM_DS3231);
+
+/*-------------------------------------------------------------*
+ *		Helpers						*
+ *-------------------------------------------------------------*/
+
+/**
+ * Gets the real time in nanoseconds since DRIFT_START.
+ */
+static uint64_t now()
+{
+	return gfrtc_sim_time_ns();
+}
+
+/**
+ * Moves the real time forward to the given instant.
+ */
+static void advanceTo(uint64_t ns)
+{
+	if (ns > now())
+		gfrtc_sim_advance_ns(ns - now());
+}
+
+/**
+ * Passes the network time to the calibration engine.
+ */
+static bool reference()
+{
+	uint64_t t = now();
+
+	return GFRTCCalib.addReference(DRIFT_START + (timelib_t) (t / NS_PER_SECOND),
+		(uint16_t) ((t % NS_PER_SECOND) * 65536 / NS_PER_SECOND));
+}
+
+/**
+ * Sets the RTC at the start of the next real second and starts a new drift
+ * sample, the first sample of the engine includes the correction and is
+ * discarded.
+ */
+static bool resync()
+{
+	uint64_t next = (now() / NS_PER_SECOND + 1) * NS_PER_SECOND;
+
+	advanceTo(next);
+	return GFRTC.set(DRIFT_START + (timelib_t) (next / NS_PER_SECOND)) && reference();
+}
+
+/*-------------------------------------------------------------*
+ *		Main						*
+ *-------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+	uint32_t days = (argc > 1) ? (uint32_t) atol(argv[1]) : DRIFT_DAYS;
+	double ppm = (argc > 2) ? atof(argv[2]) : DRIFT_PPM;
+	uint64_t end = (uint64_t) days * 86400 * NS_PER_SECOND;
+	uint64_t check, last = 0;
+	double interval, first = 0.0, longest = 0.0;
+	uint32_t resyncs = 0;
+
+	Wire.attach(rtc);
+	rtc.setDriftPpm(ppm);
+	rtc.setTime(DRIFT_START);
+	GFRTC.begin(true);
+	if (!GFRTCCalib.begin(E_CALIB_HOST)) {
+		fprintf(stderr, "calibration engine did not start\n");
+		return 1;
+	}
+	if (!resync()) {
+		fprintf(stderr, "the RTC could not be set\n");
+		return 1;
+	}
+	last = now();
+
+	printf("resync,day,interval_days,drift_ppm,aging\n");
+	for (check = (last / NS_PER_SECOND + 1) * NS_PER_SECOND + NS_PER_SECOND / 2; check < end; check += DRIFT_CHECK * NS_PER_SECOND) {
+		// in the middle of the real second the RTC shows the same second
+		// unless it is more than half a second away
+		advanceTo(check);
+		if (rtc.getTime() == DRIFT_START + (uint32_t) (check / NS_PER_SECOND))
+			continue;
+
+		interval = (double) (now() - last) / (86400.0 * NS_PER_SECOND);
+		if (!reference() || !resync()) {
+			fprintf(stderr, "resync failed on day %.2f\n", (double) now() / (86400.0 * NS_PER_SECOND));
+			return 1;
+		}
+		last = now();
+		resyncs++;
+		if (resyncs == 1)
+			first = interval;
+		else if (interval > longest)
+			longest = interval;
+		printf("%u,%.2f,%.2f,%.2f,%d\n", resyncs, (double) now() / (86400.0 * NS_PER_SECOND),
+			interval, GFRTCCalib.getDrift() / 100.0, GFRTCCalib.getAging());
+	}
+
+	// the time since the last resync counts if the RTC is still on time
+	interval = (double) (end - last) / (86400.0 * NS_PER_SECOND);
+	if (resyncs != 0 && interval > longest)
+		longest = interval;
+
+	fprintf(stderr, "resyncs: %u first interval: %.2f days longest after calibration: %.2f days\n",
+		resyncs, first, longest);
+	if (resyncs == 0 || longest < first * DRIFT_GAIN) {
+		fprintf(stderr, "the interval between resyncs did not grow\n");
+		return 1;
+	}
+	return 0;
+}
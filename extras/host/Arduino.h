@@ -0,0 +1,116 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Minimal subset of the Arduino core used by the GFRTC library, this allows
+ * the library to be compiled and exercised on a host computer against the
+ * simulated RTC declared in GFRTCSim.h. Time reported by millis() / micros()
+ * is the virtual time of the simulator, it only moves when the simulation is
+ * advanced or when a bus transfer is performed.
+ */
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+
+#define F(str) (str)
+
+#define digitalPinToInterrupt(p) (p)
+
+/**
+ * Pins of the simulated I2C bus, used by the bus recovery of the library
+ */
+#define PIN_WIRE_SDA 18
+#define PIN_WIRE_SCL 19
+
+typedef uint8_t byte;
+
+static const uint8_t SDA = PIN_WIRE_SDA;
+static const uint8_t SCL = PIN_WIRE_SCL;
+
+/*-------------------------------------------------------------*
+ *		Function prototypes				*
+ *-------------------------------------------------------------*/
+unsigned long millis();
+
+unsigned long micros();
+
+void delay(unsigned long ms);
+
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+
+int digitalRead(uint8_t pin);
+
+void digitalWrite(uint8_t pin, uint8_t value);
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+
+void detachInterrupt(uint8_t interrupt);
+
+void noInterrupts();
+
+void interrupts();
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Console stub, output is discarded on the host build.
+ */
+class HardwareSerial {
+public:
+	void begin(unsigned long) { }
+	size_t write(uint8_t) { return 1; }
+	size_t print(const char *) { return 0; }
+	size_t print(long, int = DEC) { return 0; }
+	size_t println(const char * = "") { return 0; }
+	size_t println(long, int = DEC) { return 0; }
+	operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
+// End of Header file
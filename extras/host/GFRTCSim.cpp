@@ -0,0 +1,1076 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "Arduino.h"
+#include "Wire.h"
+#include "GFRTCSim.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+#define SIM_NS_PER_SECOND 1000000000ULL
+#define SIM_MAX_PINS 64
+
+/*-------------------------------------------------------------*
+ *		Private data					*
+ *-------------------------------------------------------------*/
+
+/**
+ * Virtual time since the simulation started
+ */
+static uint64_t simTimeNs = 0;
+
+/**
+ * List of devices that receive time updates
+ */
+static GFRTCSimDevice * simDevices = NULL;
+
+/**
+ * Host pin state and attached interrupt handlers
+ */
+static uint8_t simPinLevel[SIM_MAX_PINS];
+static void (*simPinIsr[SIM_MAX_PINS])(void);
+static int simPinIsrMode[SIM_MAX_PINS];
+static bool simPinPending[SIM_MAX_PINS];
+static bool simInterruptsEnabled = true;
+
+/**
+ * Function called around every bus phase
+ */
+static void (*simYield)(void) = NULL;
+
+/*-------------------------------------------------------------*
+ *		Private helpers					*
+ *-------------------------------------------------------------*/
+static uint8_t sim_dec2bcd(uint8_t num)
+{
+	return((num / 10 * 16) + (num % 10));
+}
+
+static uint8_t sim_bcd2dec(uint8_t num)
+{
+	return((num / 16 * 10) + (num % 16));
+}
+
+static uint8_t sim_month_days(uint8_t month, uint8_t year)
+{
+	static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+	// the chips consider every year divisible by 4 as leap year
+	if (month == 2 && (year % 4) == 0)
+		return 29;
+	return days[(month - 1) % 12];
+}
+
+/**
+ * Days since 1970-01-01 for a gregorian date, independent from TimeLib so the
+ * simulator can be used to validate conversions performed by the library.
+ */
+static int32_t sim_days_from_civil(int32_t y, uint32_t m, uint32_t d)
+{
+	y -= m <= 2;
+	const int32_t era = (y >= 0 ? y : y - 399) / 400;
+	const uint32_t yoe = (uint32_t) (y - era * 400);
+	const uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int32_t) doe - 719468;
+}
+
+static void sim_civil_from_days(int32_t z, int32_t & y, uint32_t & m, uint32_t & d)
+{
+	z += 719468;
+	const int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const uint32_t doe = (uint32_t) (z - era * 146097);
+	const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const uint32_t mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = (int32_t) yoe + era * 400 + (m <= 2);
+}
+
+static uint8_t sim_decode_hours(uint8_t reg)
+{
+	uint8_t h;
+
+	// 12 hour mode, bit 5 is the PM flag
+	if (reg & 0x40) {
+		h = sim_bcd2dec(reg & 0x1f) % 12;
+		return (reg & 0x20) ? h + 12 : h;
+	}
+	return sim_bcd2dec(reg & 0x3f);
+}
+
+static uint8_t sim_encode_hours(uint8_t hour, bool mode12)
+{
+	uint8_t h;
+
+	if (mode12) {
+		h = hour % 12;
+		return 0x40 | ((hour >= 12) ? 0x20 : 0x00) | sim_dec2bcd(h ? h : 12);
+	}
+	return sim_dec2bcd(hour);
+}
+
+/*-------------------------------------------------------------*
+ *		Arduino core functions				*
+ *-------------------------------------------------------------*/
+HardwareSerial Serial;
+
+unsigned long millis()
+{
+	return (unsigned long) (simTimeNs / 1000000ULL);
+}
+
+unsigned long micros()
+{
+	return (unsigned long) (simTimeNs / 1000ULL);
+}
+
+void delay(unsigned long ms)
+{
+	gfrtc_sim_advance_ns((uint64_t) ms * 1000000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	gfrtc_sim_advance_ns((uint64_t) us * 1000ULL);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if (pin < SIM_MAX_PINS && mode == INPUT_PULLUP) {
+		// releasing an open drain line low is a rising edge
+		if (pin == SCL && simPinLevel[pin] == LOW)
+			Wire.clockScl();
+		simPinLevel[pin] = HIGH;
+	}
+}
+
+int digitalRead(uint8_t pin)
+{
+	// a device holding the data line wins over the pull-up
+	if (pin == SDA && Wire.isSdaStuck())
+		return LOW;
+	return (pin < SIM_MAX_PINS) ? simPinLevel[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	if (pin == SCL && value != LOW && simPinLevel[pin] == LOW)
+		Wire.clockScl();
+	gfrtc_sim_set_pin(pin, value != LOW);
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode)
+{
+	if (interrupt >= SIM_MAX_PINS)
+		return;
+	simPinIsr[interrupt] = isr;
+	simPinIsrMode[interrupt] = mode;
+	simPinPending[interrupt] = false;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+	if (interrupt < SIM_MAX_PINS)
+		simPinIsr[interrupt] = NULL;
+}
+
+void noInterrupts()
+{
+	simInterruptsEnabled = false;
+}
+
+void interrupts()
+{
+	uint8_t i;
+
+	simInterruptsEnabled = true;
+	// run the handlers of edges that happened while interrupts were disabled
+	for (i = 0; i < SIM_MAX_PINS; i++) {
+		if (simPinPending[i] && simPinIsr[i] != NULL) {
+			simPinPending[i] = false;
+			simPinIsr[i]();
+		}
+	}
+}
+
+/*-------------------------------------------------------------*
+ *		Simulator functions				*
+ *-------------------------------------------------------------*/
+void gfrtc_sim_advance(uint32_t us)
+{
+	gfrtc_sim_advance_ns((uint64_t) us * 1000ULL);
+}
+
+void gfrtc_sim_advance_ns(uint64_t ns)
+{
+	GFRTCSimDevice * dev;
+	uint64_t step, next;
+
+	// advance in slices that end on the next event of any device, so the
+	// virtual clock seen by interrupt handlers matches the time of the edge
+	while (ns > 0) {
+		step = ns;
+		for (dev = simDevices; dev != NULL; dev = dev->next) {
+			next = dev->nextEvent();
+			if (next < step)
+				step = next;
+		}
+		simTimeNs += step;
+		ns -= step;
+		for (dev = simDevices; dev != NULL; dev = dev->next) {
+			dev->advance(step);
+		}
+	}
+}
+
+uint64_t gfrtc_sim_time_ns()
+{
+	return simTimeNs;
+}
+
+uint32_t gfrtc_sim_bus_time_us(const struct gfrtc_sim_stats & stats, uint32_t frequency)
+{
+	return (uint32_t) (((uint64_t) stats.bits * 1000000ULL + frequency - 1) / frequency);
+}
+
+void gfrtc_sim_set_yield(void (*hook)(void))
+{
+	simYield = hook;
+}
+
+void gfrtc_sim_set_pin(uint8_t pin, bool level)
+{
+	int mode;
+	bool trigger;
+
+	if (pin >= SIM_MAX_PINS || (simPinLevel[pin] != LOW) == level)
+		return;
+	simPinLevel[pin] = level ? HIGH : LOW;
+
+	if (simPinIsr[pin] == NULL)
+		return;
+	mode = simPinIsrMode[pin];
+	trigger = (mode == CHANGE) || (mode == FALLING && !level) || (mode == RISING && level);
+	if (!trigger)
+		return;
+	if (simInterruptsEnabled) {
+		simPinIsr[pin]();
+	} else {
+		simPinPending[pin] = true;
+	}
+}
+
+/*-------------------------------------------------------------*
+ *		Simulated device				*
+ *-------------------------------------------------------------*/
+GFRTCSimDevice::GFRTCSimDevice(enum gfrtc_sim_chips chip, uint8_t address)
+{
+	_chip = chip;
+	_address = address;
+	_driftPpm = 0.0;
+	_temperature = 25.0;
+	_pin = -1;
+	reset();
+
+	// register on the list of devices that follow the virtual clock
+	next = simDevices;
+	simDevices = this;
+}
+
+GFRTCSimDevice::~GFRTCSimDevice()
+{
+	GFRTCSimDevice ** p;
+
+	for (p = &simDevices; *p != NULL; p = &(*p)->next) {
+		if (*p == this) {
+			*p = next;
+			break;
+		}
+	}
+}
+
+void GFRTCSimDevice::reset()
+{
+	memset(_regs, 0, sizeof(_regs));
+	_pointer = 0;
+	_subsecond = 0;
+	_driftRemainder = 0.0;
+	_conversionLeft = 0;
+	_secondsToConversion = GFRTC_SIM_TCXO_INTERVAL_S;
+	_stopped = false;
+	_level = true;
+
+	// date registers start on 01/01/00
+	_regs[0x03] = 0x01;
+	_regs[0x04] = 0x01;
+	_regs[0x05] = 0x01;
+
+	if (_chip == E_SIM_DS1307) {
+		// clock halt bit set on first power up
+		_regs[0x00] = 0x80;
+	} else {
+		// INTCN, RS2 & RS1 set, OSF & EN32KHZ set
+		_regs[0x0E] = 0x1C;
+		_regs[0x0F] = 0x88;
+		// temperature is converted on power up
+		finishConversion();
+	}
+	updateOutput();
+}
+
+uint8_t GFRTCSimDevice::getAddress()
+{
+	return _address;
+}
+
+enum gfrtc_sim_chips GFRTCSimDevice::getChip()
+{
+	return _chip;
+}
+
+void GFRTCSimDevice::setTime(uint32_t t)
+{
+	int32_t y;
+	uint32_t m, d;
+	uint32_t days = t / 86400UL;
+	uint32_t secs = t % 86400UL;
+
+	sim_civil_from_days((int32_t) days, y, m, d);
+
+	_regs[0x00] = (_regs[0x00] & 0x80) | sim_dec2bcd(secs % 60);
+	_regs[0x01] = sim_dec2bcd((secs / 60) % 60);
+	_regs[0x02] = sim_encode_hours(secs / 3600, (_regs[0x02] & 0x40) != 0);
+	_regs[0x03] = (uint8_t) (((days + 4) % 7) + 1);
+	_regs[0x04] = sim_dec2bcd(d);
+	_regs[0x05] = sim_dec2bcd(m) | ((_chip != E_SIM_DS1307 && y >= 2100) ? 0x80 : 0x00);
+	_regs[0x06] = sim_dec2bcd(y % 100);
+	_subsecond = 0;
+}
+
+uint32_t GFRTCSimDevice::getTime()
+{
+	int32_t year = 2000 + sim_bcd2dec(_regs[0x06]);
+	if (_chip != E_SIM_DS1307 && (_regs[0x05] & 0x80))
+		year += 100;
+
+	int32_t days = sim_days_from_civil(year, sim_bcd2dec(_regs[0x05] & 0x1f), sim_bcd2dec(_regs[0x04] & 0x3f));
+	return (uint32_t) days * 86400UL
+		+ sim_decode_hours(_regs[0x02]) * 3600UL
+		+ sim_bcd2dec(_regs[0x01] & 0x7f) * 60UL
+		+ sim_bcd2dec(_regs[0x00] & 0x7f);
+}
+
+uint8_t GFRTCSimDevice::peek(uint8_t addr)
+{
+	return _regs[addr];
+}
+
+void GFRTCSimDevice::poke(uint8_t addr, uint8_t value)
+{
+	_regs[addr] = value;
+	updateOutput();
+}
+
+void GFRTCSimDevice::setDriftPpm(double ppm)
+{
+	_driftPpm = ppm;
+}
+
+void GFRTCSimDevice::setTemperature(double celsius)
+{
+	_temperature = celsius;
+}
+
+void GFRTCSimDevice::setOscillatorStopped(bool stopped)
+{
+	_stopped = stopped;
+	if (stopped && _chip != E_SIM_DS1307)
+		_regs[0x0F] |= 0x80;
+}
+
+void GFRTCSimDevice::connectInterruptPin(uint8_t pin)
+{
+	_pin = pin;
+	gfrtc_sim_set_pin(pin, _level);
+}
+
+bool GFRTCSimDevice::getIntSqwLevel()
+{
+	return _level;
+}
+
+uint64_t GFRTCSimDevice::nextEvent()
+{
+	uint64_t osc;
+
+	if (isHalted())
+		return UINT64_MAX;
+
+	// convert oscillator time to real time, at least one nanosecond
+	osc = oscillatorStep();
+	osc = (uint64_t) ((double) osc / oscillatorRate()) + 1;
+	return osc;
+}
+
+void GFRTCSimDevice::advance(uint64_t ns)
+{
+	uint64_t osc, step;
+	double scaled;
+
+	if (isHalted())
+		return;
+
+	scaled = (double) ns * oscillatorRate() + _driftRemainder;
+	osc = (uint64_t) scaled;
+	_driftRemainder = scaled - (double) osc;
+
+	while (osc > 0) {
+		step = oscillatorStep();
+		if (step > osc) {
+			_subsecond += osc;
+			if (_conversionLeft > 0)
+				_conversionLeft -= osc;
+			break;
+		}
+
+		osc -= step;
+		_subsecond += step;
+		if (_conversionLeft > 0) {
+			_conversionLeft -= step;
+			if (_conversionLeft == 0)
+				finishConversion();
+		}
+		if (_subsecond >= SIM_NS_PER_SECOND) {
+			_subsecond = 0;
+			tickSecond();
+		}
+		updateOutput();
+	}
+}
+
+void GFRTCSimDevice::i2cStart()
+{
+	// nothing to latch, time registers do not change during a transfer
+}
+
+void GFRTCSimDevice::i2cWrite(uint8_t data, bool first)
+{
+	if (first) {
+		_pointer = data;
+		return;
+	}
+	writeRegister(_pointer, data);
+	_pointer = (_pointer >= lastRegister()) ? 0 : _pointer + 1;
+}
+
+uint8_t GFRTCSimDevice::i2cRead()
+{
+	uint8_t value = (_pointer <= lastRegister()) ? _regs[_pointer] : 0xFF;
+
+	_pointer = (_pointer >= lastRegister()) ? 0 : _pointer + 1;
+	return value;
+}
+
+uint8_t GFRTCSimDevice::lastRegister()
+{
+	switch (_chip) {
+	case E_SIM_DS1307:
+		return 0x3F;
+	case E_SIM_DS3231:
+		return 0x12;
+	default:
+		return 0xFF;
+	}
+}
+
+void GFRTCSimDevice::writeRegister(uint8_t addr, uint8_t value)
+{
+	if (addr > lastRegister())
+		return;
+
+	if (_chip == E_SIM_DS1307) {
+		_regs[addr] = value;
+		if (addr == 0x00)
+			_subsecond = 0;
+		return;
+	}
+
+	switch (addr) {
+	case 0x00:
+		// writing seconds resets the countdown chain
+		_regs[addr] = value & 0x7f;
+		_subsecond = 0;
+		break;
+	case 0x0E:
+		_regs[addr] = value;
+		// CONV starts a conversion unless one is in progress
+		if ((value & 0x20) && !(_regs[0x0F] & 0x04)) {
+			startConversion();
+		} else if (!(_regs[0x0F] & 0x04)) {
+			_regs[addr] &= ~0x20;
+		}
+		break;
+	case 0x0F:
+		// OSF, A2F & A1F can only be cleared, BSY is read only
+		_regs[addr] = (_regs[addr] & value & 0x83) | (value & 0x78) | (_regs[addr] & 0x04);
+		break;
+	case 0x11:
+	case 0x12:
+	case 0x13:
+		// temperature and reserved registers are read only
+		break;
+	default:
+		_regs[addr] = value;
+		break;
+	}
+	updateOutput();
+}
+
+bool GFRTCSimDevice::isHalted()
+{
+	return _stopped || (_chip == E_SIM_DS1307 && (_regs[0x00] & 0x80));
+}
+
+double GFRTCSimDevice::oscillatorRate()
+{
+	// apply crystal error and aging offset, one LSB is about 0.1 ppm and
+	// positive values slow down the oscillator
+	return 1.0 + (_driftPpm - 0.1 * (int8_t) _regs[0x10]) * 1e-6;
+}
+
+uint64_t GFRTCSimDevice::oscillatorStep()
+{
+	static const uint32_t sqwFrequency[] = {1, 1024, 4096, 8192};
+	uint64_t step, next;
+	uint32_t freq;
+
+	// next event is the end of the current second
+	step = SIM_NS_PER_SECOND - _subsecond;
+
+	// or the next edge of the square wave output
+	if (_chip != E_SIM_DS1307 && !(_regs[0x0E] & 0x04)) {
+		freq = 2 * sqwFrequency[(_regs[0x0E] >> 3) & 0x03];
+		next = ((_subsecond * freq / SIM_NS_PER_SECOND) + 1) * SIM_NS_PER_SECOND;
+		next = (next + freq - 1) / freq;
+		if (next - _subsecond < step)
+			step = next - _subsecond;
+	}
+
+	// or the end of a temperature conversion
+	if (_conversionLeft > 0 && _conversionLeft < step)
+		step = _conversionLeft;
+	return step;
+}
+
+void GFRTCSimDevice::tickSecond()
+{
+	uint8_t sec, min, hour, wday, mday, mon, year;
+	bool century, mode12;
+
+	sec = sim_bcd2dec(_regs[0x00] & 0x7f);
+	min = sim_bcd2dec(_regs[0x01] & 0x7f);
+	hour = sim_decode_hours(_regs[0x02]);
+	mode12 = (_regs[0x02] & 0x40) != 0;
+	wday = _regs[0x03] & 0x07;
+	mday = sim_bcd2dec(_regs[0x04] & 0x3f);
+	mon = sim_bcd2dec(_regs[0x05] & 0x1f);
+	century = (_regs[0x05] & 0x80) != 0;
+	year = sim_bcd2dec(_regs[0x06]);
+
+	if (++sec >= 60) {
+		sec = 0;
+		if (++min >= 60) {
+			min = 0;
+			if (++hour >= 24) {
+				hour = 0;
+				wday = (wday % 7) + 1;
+				if (++mday > sim_month_days(mon, year)) {
+					mday = 1;
+					if (++mon > 12) {
+						mon = 1;
+						if (++year > 99) {
+							year = 0;
+							century = !century;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	_regs[0x00] = (_regs[0x00] & 0x80) | sim_dec2bcd(sec);
+	_regs[0x01] = sim_dec2bcd(min);
+	_regs[0x02] = sim_encode_hours(hour, mode12);
+	_regs[0x03] = wday;
+	_regs[0x04] = sim_dec2bcd(mday);
+	_regs[0x05] = sim_dec2bcd(mon) | ((_chip != E_SIM_DS1307 && century) ? 0x80 : 0x00);
+	_regs[0x06] = sim_dec2bcd(year);
+
+	if (_chip == E_SIM_DS1307)
+		return;
+
+	checkAlarms();
+
+	// the TCXO performs a conversion periodically
+	if (--_secondsToConversion == 0) {
+		_secondsToConversion = GFRTC_SIM_TCXO_INTERVAL_S;
+		if (!(_regs[0x0F] & 0x04))
+			startConversion();
+	}
+}
+
+void GFRTCSimDevice::checkAlarms()
+{
+	uint8_t sec = _regs[0x00] & 0x7f;
+	uint8_t min = _regs[0x01];
+	uint8_t hour = sim_decode_hours(_regs[0x02]);
+	uint8_t wday = _regs[0x03];
+	uint8_t mday = _regs[0x04];
+	uint8_t daydate;
+	bool match;
+
+	// alarm 1, every field is compared unless its mask bit is set
+	match = true;
+	if (!(_regs[0x07] & 0x80) && (_regs[0x07] & 0x7f) != sec) match = false;
+	if (!(_regs[0x08] & 0x80) && (_regs[0x08] & 0x7f) != min) match = false;
+	if (!(_regs[0x09] & 0x80) && sim_decode_hours(_regs[0x09] & 0x7f) != hour) match = false;
+	if (!(_regs[0x0A] & 0x80)) {
+		daydate = (_regs[0x0A] & 0x40) ? (_regs[0x0A] & 0x0f) : (_regs[0x0A] & 0x3f);
+		if (daydate != ((_regs[0x0A] & 0x40) ? wday : mday)) match = false;
+	}
+	if (match)
+		_regs[0x0F] |= 0x01;
+
+	// alarm 2 is evaluated at 00 seconds
+	if (sec != 0)
+		return;
+	match = true;
+	if (!(_regs[0x0B] & 0x80) && (_regs[0x0B] & 0x7f) != min) match = false;
+	if (!(_regs[0x0C] & 0x80) && sim_decode_hours(_regs[0x0C] & 0x7f) != hour) match = false;
+	if (!(_regs[0x0D] & 0x80)) {
+		daydate = (_regs[0x0D] & 0x40) ? (_regs[0x0D] & 0x0f) : (_regs[0x0D] & 0x3f);
+		if (daydate != ((_regs[0x0D] & 0x40) ? wday : mday)) match = false;
+	}
+	if (match)
+		_regs[0x0F] |= 0x02;
+}
+
+void GFRTCSimDevice::startConversion()
+{
+	_regs[0x0F] |= 0x04;
+	_conversionLeft = GFRTC_SIM_CONV_TIME_US * 1000ULL;
+}
+
+void GFRTCSimDevice::finishConversion()
+{
+	// 10 bit two's complement value with 0.25 degree resolution
+	int16_t quarters = (int16_t) (_temperature * 4.0 + (_temperature >= 0 ? 0.5 : -0.5));
+
+	_regs[0x11] = (uint8_t) (quarters >> 2);
+	_regs[0x12] = (uint8_t) ((quarters & 0x03) << 6);
+	_regs[0x0E] &= ~0x20;
+	_regs[0x0F] &= ~0x04;
+	_conversionLeft = 0;
+}
+
+void GFRTCSimDevice::updateOutput()
+{
+	static const uint32_t sqwFrequency[] = {1, 1024, 4096, 8192};
+	uint8_t ctrl = _regs[0x0E];
+	uint8_t stat = _regs[0x0F];
+	uint32_t freq;
+	bool level;
+
+	if (_chip == E_SIM_DS1307) {
+		level = true;
+	} else if (ctrl & 0x04) {
+		// interrupt output, active low while an enabled alarm flag is set
+		level = !((ctrl & stat & 0x01) || (ctrl & stat & 0x02));
+	} else {
+		// square wave, the output goes low at the start of every second
+		freq = 2 * sqwFrequency[(ctrl >> 3) & 0x03];
+		level = ((_subsecond * freq / SIM_NS_PER_SECOND) & 0x01) != 0;
+	}
+
+	if (level == _level)
+		return;
+	_level = level;
+	if (_pin >= 0)
+		gfrtc_sim_set_pin((uint8_t) _pin, level);
+}
+
+/*-------------------------------------------------------------*
+ *		Simulated bus					*
+ *-------------------------------------------------------------*/
+TwoWire::TwoWire()
+{
+	_deviceCount = 0;
+	_frequency = 100000;
+	_txLength = 0;
+	_rxLength = 0;
+	_rxIndex = 0;
+	_busHeld = false;
+	_timeout = 0;
+	_timeoutFlag = false;
+	clearFaults();
+	resetStats();
+}
+
+void TwoWire::begin()
+{
+	_busHeld = false;
+}
+
+void TwoWire::end()
+{
+	// the controller releases both lines, the pull-ups take them high
+	simPinLevel[SDA] = HIGH;
+	simPinLevel[SCL] = HIGH;
+}
+
+void TwoWire::setClock(uint32_t frequency)
+{
+	_frequency = frequency;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	_txAddress = address;
+	_txLength = 0;
+}
+
+void TwoWire::beginTransmission(int address)
+{
+	beginTransmission((uint8_t) address);
+}
+
+uint8_t TwoWire::endTransmission()
+{
+	return endTransmission((uint8_t) true);
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+	uint8_t i;
+	GFRTCSimDevice * dev = findDevice(_txAddress);
+
+	if (simYield != NULL)
+		simYield();
+	if (_stuckClocks != 0) {
+		_txLength = 0;
+		stall();
+		return 5;
+	}
+	if (_nackCount != 0) {
+		_nackCount--;
+		dev = NULL;
+	}
+	if (_powerFault && _powerBytes == 0)
+		dev = NULL;
+
+	if (dev != NULL) {
+		dev->i2cStart();
+		for (i = 0; i < _txLength; i++) {
+			// the power fails in the middle of the burst
+			if (_powerFault && i != 0) {
+				if (_powerBytes == 0)
+					break;
+				_powerBytes--;
+			}
+			dev->i2cWrite(_txBuffer[i], i == 0);
+		}
+		if (i < _txLength)
+			dev = NULL;
+	}
+
+	_busHeld = !sendStop;
+	account(_txAddress, false, (dev != NULL) ? _txLength : 0, dev != NULL);
+	_txLength = 0;
+	if (simYield != NULL)
+		simYield();
+
+	// address not acknowledged
+	if (dev == NULL) {
+		return 2;
+	}
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+	return requestFrom(address, quantity, (uint8_t) true);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop)
+{
+	uint8_t i;
+	GFRTCSimDevice * dev = findDevice(address);
+
+	if (quantity > BUFFER_LENGTH)
+		quantity = BUFFER_LENGTH;
+
+	if (simYield != NULL)
+		simYield();
+	_rxIndex = 0;
+	_rxLength = 0;
+	if (_stuckClocks != 0) {
+		stall();
+		return 0;
+	}
+	if (_nackCount != 0) {
+		_nackCount--;
+		dev = NULL;
+	}
+	if (_powerFault && _powerBytes == 0)
+		dev = NULL;
+	if (_shortCount != 0 && dev != NULL) {
+		_shortCount--;
+		quantity /= 2;
+	}
+	if (dev != NULL) {
+		dev->i2cStart();
+		for (i = 0; i < quantity; i++) {
+			_rxBuffer[i] = dev->i2cRead();
+		}
+		_rxLength = quantity;
+	}
+
+	_busHeld = !sendStop;
+	account(address, true, _rxLength, dev != NULL);
+	if (simYield != NULL)
+		simYield();
+	return _rxLength;
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity)
+{
+	return requestFrom((uint8_t) address, (uint8_t) quantity, (uint8_t) true);
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity, int sendStop)
+{
+	return requestFrom((uint8_t) address, (uint8_t) quantity, (uint8_t) sendStop);
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	// data that does not fit on the buffer is silently dropped as on AVR
+	if (_txLength >= BUFFER_LENGTH)
+		return 0;
+	_txBuffer[_txLength++] = data;
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t * data, size_t quantity)
+{
+	size_t i;
+
+	for (i = 0; i < quantity; i++) {
+		if (!write(data[i]))
+			break;
+	}
+	return i;
+}
+
+int TwoWire::available()
+{
+	return _rxLength - _rxIndex;
+}
+
+int TwoWire::read()
+{
+	if (_rxIndex >= _rxLength)
+		return -1;
+	return _rxBuffer[_rxIndex++];
+}
+
+int TwoWire::peek()
+{
+	if (_rxIndex >= _rxLength)
+		return -1;
+	return _rxBuffer[_rxIndex];
+}
+
+void TwoWire::setWireTimeout(uint32_t timeout, bool reset)
+{
+	(void) reset;
+	_timeout = timeout;
+}
+
+bool TwoWire::getWireTimeoutFlag()
+{
+	return _timeoutFlag;
+}
+
+void TwoWire::clearWireTimeoutFlag()
+{
+	_timeoutFlag = false;
+}
+
+void TwoWire::injectFault(enum gfrtc_sim_faults fault, uint8_t count)
+{
+	switch (fault) {
+	case E_SIM_FAULT_NACK:
+		_nackCount = count;
+		break;
+	case E_SIM_FAULT_SHORT_READ:
+		_shortCount = count;
+		break;
+	case E_SIM_FAULT_SDA_STUCK:
+		_stuckClocks = (count > 9) ? 9 : count;
+		break;
+	case E_SIM_FAULT_POWER_LOSS:
+		_powerFault = true;
+		_powerBytes = count;
+		break;
+	}
+}
+
+void TwoWire::clearFaults()
+{
+	_nackCount = 0;
+	_shortCount = 0;
+	_stuckClocks = 0;
+	_powerFault = false;
+}
+
+bool TwoWire::isSdaStuck()
+{
+	return _stuckClocks != 0;
+}
+
+void TwoWire::clockScl()
+{
+	// the device shifts out one bit per clock until it releases SDA
+	_stats.recoveryClocks++;
+	if (_stuckClocks != 0)
+		_stuckClocks--;
+}
+
+bool TwoWire::attach(GFRTCSimDevice & device)
+{
+	if (_deviceCount >= GFRTC_SIM_MAX_DEVICES)
+		return false;
+	_devices[_deviceCount++] = &device;
+	return true;
+}
+
+void TwoWire::detachAll()
+{
+	_deviceCount = 0;
+}
+
+uint32_t TwoWire::getClock()
+{
+	return _frequency;
+}
+
+void TwoWire::getStats(struct gfrtc_sim_stats & stats)
+{
+	stats = _stats;
+}
+
+void TwoWire::resetStats()
+{
+	memset(&_stats, 0, sizeof(_stats));
+	_busTimeNs = 0;
+	_logHead = 0;
+	_logCount = 0;
+}
+
+bool TwoWire::getLogEntry(uint8_t index, struct gfrtc_sim_transfer & entry)
+{
+	if (index >= _logCount)
+		return false;
+	entry = _log[(_logHead + GFRTC_SIM_LOG_SIZE - _logCount + index) % GFRTC_SIM_LOG_SIZE];
+	return true;
+}
+
+uint8_t TwoWire::getLogCount()
+{
+	return _logCount;
+}
+
+GFRTCSimDevice * TwoWire::findDevice(uint8_t address)
+{
+	uint8_t i;
+
+	for (i = 0; i < _deviceCount; i++) {
+		if (_devices[i]->getAddress() == address)
+			return _devices[i];
+	}
+	return NULL;
+}
+
+void TwoWire::account(uint8_t address, bool read, uint8_t length, bool ack)
+{
+	struct gfrtc_sim_transfer * entry;
+	uint32_t bits;
+	uint64_t ns;
+
+	// START, address byte + ACK, data bytes + ACK/NACK and STOP if released
+	bits = 1 + 9 + 9 * (uint32_t) length + (_busHeld ? 0 : 1);
+	ns = ((uint64_t) bits * SIM_NS_PER_SECOND + _frequency - 1) / _frequency;
+
+	_stats.starts++;
+	if (!_busHeld)
+		_stats.stops++;
+	if (!ack)
+		_stats.nacks++;
+	if (read)
+		_stats.bytesRead += length;
+	else
+		_stats.bytesWritten += length;
+	_stats.bits += bits;
+	_busTimeNs += ns;
+	_stats.busTimeUs = (uint32_t) (_busTimeNs / 1000ULL);
+
+	entry = &_log[_logHead];
+	entry->timeUs = (uint32_t) (simTimeNs / 1000ULL);
+	entry->address = address;
+	entry->read = read;
+	entry->ack = ack;
+	entry->length = length;
+	_logHead = (_logHead + 1) % GFRTC_SIM_LOG_SIZE;
+	if (_logCount < GFRTC_SIM_LOG_SIZE)
+		_logCount++;
+
+	// the caller is blocked while the transfer is on the wire
+	gfrtc_sim_advance_ns(ns);
+}
+
+void TwoWire::stall()
+{
+	// the controller waits for the bus until the timeout expires
+	_stats.timeouts++;
+	_busHeld = false;
+	if (_timeout != 0) {
+		_timeoutFlag = true;
+		gfrtc_sim_advance(_timeout);
+	} else {
+		gfrtc_sim_advance(GFRTC_SIM_HANG_US);
+	}
+}
+
+TwoWire Wire;
+
+TwoWire Wire1;
@@ -0,0 +1,317 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCSIM_H
+#define GFRTCSIM_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Time a transfer blocks when the bus is stuck and no timeout was configured
+ * with setWireTimeout(), a real AVR would block forever
+ */
+#define GFRTC_SIM_HANG_US 1000000UL
+
+/**
+ * Time needed by the simulated chip to complete a temperature conversion
+ */
+#define GFRTC_SIM_CONV_TIME_US 200000UL
+
+/**
+ * Interval between automatic temperature conversions
+ */
+#define GFRTC_SIM_TCXO_INTERVAL_S 64
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Chips that can be simulated
+ */
+enum gfrtc_sim_chips {
+	E_SIM_DS1307,
+	E_SIM_DS3231,
+	E_SIM_DS3232,
+};
+
+/**
+ * Faults that can be injected on a simulated bus
+ */
+enum gfrtc_sim_faults {
+	/** The next transfers are not acknowledged */
+	E_SIM_FAULT_NACK,
+	/** The next reads return half of the requested bytes */
+	E_SIM_FAULT_SHORT_READ,
+	/** A device holds SDA low, as after a reset in the middle of a read, until
+	SCL is clocked a number of times */
+	E_SIM_FAULT_SDA_STUCK,
+	/** The devices lose power after a number of data bytes are written, the
+	rest of the burst is not stored and the next transfers are not
+	acknowledged until the faults are cleared */
+	E_SIM_FAULT_POWER_LOSS,
+};
+
+/**
+ * Bus activity counters
+ */
+struct gfrtc_sim_stats {
+	/** Number of START (and repeated START) conditions */
+	uint32_t starts;
+	/** Number of STOP conditions */
+	uint32_t stops;
+	/** Number of transfers that were not acknowledged */
+	uint32_t nacks;
+	/** Number of data bytes written to devices, address bytes excluded */
+	uint32_t bytesWritten;
+	/** Number of data bytes read from devices */
+	uint32_t bytesRead;
+	/** Number of bit times on the wire, including START, STOP and ACK bits */
+	uint32_t bits;
+	/** Wire time at the bus frequency configured when transfers happened */
+	uint32_t busTimeUs;
+	/** Number of transfers aborted by the timeout */
+	uint32_t timeouts;
+	/** Number of SCL clocks generated by bus recovery */
+	uint32_t recoveryClocks;
+};
+
+/**
+ * Entry on the transfer log of a simulated bus
+ */
+struct gfrtc_sim_transfer {
+	/** Virtual time when the transfer started */
+	uint32_t timeUs;
+	/** 7 bit address of the target device */
+	uint8_t address;
+	/** True for read transfers, false for write transfers */
+	bool read;
+	/** True if the device acknowledged its address */
+	bool ack;
+	/** Number of data bytes transferred */
+	uint8_t length;
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Register level model of the DS1307, DS3231 and DS3232 RTC chips.
+ *
+ * The model implements the register pointer with the wrap around behavior of
+ * each chip, BCD time keeping with day of week and century bit, both alarms
+ * with their mask bits, the A1F, A2F, OSF and BSY flags, temperature
+ * conversions, the aging offset and the INT/SQW output. Time only moves when
+ * gfrtc_sim_advance() is called or when a bus transfer takes place.
+ */
+class GFRTCSimDevice {
+public:
+	/**
+	 * Creates a simulated chip with power on register values.
+	 *
+	 * @param chip The chip to simulate.
+	 * @param address The I2C address where the chip answers.
+	 */
+	GFRTCSimDevice(enum gfrtc_sim_chips chip = E_SIM_DS3231, uint8_t address = 0x68);
+
+	~GFRTCSimDevice();
+
+	/**
+	 * Restores the power on state of the chip: registers are cleared, OSF is
+	 * set and on the DS1307 the clock is halted.
+	 */
+	void reset();
+
+	/**
+	 * Gets the address where this device answers.
+	 */
+	uint8_t getAddress();
+
+	/**
+	 * Gets the simulated chip model.
+	 */
+	enum gfrtc_sim_chips getChip();
+
+	/**
+	 * Loads the time registers from a unix timestamp, 24 hour mode.
+	 */
+	void setTime(uint32_t t);
+
+	/**
+	 * Decodes the time registers to a unix timestamp.
+	 */
+	uint32_t getTime();
+
+	/**
+	 * Direct access to the register map, no bus activity is generated.
+	 */
+	uint8_t peek(uint8_t addr);
+
+	void poke(uint8_t addr, uint8_t value);
+
+	/**
+	 * Sets the frequency error of the crystal in ppm, positive values make the
+	 * clock run fast. The aging offset register is applied on top of this.
+	 */
+	void setDriftPpm(double ppm);
+
+	/**
+	 * Sets the die temperature seen by the next conversion.
+	 */
+	void setTemperature(double celsius);
+
+	/**
+	 * Stops or restarts the oscillator, stopping it also sets OSF.
+	 */
+	void setOscillatorStopped(bool stopped);
+
+	/**
+	 * Routes the INT/SQW output of the chip to a host pin, the handler attached
+	 * to that pin with attachInterrupt() is invoked on every edge.
+	 */
+	void connectInterruptPin(uint8_t pin);
+
+	/**
+	 * Gets the current level of the INT/SQW output.
+	 */
+	bool getIntSqwLevel();
+
+	/**
+	 * Moves the chip time forward.
+	 *
+	 * @param ns Nanoseconds of real time elapsed.
+	 */
+	void advance(uint64_t ns);
+
+	/**
+	 * Gets the real time in nanoseconds until the next internal event of the
+	 * chip (second increment, square wave edge or end of conversion).
+	 */
+	uint64_t nextEvent();
+
+	/**
+	 * Bus interface used by TwoWire.
+	 */
+	void i2cStart();
+
+	void i2cWrite(uint8_t data, bool first);
+
+	uint8_t i2cRead();
+
+	/**
+	 * Linked list of all devices, used to advance time on every device.
+	 */
+	GFRTCSimDevice * next;
+
+private:
+	uint8_t lastRegister();
+
+	bool isHalted();
+
+	double oscillatorRate();
+
+	uint64_t oscillatorStep();
+
+	void tickSecond();
+
+	void checkAlarms();
+
+	void startConversion();
+
+	void finishConversion();
+
+	void updateOutput();
+
+	void writeRegister(uint8_t addr, uint8_t value);
+
+	enum gfrtc_sim_chips _chip;
+	uint8_t _address;
+	uint8_t _regs[256];
+	uint8_t _pointer;
+	uint64_t _subsecond;
+	double _driftRemainder;
+	uint32_t _secondsToConversion;
+	uint64_t _conversionLeft;
+	double _driftPpm;
+	double _temperature;
+	bool _stopped;
+	int _pin;
+	bool _level;
+};
+
+/*-------------------------------------------------------------*
+ *		Function prototypes				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Advances the virtual clock and every simulated device.
+ *
+ * @param us Microseconds to advance.
+ */
+void gfrtc_sim_advance(uint32_t us);
+
+/**
+ * Advances the virtual clock and every simulated device.
+ *
+ * @param ns Nanoseconds to advance.
+ */
+void gfrtc_sim_advance_ns(uint64_t ns);
+
+/**
+ * Gets the virtual time in nanoseconds since the simulation started.
+ */
+uint64_t gfrtc_sim_time_ns();
+
+/**
+ * Computes the time a group of transfers takes on the wire at a given
+ * frequency, useful to compare the cost of an operation at 100 kHz, 400 kHz
+ * and 1 MHz from a single run.
+ *
+ * @param stats Counters of the transfers.
+ * @param frequency Bus frequency in Hz.
+ *
+ * @return The time on the wire in microseconds.
+ */
+uint32_t gfrtc_sim_bus_time_us(const struct gfrtc_sim_stats & stats, uint32_t frequency);
+
+/**
+ * Changes the level of a host pin and invokes the handler attached to it.
+ */
+void gfrtc_sim_set_pin(uint8_t pin, bool level);
+
+/**
+ * Sets a function called before and after every bus phase. A multithreaded
+ * test can yield the processor there, so transfers that are not serialized
+ * overlap even on a single core.
+ *
+ * @param hook The function, NULL to remove it.
+ */
+void gfrtc_sim_set_yield(void (*hook)(void));
+
+#endif
+// End of Header file
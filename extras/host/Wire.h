@@ -0,0 +1,226 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef TWOWIRE_H
+#define TWOWIRE_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "Arduino.h"
+#include "GFRTCSim.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Size of the transmit and receive buffers, same as the AVR Wire library
+ */
+#define BUFFER_LENGTH 32
+
+/**
+ * The bus supports setWireTimeout() as the AVR Wire library
+ */
+#define WIRE_HAS_TIMEOUT
+
+/**
+ * Maximum number of simulated devices that can be attached to a bus
+ */
+#define GFRTC_SIM_MAX_DEVICES 4
+
+/**
+ * Number of entries kept on the transfer log of each bus
+ */
+#define GFRTC_SIM_LOG_SIZE 32
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Host implementation of the Arduino TwoWire class. Transfers are routed to the
+ * simulated devices attached to the bus, every transfer is accounted on the bus
+ * statistics and advances the virtual clock by the time it takes on the wire
+ * at the configured bus frequency.
+ */
+class TwoWire {
+public:
+	TwoWire();
+
+	void begin();
+
+	void end();
+
+	void setClock(uint32_t frequency);
+
+	void beginTransmission(uint8_t address);
+
+	void beginTransmission(int address);
+
+	uint8_t endTransmission();
+
+	uint8_t endTransmission(uint8_t sendStop);
+
+	uint8_t requestFrom(uint8_t address, uint8_t quantity);
+
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop);
+
+	uint8_t requestFrom(int address, int quantity);
+
+	uint8_t requestFrom(int address, int quantity, int sendStop);
+
+	size_t write(uint8_t data);
+
+	size_t write(const uint8_t * data, size_t quantity);
+
+	int available();
+
+	int read();
+
+	int peek();
+
+	/**
+	 * Sets the maximum time a transfer may take, 0 disables the timeout.
+	 *
+	 * @param timeout Timeout in microseconds.
+	 * @param reset Accepted for compatibility, the simulated bus is always
+	 * reset after a timeout.
+	 */
+	void setWireTimeout(uint32_t timeout = 25000, bool reset = false);
+
+	/**
+	 * Checks if a timeout occurred since the flag was cleared.
+	 */
+	bool getWireTimeoutFlag();
+
+	void clearWireTimeoutFlag();
+
+	/**
+	 * Injects a fault on the next transfers.
+	 *
+	 * @param fault The fault to inject.
+	 * @param count Number of transfers affected, for E_SIM_FAULT_SDA_STUCK the
+	 * number of SCL clocks needed to release SDA (1 to 9) and for
+	 * E_SIM_FAULT_POWER_LOSS the number of data bytes written before the power
+	 * fails.
+	 */
+	void injectFault(enum gfrtc_sim_faults fault, uint8_t count = 1);
+
+	/**
+	 * Removes all injected faults.
+	 */
+	void clearFaults();
+
+	/**
+	 * Checks if a device is holding SDA low.
+	 */
+	bool isSdaStuck();
+
+	/**
+	 * Rising edge of SCL generated by software while the controller is off.
+	 */
+	void clockScl();
+
+	/**
+	 * Connects a simulated device to this bus.
+	 *
+	 * @param device The device to attach, it answers on its own I2C address.
+	 *
+	 * @return Returns true if the device was attached, false if the bus is full.
+	 */
+	bool attach(GFRTCSimDevice & device);
+
+	/**
+	 * Disconnects all simulated devices from this bus.
+	 */
+	void detachAll();
+
+	/**
+	 * Gets the frequency configured with setClock().
+	 */
+	uint32_t getClock();
+
+	/**
+	 * Gets the statistics accumulated since the last call to resetStats().
+	 *
+	 * @param stats Reference to structure where statistics are copied.
+	 */
+	void getStats(struct gfrtc_sim_stats & stats);
+
+	/**
+	 * Clears the bus statistics and the transfer log.
+	 */
+	void resetStats();
+
+	/**
+	 * Gets an entry from the transfer log.
+	 *
+	 * @param index Index of the entry, 0 is the oldest transfer still on the log.
+	 * @param entry Reference to structure where the entry is copied.
+	 *
+	 * @return Returns true if the entry exists, false otherwise.
+	 */
+	bool getLogEntry(uint8_t index, struct gfrtc_sim_transfer & entry);
+
+	/**
+	 * Gets the number of valid entries on the transfer log.
+	 */
+	uint8_t getLogCount();
+
+private:
+	GFRTCSimDevice * findDevice(uint8_t address);
+
+	void account(uint8_t address, bool read, uint8_t length, bool ack);
+
+	/**
+	 * Blocks for the timeout (or the hang time) of a transfer on a stuck bus.
+	 */
+	void stall();
+
+	GFRTCSimDevice * _devices[GFRTC_SIM_MAX_DEVICES];
+	uint8_t _deviceCount;
+	uint32_t _frequency;
+	uint8_t _txAddress;
+	uint8_t _txBuffer[BUFFER_LENGTH];
+	uint8_t _txLength;
+	uint8_t _rxBuffer[BUFFER_LENGTH];
+	uint8_t _rxLength;
+	uint8_t _rxIndex;
+	bool _busHeld;
+	struct gfrtc_sim_stats _stats;
+	uint64_t _busTimeNs;
+	struct gfrtc_sim_transfer _log[GFRTC_SIM_LOG_SIZE];
+	uint8_t _logHead;
+	uint8_t _logCount;
+	uint32_t _timeout;
+	bool _timeoutFlag;
+	uint8_t _nackCount;
+	uint8_t _shortCount;
+	uint8_t _stuckClocks;
+	bool _powerFault;
+	uint8_t _powerBytes;
+};
+
+extern TwoWire Wire;
+
+extern TwoWire Wire1;
+
+#endif
+// End of Header file
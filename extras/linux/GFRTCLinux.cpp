@@ -0,0 +1,352 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "Arduino.h"
+#include "Wire.h"
+
+/*-------------------------------------------------------------*
+ *		Private functions				*
+ *-------------------------------------------------------------*/
+static int linux_open(const char * path, int flags)
+{
+	return open(path, flags);
+}
+
+static int linux_close(int fd)
+{
+	return close(fd);
+}
+
+static int linux_ioctl(int fd, unsigned long request, void * arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+static uint64_t linux_time_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+}
+
+/*-------------------------------------------------------------*
+ *		Private data					*
+ *-------------------------------------------------------------*/
+
+/**
+ * System calls used when no replacement is installed
+ */
+static const struct gfrtc_linux_ops linuxSystemOps = {
+	linux_open,
+	linux_close,
+	linux_ioctl,
+};
+
+/**
+ * Start of the time reported by millis() and micros()
+ */
+static uint64_t linuxEpochUs = linux_time_us();
+
+/*-------------------------------------------------------------*
+ *		Arduino core functions				*
+ *-------------------------------------------------------------*/
+HardwareSerial Serial;
+
+unsigned long millis()
+{
+	return (unsigned long) ((linux_time_us() - linuxEpochUs) / 1000ULL);
+}
+
+unsigned long micros()
+{
+	return (unsigned long) (linux_time_us() - linuxEpochUs);
+}
+
+void delay(unsigned long ms)
+{
+	usleep((useconds_t) ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	usleep(us);
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+int digitalRead(uint8_t)
+{
+	return LOW;
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+void attachInterrupt(uint8_t, void (*)(void), int)
+{
+}
+
+void detachInterrupt(uint8_t)
+{
+}
+
+void noInterrupts()
+{
+}
+
+void interrupts()
+{
+}
+
+size_t HardwareSerial::write(uint8_t data)
+{
+	return (fputc(data, stdout) == EOF) ? 0 : 1;
+}
+
+size_t HardwareSerial::print(const char * str)
+{
+	int ret = printf("%s", str);
+	return (ret < 0) ? 0 : ret;
+}
+
+size_t HardwareSerial::print(long num, int base)
+{
+	int ret = printf((base == HEX) ? "%lX" : "%ld", num);
+	return (ret < 0) ? 0 : ret;
+}
+
+size_t HardwareSerial::println(const char * str)
+{
+	int ret = printf("%s\n", str);
+	return (ret < 0) ? 0 : ret;
+}
+
+size_t HardwareSerial::println(long num, int base)
+{
+	int ret = printf((base == HEX) ? "%lX\n" : "%ld\n", num);
+	return (ret < 0) ? 0 : ret;
+}
+
+/*-------------------------------------------------------------*
+ *		i2c-dev bus					*
+ *-------------------------------------------------------------*/
+TwoWire::TwoWire(uint8_t bus)
+{
+	_ops = &linuxSystemOps;
+	_fd = -1;
+	_bus = bus;
+	_txLength = 0;
+	_txHeld = false;
+	_rxLength = 0;
+	_rxIndex = 0;
+	_transactions = 0;
+}
+
+void TwoWire::begin()
+{
+	char path[20];
+
+	if (_fd >= 0)
+		return;
+	snprintf(path, sizeof(path), "/dev/i2c-%u", _bus);
+	_fd = _ops->open(path, O_RDWR);
+	_txHeld = false;
+	_transactions = 0;
+}
+
+void TwoWire::end()
+{
+	if (_fd >= 0)
+		_ops->close(_fd);
+	_fd = -1;
+}
+
+void TwoWire::setClock(uint32_t)
+{
+	// bus frequency is set by the adapter driver (device tree)
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	// a held write not followed by a read is sent on its own
+	if (_txHeld)
+		transfer(_txAddress, NULL, 0);
+	_txAddress = address;
+	_txLength = 0;
+}
+
+void TwoWire::beginTransmission(int address)
+{
+	beginTransmission((uint8_t) address);
+}
+
+uint8_t TwoWire::endTransmission()
+{
+	return endTransmission((uint8_t) true);
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+	if (!sendStop) {
+		// wait for the read that follows to issue both messages together
+		_txHeld = true;
+		return 0;
+	}
+	// send the write now, transfer() picks it from the transmit buffer
+	_txHeld = true;
+	return transfer(_txAddress, NULL, 0);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+	return requestFrom(address, quantity, (uint8_t) true);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t)
+{
+	if (quantity > BUFFER_LENGTH)
+		quantity = BUFFER_LENGTH;
+
+	// only a write to the same device can be combined with this read
+	if (_txHeld && _txAddress != address)
+		transfer(_txAddress, NULL, 0);
+
+	_rxIndex = 0;
+	_rxLength = 0;
+	if (transfer(address, _rxBuffer, quantity) != 0)
+		return 0;
+	_rxLength = quantity;
+	return quantity;
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity)
+{
+	return requestFrom((uint8_t) address, (uint8_t) quantity, (uint8_t) true);
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity, int sendStop)
+{
+	return requestFrom((uint8_t) address, (uint8_t) quantity, (uint8_t) sendStop);
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	if (_txLength >= BUFFER_LENGTH)
+		return 0;
+	_txBuffer[_txLength++] = data;
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t * data, size_t quantity)
+{
+	size_t i;
+
+	for (i = 0; i < quantity; i++) {
+		if (!write(data[i]))
+			break;
+	}
+	return i;
+}
+
+int TwoWire::available()
+{
+	return _rxLength - _rxIndex;
+}
+
+int TwoWire::read()
+{
+	if (_rxIndex >= _rxLength)
+		return -1;
+	return _rxBuffer[_rxIndex++];
+}
+
+int TwoWire::peek()
+{
+	if (_rxIndex >= _rxLength)
+		return -1;
+	return _rxBuffer[_rxIndex];
+}
+
+void TwoWire::setBus(uint8_t bus)
+{
+	_bus = bus;
+}
+
+void TwoWire::setOps(const struct gfrtc_linux_ops * ops)
+{
+	_ops = (ops != NULL) ? ops : &linuxSystemOps;
+}
+
+uint32_t TwoWire::getTransactionCount()
+{
+	return _transactions;
+}
+
+uint8_t TwoWire::transfer(uint8_t address, uint8_t * rxBuffer, uint8_t rxLength)
+{
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data data;
+	uint8_t count = 0;
+
+	// held write goes first, the kernel inserts a repeated START before the read
+	if (_txHeld) {
+		msgs[count].addr = _txAddress;
+		msgs[count].flags = 0;
+		msgs[count].len = _txLength;
+		msgs[count].buf = _txBuffer;
+		count++;
+		_txHeld = false;
+	}
+	if (rxLength > 0) {
+		msgs[count].addr = address;
+		msgs[count].flags = I2C_M_RD;
+		msgs[count].len = rxLength;
+		msgs[count].buf = rxBuffer;
+		count++;
+	}
+	if (count == 0)
+		return 0;
+	if (_fd < 0)
+		return 4;
+
+	data.msgs = msgs;
+	data.nmsgs = count;
+	_transactions++;
+	if (_ops->ioctl(_fd, I2C_RDWR, &data) < 0) {
+		// address or data not acknowledged
+		if (errno == ENXIO || errno == EREMOTEIO)
+			return 2;
+		return 4;
+	}
+	return 0;
+}
+
+TwoWire Wire;
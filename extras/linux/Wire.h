@@ -0,0 +1,146 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef TWOWIRE_H
+#define TWOWIRE_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "Arduino.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Size of the transmit and receive buffers, same as the AVR Wire library
+ */
+#define BUFFER_LENGTH 32
+
+/**
+ * Adapter used by the Wire instance, /dev/i2c-1 is the header I2C bus on
+ * Raspberry Pi class boards
+ */
+#ifndef GFRTC_LINUX_DEFAULT_BUS
+#define GFRTC_LINUX_DEFAULT_BUS 1
+#endif
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * System calls used to reach the i2c-dev driver. Replacing them allows the
+ * bus code to run against a fake device on any Linux box.
+ */
+struct gfrtc_linux_ops {
+	int (*open)(const char * path, int flags);
+	int (*close)(int fd);
+	int (*ioctl)(int fd, unsigned long request, void * arg);
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Linux implementation of the Arduino TwoWire class on top of i2c-dev.
+ *
+ * Every transfer is issued as a single I2C_RDWR ioctl. A write ended with
+ * endTransmission(false) is held and sent together with the following
+ * requestFrom() to the same address, so a register pointer write followed by
+ * a read becomes one system call with a repeated START in between. The status
+ * of a held write is reported by requestFrom(), which returns 0 if any of the
+ * two messages failed.
+ */
+class TwoWire {
+public:
+	TwoWire(uint8_t bus = GFRTC_LINUX_DEFAULT_BUS);
+
+	void begin();
+
+	void end();
+
+	void setClock(uint32_t frequency);
+
+	void beginTransmission(uint8_t address);
+
+	void beginTransmission(int address);
+
+	uint8_t endTransmission();
+
+	uint8_t endTransmission(uint8_t sendStop);
+
+	uint8_t requestFrom(uint8_t address, uint8_t quantity);
+
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop);
+
+	uint8_t requestFrom(int address, int quantity);
+
+	uint8_t requestFrom(int address, int quantity, int sendStop);
+
+	size_t write(uint8_t data);
+
+	size_t write(const uint8_t * data, size_t quantity);
+
+	int available();
+
+	int read();
+
+	int peek();
+
+	/**
+	 * Selects the adapter opened by begin(), /dev/i2c-<bus>.
+	 */
+	void setBus(uint8_t bus);
+
+	/**
+	 * Replaces the system calls used to reach the adapter.
+	 *
+	 * @param ops Pointer to the functions to use, NULL restores the system
+	 * calls. The structure must remain valid while the bus is in use.
+	 */
+	void setOps(const struct gfrtc_linux_ops * ops);
+
+	/**
+	 * Gets the number of I2C_RDWR system calls issued since begin().
+	 */
+	uint32_t getTransactionCount();
+
+private:
+	uint8_t transfer(uint8_t address, uint8_t * rxBuffer, uint8_t rxLength);
+
+	const struct gfrtc_linux_ops * _ops;
+	int _fd;
+	uint8_t _bus;
+	uint8_t _txAddress;
+	uint8_t _txBuffer[BUFFER_LENGTH];
+	uint8_t _txLength;
+	bool _txHeld;
+	uint8_t _rxBuffer[BUFFER_LENGTH];
+	uint8_t _rxLength;
+	uint8_t _rxIndex;
+	uint32_t _transactions;
+};
+
+extern TwoWire Wire;
+
+#endif
+// End of Header file
@@ -0,0 +1,224 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+
+/**
+ * Check of the Linux i2c-dev backend against a fake DS3231.
+ *
+ * The open, close and ioctl system calls are replaced with Wire.setOps() by
+ * functions that emulate the registers and the register pointer of a DS3231
+ * at address 0x68. The program checks that set(), get() and getTemperature()
+ * are issued as a single I2C_RDWR ioctl each, that a read is sent as a write
+ * of the register pointer followed by a read with a repeated START and that
+ * a chip that does not answer (ENXIO, the error of i2c-dev on a NACK) is
+ * reported as a failed call and as a missing chip.
+ *
+ * Usage: GFRTCLinuxCheck
+ *
+ * The program exits with status 1 if any of the checks fails.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <Wire.h>
+#include "GFRTC.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Address of the fake chip and last register of the DS3231 map
+ */
+#define FAKE_ADDRESS	0x68
+#define FAKE_LAST_REG	0x12
+
+/**
+ * File descriptor returned by the fake open()
+ */
+#define FAKE_FD		3
+
+/**
+ * Time written and read back, 2023-11-14 22:13:20
+ */
+#define CHECK_TIME	1700000000UL
+
+/*-------------------------------------------------------------*
+ *		Fake i2c-dev adapter				*
+ *-------------------------------------------------------------*/
+static uint8_t regs[FAKE_LAST_REG + 1];
+static uint8_t pointer;
+static bool nack;
+static uint32_t ioctls;
+static uint32_t messages;
+static bool restarted;
+
+static uint32_t failures = 0;
+
+static int fake_open(const char * path, int flags)
+{
+	(void) path;
+	(void) flags;
+	return FAKE_FD;
+}
+
+static int fake_close(int fd)
+{
+	(void) fd;
+	return 0;
+}
+
+/**
+ * Moves the register pointer, the DS3231 wraps from the last register to 0.
+ */
+static void fake_next()
+{
+	pointer = (pointer == FAKE_LAST_REG) ? 0 : pointer + 1;
+}
+
+static int fake_ioctl(int fd, unsigned long request, void * arg)
+{
+	struct i2c_rdwr_ioctl_data * data = (struct i2c_rdwr_ioctl_data *) arg;
+	struct i2c_msg * msg;
+	unsigned int m;
+	int i;
+
+	ioctls++;
+	if (fd != FAKE_FD || request != I2C_RDWR) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// a read after a write in the same call is a repeated START
+	restarted = data->nmsgs == 2 && !(data->msgs[0].flags & I2C_M_RD) && (data->msgs[1].flags & I2C_M_RD);
+	messages = data->nmsgs;
+	for (m = 0; m < data->nmsgs; m++) {
+		msg = &data->msgs[m];
+		if (nack || msg->addr != FAKE_ADDRESS) {
+			errno = ENXIO;
+			return -1;
+		}
+		if (msg->flags & I2C_M_RD) {
+			for (i = 0; i < msg->len; i++) {
+				msg->buf[i] = regs[pointer];
+				fake_next();
+			}
+		} else if (msg->len != 0) {
+			pointer = msg->buf[0];
+			for (i = 1; i < msg->len; i++) {
+				regs[pointer] = msg->buf[i];
+				fake_next();
+			}
+		}
+	}
+	return (int) data->nmsgs;
+}
+
+static const struct gfrtc_linux_ops fakeOps = {
+	fake_open,
+	fake_close,
+	fake_ioctl,
+};
+
+/*-------------------------------------------------------------*
+ *		Helpers						*
+ *-------------------------------------------------------------*/
+static void fail(const char * call, const char * what, uint32_t value)
+{
+	if (failures++ < 10)
+		fprintf(stderr, "%s: %s %u\n", call, what, value);
+}
+
+/**
+ * Checks the system calls issued by the last call of the library.
+ */
+static void checkCalls(const char * call, bool read)
+{
+	if (ioctls != 1)
+		fail(call, "ioctl calls", ioctls);
+	if (read && !restarted)
+		fail(call, "read without repeated START, messages", messages);
+	ioctls = 0;
+}
+
+/*-------------------------------------------------------------*
+ *		Main						*
+ *-------------------------------------------------------------*/
+int main()
+{
+	uint8_t expected[7];
+	timelib_t t;
+	int16_t temperature;
+
+	// valid date on the fake chip and 25.25 degrees on the sensor
+	regs[0x04] = 0x01;
+	regs[0x05] = 0x01;
+	regs[0x11] = 25;
+	regs[0x12] = 0x40;
+
+	Wire.setOps(&fakeOps);
+	if (!GFRTC.begin(true) || !GFRTC.isPresent()) {
+		fprintf(stderr, "the fake chip was not found\n");
+		return 1;
+	}
+
+	ioctls = 0;
+	if (!GFRTC.set(CHECK_TIME))
+		fail("set", "failed", 0);
+	checkCalls("set", false);
+	gfrtc_time2regs(CHECK_TIME, expected);
+	if (memcmp(regs, expected, sizeof(expected)) != 0)
+		fail("set", "registers differ from the codec, seconds", regs[0]);
+
+	t = GFRTC.get();
+	if (t != CHECK_TIME)
+		fail("get", "returned", (uint32_t) t);
+	checkCalls("get", true);
+
+	temperature = GFRTC.getTemperature();
+	if (temperature != 25)
+		fail("getTemperature", "returned", (uint32_t) temperature);
+	checkCalls("getTemperature", true);
+
+	// the chip stops answering, i2c-dev reports ENXIO
+	nack = true;
+	t = GFRTC.get();
+	if (t != 0)
+		fail("get on a NACK", "returned", (uint32_t) t);
+	if (ioctls == 0)
+		fail("get on a NACK", "ioctl calls", ioctls);
+	if (GFRTC.isPresent())
+		fail("get on a NACK", "chip still present", 1);
+	ioctls = 0;
+
+	// and answers again
+	nack = false;
+	t = GFRTC.get();
+	if (t != CHECK_TIME)
+		fail("get after the NACK", "returned", (uint32_t) t);
+	checkCalls("get after the NACK", true);
+	if (!GFRTC.isPresent())
+		fail("get after the NACK", "chip missing", 0);
+
+	Wire.setOps(NULL);
+	printf("failures: %u\n", failures);
+	return (failures != 0) ? 1 : 0;
+}
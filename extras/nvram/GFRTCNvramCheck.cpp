@@ -0,0 +1,215 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+
+/**
+ * Random operation check of the GFRTCNvram mirror on the host simulator.
+ *
+ * Reads, writes, flushes and calls to update() with random offsets and sizes
+ * are applied to the mirror of a DS3232 and to a reference copy of the NVRAM.
+ * Accesses fall inside, outside and across the mirrored window, which is
+ * moved every few thousand operations, and some flushes are made to fail by
+ * the simulated bus. Every read must match the reference, the number of dirty
+ * ranges must stay within GFRTC_NVRAM_MAX_RANGES and after every successful
+ * flush the chip must hold the reference copy.
+ *
+ * Usage: GFRTCNvramCheck [operations] [seed]
+ *
+ * The program exits with status 1 if the mirror and the reference disagree.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Wire.h>
+#include "GFRTC.h"
+#include "GFRTCNvram.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Default number of random operations
+ */
+#define CHECK_OPERATIONS	20000
+
+/**
+ * Operations between changes of the mirrored window
+ */
+#define CHECK_WINDOW_OPS	2500
+
+/**
+ * Milliseconds between the first unflushed write and the automatic flush
+ */
+#define CHECK_INTERVAL	50
+
+/*-------------------------------------------------------------*
+ *		Simulated hardware				*
+ *-------------------------------------------------------------*/
+static GFRTCSimDevice rtc(E_SIM_DS3232);
+
+/**
+ * Expected contents of the NVRAM
+ */
+static uint8_t reference[SRAM_SIZE];
+
+static uint32_t failures = 0;
+static uint32_t counts[5];
+
+/*-------------------------------------------------------------*
+ *		Helpers						*
+ *-------------------------------------------------------------*/
+static void fail(const char * what, uint32_t op, uint32_t value)
+{
+	if (failures++ < 10)
+		fprintf(stderr, "op %u: %s %u\n", op, what, value);
+}
+
+/**
+ * Picks a random range that fits the NVRAM, small ranges are more frequent.
+ */
+static void randomRange(uint8_t & offset, uint16_t & size)
+{
+	offset = (uint8_t) (rand() % SRAM_SIZE);
+	size = (rand() % 4 == 0) ? (uint16_t) (rand() % 64) : (uint16_t) (rand() % 8 + 1);
+	if (offset + size > SRAM_SIZE)
+		size = SRAM_SIZE - offset;
+}
+
+/**
+ * Compares the chip against the reference copy.
+ */
+static void checkChip(uint32_t op)
+{
+	uint8_t i;
+
+	for (i = 0; i < SRAM_SIZE; i++) {
+		if (rtc.peek(SRAM_START_ADDR + i) != reference[i]) {
+			fail("chip differs at", op, i);
+			return;
+		}
+	}
+}
+
+static bool moveWindow(uint32_t op)
+{
+	uint8_t offset = (uint8_t) (rand() % SRAM_SIZE);
+	uint8_t size = (uint8_t) (rand() % (SRAM_SIZE - offset) + 1);
+
+	if (!GFRTCNvram.end())
+		fail("end", op, 0);
+	checkChip(op);
+	if (!GFRTCNvram.begin(offset, size, CHECK_INTERVAL)) {
+		fail("begin", op, offset);
+		return false;
+	}
+	return true;
+}
+
+/*-------------------------------------------------------------*
+ *		Main						*
+ *-------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+	uint32_t operations = (argc > 1) ? (uint32_t) atol(argv[1]) : CHECK_OPERATIONS;
+	uint8_t data[SRAM_SIZE];
+	uint32_t op;
+	uint16_t i, size;
+	uint8_t offset;
+	bool ok;
+
+	srand((argc > 2) ? (unsigned) atol(argv[2]) : 1);
+	Wire.attach(rtc);
+	GFRTC.begin(true);
+	for (i = 0; i < SRAM_SIZE; i++) {
+		reference[i] = (uint8_t) rand();
+		rtc.poke(SRAM_START_ADDR + i, reference[i]);
+	}
+	GFRTCNvram.begin(0, SRAM_SIZE, CHECK_INTERVAL);
+
+	for (op = 0; op < operations; op++) {
+		if (op % CHECK_WINDOW_OPS == CHECK_WINDOW_OPS - 1 && !moveWindow(op))
+			break;
+
+		switch (rand() % 10) {
+		case 0:
+		case 1:
+		case 2:
+			// read, from the mirror or from the chip
+			randomRange(offset, size);
+			memset(data, 0xA5, sizeof(data));
+			if (!GFRTCNvram.read(offset, data, size))
+				fail("read", op, offset);
+			else if (memcmp(data, &reference[offset], size) != 0)
+				fail("read mismatch at", op, offset);
+			counts[0]++;
+			break;
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+			// write, the reference is only updated when the write succeeds
+			randomRange(offset, size);
+			for (i = 0; i < size; i++)
+				data[i] = (uint8_t) rand();
+			if (!GFRTCNvram.write(offset, data, size))
+				fail("write", op, offset);
+			else
+				memcpy(&reference[offset], data, size);
+			counts[1]++;
+			break;
+		case 7:
+			// flush, sometimes on a bus that does not answer
+			if (rand() % 4 == 0) {
+				Wire.injectFault(E_SIM_FAULT_NACK, (uint8_t) (rand() % 8 + 1));
+				GFRTCNvram.flush();
+				Wire.clearFaults();
+				counts[2]++;
+			}
+			ok = GFRTCNvram.flush();
+			if (!ok)
+				fail("flush", op, 0);
+			else if (GFRTCNvram.isDirty())
+				fail("dirty after flush", op, GFRTCNvram.getDirtyRanges());
+			else
+				checkChip(op);
+			counts[3]++;
+			break;
+		default:
+			// automatic flush after the interval
+			delay(rand() % (2 * CHECK_INTERVAL));
+			if (!GFRTCNvram.update())
+				fail("update", op, 0);
+			counts[4]++;
+			break;
+		}
+		if (GFRTCNvram.getDirtyRanges() > GFRTC_NVRAM_MAX_RANGES)
+			fail("dirty ranges", op, GFRTCNvram.getDirtyRanges());
+	}
+
+	if (!GFRTCNvram.end())
+		fail("end", op, 0);
+	checkChip(op);
+
+	printf("operations: %u\n", op);
+	printf("reads: %u writes: %u flushes: %u (%u on a failing bus) updates: %u\n",
+		counts[0], counts[1], counts[3], counts[2], counts[4]);
+	printf("failures: %u\n", failures);
+	return (failures != 0) ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+
+/**
+ * Power loss test of the GFRTCLog store on the host simulator.
+ *
+ * Values of a few keys updated often and of some keys updated rarely are
+ * appended to the log on a DS3232. Before some of the appends the simulated
+ * chip is set to lose power after a random number of bytes, which tears the
+ * record, the copies of other keys carried forward or the checkpoint written
+ * by writeNVRAM() at any byte. The program then restarts as after a reset:
+ * begin() must find the store and get() must return the last value appended
+ * for every key, or the previous one for the key whose append was torn.
+ *
+ * The bus transactions of every append without a power loss are counted as
+ * well: one write for the record, one read and one write for each value
+ * copied forward and one write for each checkpoint.
+ *
+ * Usage: GFRTCPowerLoss [appends] [seed]
+ *
+ * The program exits with status 1 if the store was not found after a power
+ * loss, a key lost its value or an append used more transactions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <Wire.h>
+#include "GFRTC.h"
+#include "GFRTCLog.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Default number of appends
+ */
+#define POWER_APPENDS	20000
+
+/**
+ * Region of NVRAM used by the store
+ */
+#define POWER_OFFSET	0
+#define POWER_SIZE	236
+
+/**
+ * Keys updated on most appends and keys updated once in a while
+ */
+#define POWER_HOT_KEYS	2
+#define POWER_RARE_KEYS	6
+
+/**
+ * Largest number of bytes written before the power fails, an append with
+ * copies and a checkpoint writes less than this
+ */
+#define POWER_MAX_BYTES	160
+
+#define POWER_KEYS	(POWER_HOT_KEYS + POWER_RARE_KEYS)
+
+/*-------------------------------------------------------------*
+ *		Simulated hardware				*
+ *-------------------------------------------------------------*/
+static GFRTCSimDevice rtc(E_SIM_DS3232);
+
+/**
+ * Last value appended for each key, 0 if the key was never written
+ */
+static uint32_t values[POWER_KEYS];
+
+static uint32_t failures = 0;
+
+/**
+ * Bus transactions of the appends without a power loss
+ */
+static uint32_t transactions = 0;
+static uint32_t maxTransactions = 0;
+
+/*-------------------------------------------------------------*
+ *		Helpers						*
+ *-------------------------------------------------------------*/
+static void fail(const char * what, uint32_t append, uint32_t value)
+{
+	if (failures++ < 10)
+		fprintf(stderr, "append %u: %s %u\n", append, what, value);
+}
+
+/**
+ * Restarts the library as after a reset.
+ */
+static bool restart()
+{
+	GFRTC.begin(true);
+	return GFRTCLog.begin(POWER_OFFSET, POWER_SIZE);
+}
+
+/**
+ * Checks the value of every key, the key of a torn append can hold the new
+ * value or the previous one.
+ */
+static void checkKeys(uint32_t append, int8_t torn, uint32_t value)
+{
+	uint32_t data;
+	int16_t size;
+	uint8_t key;
+
+	for (key = 0; key < POWER_KEYS; key++) {
+		data = 0;
+		size = GFRTCLog.get(key, &data, sizeof(data));
+		if (size < 0)
+			data = 0;
+		else if (size != sizeof(data))
+			fail("size of key", append, key);
+
+		if (key == torn && data == value) {
+			values[key] = value;
+		} else if (data != values[key]) {
+			fail("value lost of key", append, key);
+			values[key] = data;
+		}
+	}
+}
+
+/**
+ * Checks the bus transactions of an append that wrote a number of records,
+ * the record itself and the copies carried forward.
+ */
+static void checkCost(uint32_t append, uint16_t records, const struct gfrtc_sim_stats & stats)
+{
+	// a read is a pointer write and a repeated START, a write a single START
+	uint32_t reads = stats.starts - stats.stops;
+	uint32_t writes = stats.stops - reads;
+
+	transactions += stats.stops;
+	if (stats.stops > maxTransactions)
+		maxTransactions = stats.stops;
+	if (reads > (uint32_t) records - 1)
+		fail("reads on the append", append, reads);
+	if (writes > (uint32_t) records + 1 + records / GFRTC_LOG_CHECKPOINT_INTERVAL)
+		fail("writes on the append", append, writes);
+}
+
+/*-------------------------------------------------------------*
+ *		Main						*
+ *-------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+	uint32_t appends = (argc > 1) ? (uint32_t) atol(argv[1]) : POWER_APPENDS;
+	struct gfrtc_sim_stats stats;
+	uint32_t i, value, tears = 0, rejected = 0;
+	uint16_t seq;
+	uint8_t key;
+	bool ok;
+
+	srand((argc > 2) ? (unsigned) atol(argv[2]) : 1);
+	Wire.attach(rtc);
+	GFRTC.begin(true);
+	GFRTCLog.begin(POWER_OFFSET, POWER_SIZE);
+	if (!GFRTCLog.format()) {
+		fprintf(stderr, "format failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < appends; i++) {
+		key = (rand() % 50 == 0) ? POWER_HOT_KEYS + rand() % POWER_RARE_KEYS : rand() % POWER_HOT_KEYS;
+		value = (uint32_t) rand() | 1;
+
+		if (rand() % 3 != 0) {
+			seq = GFRTCLog.getSequence();
+			Wire.resetStats();
+			if (!GFRTCLog.append(key, &value, sizeof(value))) {
+				fail("append rejected, key", i, key);
+				rejected++;
+				continue;
+			}
+			Wire.getStats(stats);
+			if (seq != 0)
+				checkCost(i, (uint16_t) (GFRTCLog.getSequence() - seq), stats);
+			values[key] = value;
+			if (rand() % 20 == 0) {
+				if (!restart())
+					fail("begin after reset", i, 0);
+				checkKeys(i, -1, 0);
+			}
+			continue;
+		}
+
+		// the chip loses power in the middle of the append
+		Wire.injectFault(E_SIM_FAULT_POWER_LOSS, (uint8_t) (rand() % POWER_MAX_BYTES));
+		ok = GFRTCLog.append(key, &value, sizeof(value));
+		Wire.clearFaults();
+		tears++;
+		if (!restart()) {
+			fail("begin after power loss", i, 0);
+			GFRTCLog.format();
+			continue;
+		}
+		if (ok)
+			values[key] = value;
+		checkKeys(i, key, value);
+	}
+
+	printf("appends: %u (%u with a power loss)\n", appends, tears);
+	printf("appends rejected: %u\n", rejected);
+	printf("bus transactions per append: %.2f (max %u)\n",
+		(double) transactions / (appends - tears - rejected), maxTransactions);
+	printf("records on the log: %u\n", (uint32_t) GFRTCLog.getSequence());
+	printf("failures: %u\n", failures);
+	return (failures != 0) ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#	Geek Factory GFRTC Library
+#	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+#
+#	This program is free software: you can redistribute it and/or modify
+#	it under the terms of the GNU General Public License as published by
+#	the Free Software Foundation, either version 3 of the License, or
+#	(at your option) any later version.
+#
+#	This program is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU General Public License for more details.
+#
+#	You should have received a copy of the GNU General Public License
+#	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#	Author website: https://www.geekfactory.mx
+#	Author e-mail: ruben at geekfactory dot mx
+#
+# Flash and RAM used by each footprint tier of the library.
+#
+# The library files are compiled with -Os for every toolchain found on the
+# PATH (avr-g++ for the ATmega328P, arm-none-eabi-g++ for a Cortex-M0+ and the
+# host g++), using the headers of extras/host for the Arduino core. The core
+# (GFRTC.cpp and GFRTCCodec.cpp) is reported for each tier and the optional
+# classes for the full tier. Numbers are the size of the object files, the
+# linker drops the functions a sketch does not call, so they are the upper
+# bound of a sketch that uses every feature of the tier.
+#
+# Usage: extras/size/size-report.sh <TimeLib folder>
+#
+# The output is a markdown table, flash is text + data and RAM is data + bss.
+
+set -e
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 <TimeLib folder>" >&2
+	exit 2
+fi
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+TIMELIB=$1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CFLAGS="-Os -std=gnu++11 -ffunction-sections -fdata-sections -fno-exceptions -fno-rtti -I$ROOT/extras/host -I$ROOT/src -I$TIMELIB"
+
+# prints "flash ram" for a group of files compiled with a toolchain
+measure() {
+	cc=$1; size=$2; flags=$3; shift 3
+	objs=""
+	for f in "$@"; do
+		o="$WORK/$(basename "$f" .cpp).o"
+		$cc $CFLAGS $flags -c "$ROOT/src/$f" -o "$o"
+		objs="$objs $o"
+	done
+	$size -t $objs | tail -n 1 | awk '{ print $1 + $2, $2 + $3 }'
+}
+
+report() {
+	name=$1; cc=$2; size=$3; flags=$4
+	command -v "$cc" > /dev/null 2>&1 || return 0
+
+	for tier in 0 1 2 3; do
+		set -- $(measure "$cc" "$size" "$flags -DGFRTC_TIER=$tier" GFRTC.cpp GFRTCCodec.cpp)
+		echo "| $name | GFRTC tier $tier | $1 | $2 |"
+	done
+	for module in GFRTCAsync GFRTCSqw GFRTCScheduler GFRTCNvram GFRTCLog GFRTCCalib; do
+		set -- $(measure "$cc" "$size" "$flags" $module.cpp)
+		echo "| $name | $module | $1 | $2 |"
+	done
+}
+
+echo "| Target | Code | Flash | RAM |"
+echo "|---|---|---:|---:|"
+report "ATmega328P" avr-g++ avr-size "-mmcu=atmega328p -DF_CPU=16000000UL"
+report "Cortex-M0+" arm-none-eabi-g++ arm-none-eabi-size "-mcpu=cortex-m0plus -mthumb"
+report "Host (x86-64)" g++ size ""
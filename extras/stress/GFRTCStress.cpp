@@ -0,0 +1,324 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+
+/**
+ * Concurrency stress test of the GFRTC library on the host simulator.
+ *
+ * Several std::thread workers call the blocking API on two chips while other
+ * threads read the published time without the bus, an asynchronous transfer
+ * is polled from its own thread and a simulated interrupt handler reads the
+ * published time on every edge of the 1 Hz square wave. A ticker thread moves
+ * the virtual clock in steps of up to two seconds, so a torn copy of the
+ * published time is far off the time of the simulated chip.
+ *
+ * Usage: GFRTCStress [iterations]
+ *
+ * The program exits with status 1 if a call failed, a read-modify-write of
+ * the control register was lost or a time was outside the expected range.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <Wire.h>
+#include "GFRTC.h"
+#include "GFRTCAsync.h"
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Default number of calls made by each worker
+ */
+#define STRESS_ITERATIONS	5000
+
+/**
+ * Host pin connected to the INT/SQW output of the chip
+ */
+#define STRESS_SQW_PIN	2
+
+/**
+ * Seconds a time may differ from the simulated chip, covers the truncation of
+ * both the chip time and the milliseconds elapsed since it was published
+ */
+#define STRESS_TOLERANCE_S	2
+
+/*-------------------------------------------------------------*
+ *		Simulated hardware				*
+ *-------------------------------------------------------------*/
+
+/**
+ * DS3231 driven by the GFRTC instance and DS3232 on the second bus
+ */
+static GFRTCSimDevice rtc(E_SIM_DS3231);
+static GFRTCSimDevice rtc2(E_SIM_DS3232);
+static GFRTCClass second(Wire1);
+
+/**
+ * Bus lock, the simulator is also advanced while holding it
+ */
+static std::recursive_mutex busMutex;
+
+/**
+ * Chip time minus virtual seconds, measured before the threads start
+ */
+static timelib_t offset;
+
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> failures(0);
+static std::atomic<uint32_t> published(0);
+static std::atomic<uint32_t> unpublished(0);
+static std::atomic<uint32_t> isrReads(0);
+
+/*-------------------------------------------------------------*
+ *		Helpers						*
+ *-------------------------------------------------------------*/
+static void lockBus(void * context)
+{
+	((std::recursive_mutex *) context)->lock();
+}
+
+static void unlockBus(void * context)
+{
+	((std::recursive_mutex *) context)->unlock();
+}
+
+/**
+ * Gives other threads a chance to run in the middle of a transfer.
+ */
+static void yieldBus()
+{
+	std::this_thread::yield();
+}
+
+static void fail(const char * what, uint32_t value)
+{
+	if (failures++ < 10)
+		fprintf(stderr, "%s: %u\n", what, value);
+}
+
+/**
+ * Checks a time against the chip time between two values of millis().
+ */
+static void checkTime(const char * what, timelib_t t, uint32_t before, uint32_t after)
+{
+	timelib_t low = offset + before / 1000 - STRESS_TOLERANCE_S;
+	timelib_t high = offset + after / 1000 + STRESS_TOLERANCE_S;
+
+	if (t < low || t > high)
+		fail(what, t - offset);
+}
+
+/**
+ * Simulated interrupt handler, runs on the thread that moves the simulator
+ * while the bus lock is held by any thread.
+ */
+static void sqwIsr()
+{
+	timelib_t t;
+	uint32_t now = millis();
+
+	if (GFRTC.getPublishedTime(t)) {
+		checkTime("isr time", t, now, now);
+		isrReads++;
+	}
+}
+
+/*-------------------------------------------------------------*
+ *		Threads						*
+ *-------------------------------------------------------------*/
+static void ticker()
+{
+	uint32_t step = 1;
+
+	while (running) {
+		{
+			std::lock_guard<std::recursive_mutex> guard(busMutex);
+			gfrtc_sim_advance(step * 1000UL);
+		}
+		step = (step * 7919UL + 13) % 2000 + 1;
+		std::this_thread::yield();
+	}
+}
+
+/**
+ * Toggles the interrupt enable bit of one alarm and checks that the other
+ * worker did not overwrite it with a stale copy of the control register.
+ */
+static void alarmWorker(enum gfrtc_alarms alarm, uint32_t iterations)
+{
+	uint8_t bit = (alarm == E_ALARM_1) ? GFRTC_BIT_A1IE : GFRTC_BIT_A2IE;
+	bool enable, ok;
+	uint8_t control;
+	uint32_t i;
+
+	for (i = 0; i < iterations; i++) {
+		enable = (i & 1) != 0;
+		if (!GFRTC.setAlarmInterrupt(alarm, enable)) {
+			fail("setAlarmInterrupt", i);
+			continue;
+		}
+		control = GFRTC.readRegister(GFRTC_REG_CONTROL, &ok);
+		if (!ok)
+			fail("readRegister", i);
+		else if (((control >> bit) & 1) != enable)
+			fail("lost control update", i);
+	}
+}
+
+static void timeWorker(uint32_t iterations)
+{
+	struct timelib_tm dt;
+	uint32_t i, before;
+	timelib_t t;
+	int16_t quarters;
+
+	for (i = 0; i < iterations; i++) {
+		before = millis();
+		switch (i % 3) {
+		case 0:
+			t = GFRTC.get();
+			if (t == 0)
+				fail("get", i);
+			else
+				checkTime("get", t, before, millis());
+			break;
+		case 1:
+			if (!GFRTC.read(dt))
+				fail("read", i);
+			break;
+		default:
+			if (!GFRTC.readTemperature(quarters))
+				fail("readTemperature", i);
+			break;
+		}
+	}
+}
+
+static void readAllWorker(uint32_t iterations)
+{
+	GFRTCClass * const rtcs[2] = { &GFRTC, &second };
+	timelib_t times[2];
+	uint32_t i, before;
+
+	for (i = 0; i < iterations; i++) {
+		before = millis();
+		if (GFRTCClass::readAll(rtcs, times, 2) != 2) {
+			fail("readAll", i);
+			continue;
+		}
+		checkTime("readAll", times[0], before, millis());
+		checkTime("readAll second", times[1], before, millis());
+	}
+}
+
+static void asyncWorker(uint32_t iterations)
+{
+	uint32_t i, before;
+
+	for (i = 0; i < iterations; i++) {
+		before = millis();
+		if (!GFRTCAsync.beginReadTime()) {
+			fail("beginReadTime", i);
+			continue;
+		}
+		while (GFRTCAsync.poll() == E_ASYNC_BUSY)
+			std::this_thread::yield();
+		if (GFRTCAsync.getState() != E_ASYNC_DONE)
+			fail("async read", i);
+		else
+			checkTime("async time", GFRTCAsync.getTime(), before, millis());
+	}
+}
+
+static void publishedReader()
+{
+	uint32_t before;
+	timelib_t t;
+
+	while (running) {
+		before = millis();
+		if (GFRTC.getPublishedTime(t)) {
+			checkTime("published time", t, before, millis());
+			published++;
+		} else {
+			unpublished++;
+		}
+		// leave processor time to the workers on small machines
+		std::this_thread::sleep_for(std::chrono::microseconds(10));
+	}
+}
+
+/*-------------------------------------------------------------*
+ *		Main						*
+ *-------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+	uint32_t iterations = (argc > 1) ? (uint32_t) atol(argv[1]) : STRESS_ITERATIONS;
+	uint8_t control;
+
+	Wire.attach(rtc);
+	Wire1.attach(rtc2);
+	rtc.setTime(1700000000UL);
+	rtc2.setTime(1700000000UL);
+	GFRTC.begin(true);
+	second.begin(true);
+	offset = rtc.getTime() - millis() / 1000;
+
+	// square wave on INT/SQW, the handler reads the published time
+	rtc.connectInterruptPin(STRESS_SQW_PIN);
+	attachInterrupt(digitalPinToInterrupt(STRESS_SQW_PIN), sqwIsr, FALLING);
+	GFRTC.setIntSqwMode(E_SQRWAVE_1_HZ);
+
+	GFRTCClass::setLockHooks(lockBus, unlockBus, &busMutex);
+	gfrtc_sim_set_yield(yieldBus);
+
+	std::thread tick(ticker);
+	std::thread readers[2] = { std::thread(publishedReader), std::thread(publishedReader) };
+	std::thread workers[] = {
+		std::thread(alarmWorker, E_ALARM_1, iterations),
+		std::thread(alarmWorker, E_ALARM_2, iterations + 1),
+		std::thread(timeWorker, iterations),
+		std::thread(timeWorker, iterations),
+		std::thread(readAllWorker, iterations),
+		std::thread(asyncWorker, iterations),
+	};
+	for (std::thread & w : workers)
+		w.join();
+	running = false;
+	tick.join();
+	readers[0].join();
+	readers[1].join();
+	GFRTCClass::setLockHooks(NULL, NULL);
+
+	// the last call of each alarm worker disabled / enabled its bit
+	control = rtc.peek(GFRTC_REG_CONTROL);
+	if (((control >> GFRTC_BIT_A1IE) & 1) != ((iterations - 1) & 1) || ((control >> GFRTC_BIT_A2IE) & 1) != (iterations & 1))
+		fail("final control register", control);
+
+	printf("iterations per worker: %u\n", iterations);
+	printf("published time reads: %u (%u unavailable)\n", (uint32_t) published, (uint32_t) unpublished);
+	printf("interrupt handler reads: %u\n", (uint32_t) isrReads);
+	printf("failures: %u\n", (uint32_t) failures);
+	return (failures != 0) ? 1 : 0;
+}
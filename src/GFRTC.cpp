@@ -22,132 +22,327 @@
 /*-------------------------------------------------------------*
  *		Class implementation				*
  *-------------------------------------------------------------*/
-GFRTCClass::GFRTCClass()
+GFRTCClass::GFRTCClass(TwoWire & wire, uint8_t address)
 {
 	// Prepare I2C: moved this call out of the constructor as it causes
 	// problems in some architectures
 	// Wire.begin();
+	_wire = &wire;
+	_address = address;
+	_muxAddress = GFRTC_NO_MUX;
+	_muxChannel = 0;
+	_muxSelected = false;
+	_muxNext = NULL;
+	_isPresent = false;
+	_chip = E_CHIP_UNKNOWN;
+	memset(&_cache, 0, sizeof(_cache));
+	memset((void *) &_published, 0, sizeof(_published));
+#if GFRTC_USE_ALARMS
+	memset(&_shadow, 0, sizeof(_shadow));
+	_alarmHandlers[E_ALARM_1] = NULL;
+	_alarmHandlers[E_ALARM_2] = NULL;
+#endif
+	_timeout = GFRTC_DEFAULT_TIMEOUT_US;
+	_retries = GFRTC_DEFAULT_RETRIES;
+	_backoff = GFRTC_DEFAULT_BACKOFF_US;
+#if defined(PIN_WIRE_SDA) && defined(PIN_WIRE_SCL)
+	// pins of the core are only known for the default bus
+	_sdaPin = (&wire == &Wire) ? PIN_WIRE_SDA : GFRTC_NO_PIN;
+	_sclPin = (&wire == &Wire) ? PIN_WIRE_SCL : GFRTC_NO_PIN;
+#else
+	_sdaPin = GFRTC_NO_PIN;
+	_sclPin = GFRTC_NO_PIN;
+#endif
+#if GFRTC_TEMP_HISTORY_SIZE > 0
+	_historyHead = 0;
+	_historyCount = 0;
+#endif
 }
 
 bool GFRTCClass::begin(bool begini2c)
 {
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_BEGIN);
+
 	_isPresent = false;
 	// request to initialize I2C?
 	if (begini2c) {
-		Wire.begin();
+		_wire->begin();
 	}
+#ifdef WIRE_HAS_TIMEOUT
+	// bound the time of every transfer, the bus is reset on timeout
+	_wire->setWireTimeout(_timeout, true);
+#endif
 
-	// check for presence by performing a read operation
-	readRegister(0x00);
+#if GFRTC_USE_ALARMS
+	// registers cached from a previous session may be stale
+	invalidate();
+#endif
+
+	// check for presence and find out the chip type
+	_chip = detectChip();
 
 	return _isPresent;
 }
 
 timelib_t GFRTCClass::get()
 {
-	struct timelib_tm dt;
+	timelib_t t;
+	uint32_t now;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_GET);
+
+	// serve time from the cached clock if enabled
+	if (_cache.enabled && _cache.valid) {
+		now = millis();
+		cacheAdvance(now);
+		// check if synchronization is due, the period is never longer than
+		// the interval so the chip is read again after a long gap
+		if ((uint32_t) (now - _cache.sync) >= _cache.period) {
+			sync();
+		}
+		return _cache.time;
+	} else if (_cache.enabled) {
+		// first synchronization, attempts are spaced while the RTC is absent
+		if (_cache.failed && (uint32_t) (millis() - _cache.sync) < _cache.period)
+			return 0;
+		if (!sync())
+			return 0;
+		return _cache.time;
+	}
 
-	// read information from RTC to structure
-	if (read(dt) == false) {
+	// read registers from RTC and convert to timestamp
+	if (readTimestamp(t) == false) {
 		// return 0 if cannot communicate with RTC
 		return 0;
 	}
-
-	// convert to timestamp
-	return timelib_make(&dt);
+	return t;
 }
 
 bool GFRTCClass::set(timelib_t t)
 {
-	struct timelib_tm dt;
-
-	// get human readable time information (as required by RTC chip)
-	timelib_break(t, &dt);
+	uint8_t regs[7];
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_SET);
+
+	// encode register values straight from the timestamp
+	gfrtc_time2regs(t, regs);
+
+	// bit 7 of the seconds register is not a clock halt bit on DS323x chips
+	if (_chip != E_CHIP_DS3231 && _chip != E_CHIP_DS3232) {
+		// enable CH bit for DS1307 chip
+		regs[0] |= 0x80;
+		if (!busWrite(GFRTC_REG_SECONDS, regs, sizeof(regs)))
+			return false;
+		// disable CH bit on DS1307
+		regs[0] &= 0x7f;
+	}
 
-	// enable CH bit for DS1307 chip
-	dt.tm_sec |= 0x80;
-	// write information on struct to hardware clock
-	if (!write(dt))
-		return false;
-	// disable CH bit on DS1307
-	dt.tm_sec &= 0x7f;
-	if (!write(dt))
+	// write information to hardware clock
+	if (!busWrite(GFRTC_REG_SECONDS, regs, sizeof(regs)))
 		return false;
+	publish(t);
 
-	// return true if communication was successful
+	// cached clock should read the new time from the RTC
+	_cache.valid = false;
 	return true;
 }
 
 bool GFRTCClass::read(struct timelib_tm &dt)
 {
-	uint8_t sec;
-	_isPresent = false;
+	uint8_t regs[7];
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ);
 
-	// begin i2c communication
-	Wire.beginTransmission(GFRTC_I2C_ADDRESS);
-	// reset register pointer to seconds reg
-	Wire.write((uint8_t) GFRTC_REG_SECONDS);
-	// test communication result
-	if (Wire.endTransmission() != 0) {
+	// read the 7 data fields secs, min, hr, dow, date, mth, yr
+	if (!busRead(GFRTC_REG_SECONDS, regs, sizeof(regs))) {
 		return false;
 	}
 
-	// request the 7 data fields secs, min, hr, dow, date, mth, yr
-	Wire.requestFrom(GFRTC_I2C_ADDRESS, 7);
-	if (Wire.available() < 7) {
+	// convert from BCD
+	dt.tm_sec = bcd2dec(regs[0] & 0x7f);
+	dt.tm_min = bcd2dec(regs[1]);
+	dt.tm_hour = bcd2dec(regs[2] & 0x3f); // mask assumes 24hr clock
+	dt.tm_wday = bcd2dec(regs[3]);
+	dt.tm_mday = bcd2dec(regs[4]);
+	dt.tm_mon = bcd2dec(regs[5]);
+	dt.tm_year = timelib_y2k2tm((bcd2dec(regs[6])));
+
+	// If clock is halted, return false (DS1307 only)
+	if ((regs[0] & 0x80) && _chip != E_CHIP_DS3231 && _chip != E_CHIP_DS3232) {
+		GFRTC_STATS_HALTED();
 		return false;
 	}
+	publish(gfrtc_regs2time(regs));
+	return true;
+}
 
-	// RTC responded as expected
-	_isPresent = true;
+bool GFRTCClass::read(timelib_t & t)
+{
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ);
 
-	// read result and convert from BCD
-	sec = Wire.read();
-	dt.tm_sec = bcd2dec(sec & 0x7f);
-	dt.tm_min = bcd2dec(Wire.read());
-	dt.tm_hour = bcd2dec(Wire.read() & 0x3f); // mask assumes 24hr clock
-	dt.tm_wday = bcd2dec(Wire.read());
-	dt.tm_mday = bcd2dec(Wire.read());
-	dt.tm_mon = bcd2dec(Wire.read());
-	dt.tm_year = timelib_y2k2tm((bcd2dec(Wire.read())));
+	return readTimestamp(t);
+}
 
-	// If clock is halted, return false
-	if (sec & 0x80) {
+bool GFRTCClass::write(struct timelib_tm &dt)
+{
+	uint8_t regs[7];
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_WRITE);
+
+	// date / time information
+	regs[0] = dec2bcd(dt.tm_sec);
+	regs[1] = dec2bcd(dt.tm_min);
+	regs[2] = dec2bcd(dt.tm_hour);
+	regs[3] = dec2bcd(dt.tm_wday);
+	regs[4] = dec2bcd(dt.tm_mday);
+	regs[5] = dec2bcd(dt.tm_mon);
+	regs[6] = dec2bcd(timelib_tm2y2k(dt.tm_year));
+
+	// perform i2c operation
+	if (!busWrite(GFRTC_REG_SECONDS, regs, sizeof(regs))) {
 		return false;
 	}
+	publish(gfrtc_regs2time(regs));
+
+	// cached clock should read the new time from the RTC
+	_cache.valid = false;
 	return true;
 }
 
-bool GFRTCClass::write(struct timelib_tm &dt)
+void GFRTCClass::setCachedMode(bool enable, uint32_t interval, uint16_t maxerror)
 {
-	_isPresent = false;
-	Wire.beginTransmission(GFRTC_I2C_ADDRESS);
+	_cache.enabled = enable;
+	_cache.valid = false;
+	// limit interval to avoid overflow when converting to milliseconds
+	if (interval > 0x418937UL)
+		interval = 0x418937UL;
+	_cache.interval = interval * 1000UL;
+	_cache.maxError = maxerror;
+	_cache.lastSync = 0;
+	_cache.correction = 0;
+	_cache.drift = 0;
+	_cache.failed = false;
+}
+
+bool GFRTCClass::sync()
+{
+	timelib_t t;
+	uint32_t now, elapsed, period;
+	int32_t correction = 0;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_SYNC);
+
+	// read time from the RTC chip
+	if (!readTimestamp(t)) {
+		// retry after a full interval, or shortly if there is no time to serve
+		_cache.sync = millis();
+		_cache.period = _cache.valid ? _cache.interval : GFRTC_CACHE_RETRY_INTERVAL;
+		_cache.failed = true;
+		return false;
+	}
+	now = millis();
 
-	// reset register pointer to seconds reg
-	Wire.write((uint8_t) GFRTC_REG_SECONDS);
+	if (_cache.valid) {
+		// bring the cached clock up to date and measure its error
+		cacheAdvance(now);
+		correction = (int32_t) (t - _cache.time);
+	}
 
-	// write date / time information
-	Wire.write(dec2bcd(dt.tm_sec));
-	Wire.write(dec2bcd(dt.tm_min));
-	Wire.write(dec2bcd(dt.tm_hour));
-	Wire.write(dec2bcd(dt.tm_wday));
-	Wire.write(dec2bcd(dt.tm_mday));
-	Wire.write(dec2bcd(dt.tm_mon));
-	Wire.write(dec2bcd(timelib_tm2y2k(dt.tm_year)));
+	// keep the phase of the cached clock unless it disagrees with the RTC
+	if (!_cache.valid) {
+		_cache.time = t;
+		_cache.millis = now;
+		_cache.rebase = now;
+		_cache.corrected = 0;
+	} else if (correction != 0) {
+		_cache.time = t;
+		_cache.millis = now;
+		_cache.corrected += correction;
+	}
 
-	// perform i2c operation
-	if (Wire.endTransmission() != 0) {
-		return false;
+	// the drift rate is measured over all the corrections since the clock was
+	// loaded, a single one is off by up to a second due to the phase of the
+	// cached clock, and it is kept while no further error is seen
+	elapsed = now - _cache.rebase;
+	if (_cache.corrected != 0) {
+		_cache.drift = elapsed / (uint32_t) ((_cache.corrected < 0) ? -_cache.corrected : _cache.corrected);
+	} else if (_cache.drift != 0 && elapsed > _cache.drift) {
+		// a longer run without error bounds the drift rate
+		_cache.drift = elapsed;
+	}
+	if (elapsed >= GFRTC_CACHE_DRIFT_SPAN) {
+		// restart the measurement well before millis() overflows
+		_cache.rebase = now;
+		_cache.corrected = 0;
 	}
 
-	// communication successful
-	_isPresent = true;
+	// estimate when the error will reach the limit at the measured drift rate
+	period = _cache.interval;
+	if (_cache.maxError != 0 && _cache.drift != 0) {
+		uint64_t limit = ((uint64_t) _cache.maxError * _cache.drift) / 1000UL;
+		if (limit < period)
+			period = (uint32_t) limit;
+	}
+
+	_cache.sync = now;
+	_cache.period = period;
+	_cache.failed = false;
+	_cache.lastSync = t;
+	_cache.correction = correction;
+	_cache.valid = true;
 	return true;
 }
 
+void GFRTCClass::cacheAdvance(uint32_t now)
+{
+	uint32_t seconds = (uint32_t) (now - _cache.millis) / 1000UL;
+
+	// whole seconds in one step, the remainder stays on the phase
+	_cache.time += seconds;
+	_cache.millis += seconds * 1000UL;
+}
+
+timelib_t GFRTCClass::getLastSync()
+{
+	return _cache.lastSync;
+}
+
+int32_t GFRTCClass::getLastCorrection()
+{
+	return _cache.correction;
+}
+
+bool GFRTCClass::getPublishedTime(timelib_t & t)
+{
+	uint8_t i, sequence, copy;
+	timelib_t time;
+	uint32_t stamp;
+
+	if (!_published.valid)
+		return false;
+	for (i = 0; i < GFRTC_PUBLISH_RETRIES; i++) {
+		sequence = _published.sequence;
+		GFRTC_MEMORY_BARRIER();
+		copy = sequence & 1;
+		time = _published.time[copy];
+		stamp = _published.millis[copy];
+		GFRTC_MEMORY_BARRIER();
+		// retry only if the writer moved on to the copy that was read
+		if (sequence == _published.sequence) {
+			t = time + (uint32_t) (millis() - stamp) / 1000;
+			return true;
+		}
+	}
+	return false;
+}
+
 uint8_t GFRTCClass::readRegister(uint8_t addr, bool * result)
 {
 	uint8_t reg;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ_REGISTER);
 
 	// read register value
 	bool ret = readRegister(addr, &reg, sizeof(reg));
@@ -162,63 +357,234 @@ uint8_t GFRTCClass::readRegister(uint8_t addr, bool * result)
 
 bool GFRTCClass::readRegister(uint8_t addr, void * data, uint8_t size)
 {
-	uint8_t i;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ_REGISTER);
+#if GFRTC_USE_ALARMS
+	uint8_t i, bit;
 	uint8_t * dst = (uint8_t *) data;
 
-	// limitation of wire library
-	if (size > 32)
+	if (_shadow.policy == E_SHADOW_DISABLED || !shadowOverlaps(addr, size)) {
+		return busRead(addr, data, size);
+	}
+
+	// serve from shadow copy if none of the registers is volatile
+	if (shadowCovers(addr, size)) {
+		if (!shadowLoad())
+			return false;
+		memcpy(dst, &_shadow.regs[addr - GFRTC_SHADOW_START], size);
+		return true;
+	}
+
+	// read from chip and refresh the shadow copy, keeping pending writes
+	if (!busRead(addr, data, size))
 		return false;
+	for (i = 0; i < size; i++) {
+		if ((uint8_t) (addr + i) < GFRTC_SHADOW_START || (uint8_t) (addr + i) >= GFRTC_SHADOW_START + GFRTC_SHADOW_SIZE)
+			continue;
+		bit = addr + i - GFRTC_SHADOW_START;
+		if (_shadow.dirty & (1 << bit)) {
+			dst[i] = _shadow.regs[bit];
+		} else {
+			_shadow.regs[bit] = dst[i];
+			_shadow.valid |= (1 << bit);
+		}
+	}
+	return true;
+#else
+	return busRead(addr, data, size);
+#endif
+}
 
-	_isPresent = false;
-	// begin operation on I2C
-	Wire.beginTransmission(GFRTC_I2C_ADDRESS);
-	Wire.write(addr);
+bool GFRTCClass::writeRegister(uint8_t addr, uint8_t value)
+{
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_WRITE_REGISTER);
+
+	return writeRegister(addr, &value, sizeof(value));
+}
 
-	// prepare to read
-	if (Wire.endTransmission() != 0) {
+bool GFRTCClass::writeRegister(uint8_t addr, const void * data, uint8_t size)
+{
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_WRITE_REGISTER);
+#if GFRTC_USE_ALARMS
+	uint8_t i, bit, value;
+	const uint8_t * src = (const uint8_t *) data;
+	bool defer;
+
+	if (_shadow.policy == E_SHADOW_DISABLED || !shadowOverlaps(addr, size)) {
+		return busWrite(addr, data, size);
+	}
+
+	// write-back policy stores data in RAM unless a conversion is requested
+	defer = (_shadow.policy == E_SHADOW_WRITE_BACK) && shadowCovers(addr, size);
+	if (defer && addr <= GFRTC_REG_CONTROL && addr + size > GFRTC_REG_CONTROL) {
+		if (src[GFRTC_REG_CONTROL - addr] & (1 << GFRTC_BIT_CONV))
+			defer = false;
+	}
+	if (!defer && !busWrite(addr, data, size))
 		return false;
+
+	// update shadow copy, status register is never cached
+	for (i = 0; i < size; i++) {
+		if ((uint8_t) (addr + i) < GFRTC_SHADOW_START || (uint8_t) (addr + i) >= GFRTC_SHADOW_START + GFRTC_SHADOW_SIZE)
+			continue;
+		if ((uint8_t) (addr + i) == GFRTC_REG_STATUS)
+			continue;
+		value = src[i];
+		// CONV is cleared by the chip when the conversion ends
+		if ((uint8_t) (addr + i) == GFRTC_REG_CONTROL)
+			value &= ~(1 << GFRTC_BIT_CONV);
+		bit = addr + i - GFRTC_SHADOW_START;
+		_shadow.regs[bit] = value;
+		_shadow.valid |= (1 << bit);
+		if (defer) {
+			_shadow.dirty |= (1 << bit);
+		} else {
+			_shadow.dirty &= ~(1 << bit);
+		}
 	}
+	return true;
+#else
+	return busWrite(addr, data, size);
+#endif
+}
+
+#if GFRTC_USE_ALARMS
+bool GFRTCClass::setShadowMode(enum gfrtc_shadow_policies policy)
+{
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_FLUSH);
+	bool ret = flush();
+
+	_shadow.policy = policy;
+	invalidate();
+	return ret;
+}
+
+bool GFRTCClass::flush()
+{
+	uint8_t first, last;
+	const uint8_t status = GFRTC_REG_STATUS - GFRTC_SHADOW_START;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_FLUSH);
+
+	if (_shadow.dirty == 0)
+		return true;
 
-	// begin read operation
-	Wire.requestFrom((uint8_t)GFRTC_I2C_ADDRESS, size);
-	if (Wire.available() < size) {
+	// clean registers between dirty ones are sent too, they must hold valid data
+	if (!shadowLoad())
 		return false;
+
+	// alarm and control registers in a single burst, the status register is
+	// skipped as writing it back could clear flags set by the chip
+	if (_shadow.dirty & ((1 << status) - 1)) {
+		for (first = 0; !(_shadow.dirty & (1 << first)); first++);
+		for (last = status - 1; !(_shadow.dirty & (1 << last)); last--);
+		if (!busWrite(GFRTC_SHADOW_START + first, &_shadow.regs[first], last - first + 1))
+			return false;
+		_shadow.dirty &= ~((1 << status) - 1);
 	}
-	// Read data to buffer
-	for (i = 0; i < size; i++) {
-		dst[i] = Wire.read();
+
+	// aging offset register
+	if (_shadow.dirty) {
+		if (!busWrite(GFRTC_REG_AGING, &_shadow.regs[GFRTC_REG_AGING - GFRTC_SHADOW_START], 1))
+			return false;
+		_shadow.dirty = 0;
 	}
+	return true;
+}
 
-	_isPresent = true;
+void GFRTCClass::invalidate()
+{
+	_shadow.valid = 0;
+	_shadow.dirty = 0;
+}
+#endif
+
+bool GFRTCClass::busRead(uint8_t addr, void * data, uint8_t size)
+{
+	uint8_t attempt = 0;
+
+	while (!busReadOnce(addr, (uint8_t *) data, size)) {
+		if (!retry(attempt++))
+			return false;
+	}
 	return true;
 }
 
-bool GFRTCClass::writeRegister(uint8_t addr, uint8_t value)
+bool GFRTCClass::busWrite(uint8_t addr, const void * data, uint8_t size)
 {
-	return writeRegister(addr, &value, sizeof(value));
+	uint8_t attempt = 0;
+
+	// limitation of wire library, the address takes one byte of the buffer
+	if (size > GFRTC_WIRE_BUFFER_SIZE - 1)
+		return false;
+
+	while (!busWriteOnce(addr, (const uint8_t *) data, size)) {
+		if (!retry(attempt++))
+			return false;
+	}
+	return true;
 }
 
-bool GFRTCClass::writeRegister(uint8_t addr, const void * data, uint8_t size)
+bool GFRTCClass::busReadOnce(uint8_t addr, uint8_t * data, uint8_t size)
 {
-	uint8_t i;
-	uint8_t * src = (uint8_t *) data;
+	uint8_t i, chunk;
 
-	// limitation of wire library
-	if (size > 32)
+	// pending asynchronous transfers have to set the register pointer again
+	_busEpoch++;
+	_isPresent = false;
+	if (!muxSelect())
+		return false;
+
+	// set register pointer once, it auto increments across bursts
+	_wire->beginTransmission(_address);
+	_wire->write(addr);
+
+	// prepare to read, repeated START keeps the bus until the read
+	if (GFRTC_STATS_WRITE(_wire->endTransmission(false), 1) != 0) {
 		return false;
+	}
+
+	// read back to back bursts that fit the receive buffer
+	while (size > 0) {
+		chunk = (size > GFRTC_WIRE_BUFFER_SIZE) ? GFRTC_WIRE_BUFFER_SIZE : size;
+		_wire->requestFrom(_address, chunk);
+		if (GFRTC_STATS_READ(_wire->available(), chunk) < chunk) {
+			return false;
+		}
+		// Read data to buffer
+		for (i = 0; i < chunk; i++) {
+			*data++ = _wire->read();
+		}
+		size -= chunk;
+	}
+
+	_isPresent = true;
+	return true;
+}
+
+bool GFRTCClass::busWriteOnce(uint8_t addr, const uint8_t * data, uint8_t size)
+{
+	uint8_t i;
 
+	_busEpoch++;
 	_isPresent = false;
+	if (!muxSelect())
+		return false;
+
 	// begin operation on I2C
-	Wire.beginTransmission(GFRTC_I2C_ADDRESS);
-	Wire.write(addr);
+	_wire->beginTransmission(_address);
+	_wire->write(addr);
 
 	// write desired data
 	for (i = 0; i < size; i++) {
-		Wire.write(src[i]);
+		_wire->write(data[i]);
 	}
 
 	// check if communication was successful
-	if (Wire.endTransmission() != 0) {
+	if (GFRTC_STATS_WRITE(_wire->endTransmission(), size + 1) != 0) {
 		return false;
 	} else {
 		_isPresent = true;
@@ -226,16 +592,48 @@ bool GFRTCClass::writeRegister(uint8_t addr, const void * data, uint8_t size)
 	}
 }
 
+bool GFRTCClass::retry(uint8_t attempt)
+{
+	uint32_t wait;
+	bool stuck = false;
+
+	// the mux may have lost the selection, write it again on next transfer
+	_muxSelected = false;
+	if (attempt >= _retries)
+		return false;
+
+	// a device holding the bus does not let go by itself
+#ifdef WIRE_HAS_TIMEOUT
+	stuck = _wire->getWireTimeoutFlag();
+	_wire->clearWireTimeoutFlag();
+#endif
+	if (_sdaPin != GFRTC_NO_PIN && digitalRead(_sdaPin) == LOW)
+		stuck = true;
+	if (stuck)
+		recoverBus();
+	GFRTC_STATS_RETRY(stuck);
+
+	// delayMicroseconds() takes 16 bits on AVR, wait whole milliseconds first
+	wait = (uint32_t) _backoff << attempt;
+	delay(wait / 1000);
+	delayMicroseconds((uint16_t) (wait % 1000));
+	return true;
+}
+
 bool GFRTCClass::readBit(uint8_t addr, uint8_t bit, bool * result)
 {
 	uint8_t regval;
-	bool ret = false;
+	bool res, ret = false;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ_REGISTER);
 	
-	// read current register value
-	regval = readRegister(addr, result);
-	if (* result) {
+	// read current register value, the result pointer is optional
+	regval = readRegister(addr, &res);
+	if (res) {
 		ret = (regval & (1 << bit)) ? true : false;
 	}
+	if (result != NULL)
+		*result = res;
 	// return bit value
 	return ret;
 }
@@ -244,6 +642,8 @@ bool GFRTCClass::writeBit(uint8_t addr, uint8_t bit, bool value)
 {
 	uint8_t regval, bitmask;
 	bool res;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_WRITE_REGISTER);
 
 	// read current register value
 	regval = readRegister(addr, &res);
@@ -265,40 +665,66 @@ bool GFRTCClass::writeBit(uint8_t addr, uint8_t bit, bool value)
 	return true;
 }
 
+#if GFRTC_USE_ALARMS
 bool GFRTCClass::setAlarm(gfrtc_alarm_types type, uint8_t hour, uint8_t minute, uint8_t second, uint8_t dow)
 {
-	uint8_t addr;
+	uint8_t regs[4];
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_ALARM);
 
-	second = dec2bcd(second);
-	minute = dec2bcd(minute);
-	hour = dec2bcd(hour);
-	dow = dec2bcd(dow);
-
-	if (type & 0x01) second |= 1 << GFRTC_BIT_A1M1;
-	if (type & 0x02) minute |= 1 << GFRTC_BIT_A1M2;
-	if (type & 0x04) hour |= 1 << GFRTC_BIT_A1M3;
-	if (type & 0x10) dow |= 1 << GFRTC_BIT_DYDT;
-	if (type & 0x08) dow |= 1 << GFRTC_BIT_A1M4;
-
-	if (!(type & 0x80)) // alarm 1
-	{
-		addr = GFRTC_REG_ALM1_SECONDS;
-		if (!writeRegister(addr++, second)) {
-			return false;
-		}
+	if (!hasDS3231Registers())
+		return false;
+
+	encodeAlarm(type, hour, minute, second, dow, regs);
+
+	// write all alarm registers in a single transaction
+	if (!(type & 0x80)) { // alarm 1
+		return writeRegister(GFRTC_REG_ALM1_SECONDS, regs, 4);
 	} else {
-		addr = GFRTC_REG_ALM2_MINUTES;
+		return writeRegister(GFRTC_REG_ALM2_MINUTES, &regs[1], 3);
 	}
-	if (!writeRegister(addr++, minute) || !writeRegister(addr++, hour) || !writeRegister(addr++, dow)) {
+}
+
+bool GFRTCClass::setAlarms(const struct gfrtc_alarm & alarm1, const struct gfrtc_alarm & alarm2)
+{
+	uint8_t regs[8], alm2[4];
+	bool res;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_ALARM);
+
+	// check that each alarm type belongs to the right alarm
+	if (!hasDS3231Registers() || (alarm1.type & 0x80) || !(alarm2.type & 0x80))
 		return false;
-	}
-	return true;
+
+	// get current control register to keep the other bits
+	regs[7] = readRegister(GFRTC_REG_CONTROL, &res);
+	if (!res)
+		return false;
+	regs[7] &= ~((1 << GFRTC_BIT_A1IE) | (1 << GFRTC_BIT_A2IE) | (1 << GFRTC_BIT_CONV));
+	if (alarm1.interrupt)
+		regs[7] |= 1 << GFRTC_BIT_A1IE;
+	if (alarm2.interrupt)
+		regs[7] |= 1 << GFRTC_BIT_A2IE;
+	if (alarm1.interrupt || alarm2.interrupt)
+		regs[7] |= 1 << GFRTC_BIT_INTCN;
+
+	// alarm 1 on 0x07 to 0x0A, alarm 2 has no seconds register (0x0B to 0x0D)
+	encodeAlarm(alarm1.type, alarm1.hour, alarm1.minute, alarm1.second, alarm1.dow, &regs[0]);
+	encodeAlarm(alarm2.type, alarm2.hour, alarm2.minute, 0, alarm2.dow, alm2);
+	memcpy(&regs[4], &alm2[1], 3);
+
+	return writeRegister(GFRTC_REG_ALM1_SECONDS, regs, sizeof(regs));
 }
 
 bool GFRTCClass::setAlarmInterrupt(enum gfrtc_alarms alarm, bool enable)
 {
 	uint8_t regval, mask;
 	bool res;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_ALARM);
+
+	if (!hasDS3231Registers())
+		return false;
 
 	// read control register value
 	regval = readRegister(GFRTC_REG_CONTROL, & res);
@@ -335,6 +761,11 @@ bool GFRTCClass::setIntSqwMode(enum gfrtc_intsqw_modes frequency)
 {
 	uint8_t controlReg;
 	bool res;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_ALARM);
+
+	if (!hasDS3231Registers())
+		return false;
 
 	//first read current value
 	controlReg = readRegister(GFRTC_REG_CONTROL, &res);
@@ -347,8 +778,6 @@ bool GFRTCClass::setIntSqwMode(enum gfrtc_intsqw_modes frequency)
 	} else {
 		controlReg = (controlReg & 0xE3) | (frequency << GFRTC_BIT_RS1);
 	}
-	
-	Serial.println(controlReg, HEX);
 
 	// write to IC
 	return writeRegister(GFRTC_REG_CONTROL, controlReg);
@@ -357,9 +786,17 @@ bool GFRTCClass::setIntSqwMode(enum gfrtc_intsqw_modes frequency)
 bool GFRTCClass::getAlarmInterruptFlag(enum gfrtc_alarms alarm)
 {
 	uint8_t regval, mask;
+	bool res;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_FLAGS);
+
+	if (!hasDS3231Registers())
+		return false;
 
-	// read status register value
-	regval = readRegister(GFRTC_REG_STATUS);
+	// read status register value, nothing is written if the read failed
+	regval = readRegister(GFRTC_REG_STATUS, &res);
+	if (!res)
+		return false;
 
 	// prepare bitmask according to requested interrupt
 	switch (alarm) {
@@ -375,8 +812,8 @@ bool GFRTCClass::getAlarmInterruptFlag(enum gfrtc_alarms alarm)
 
 	// check for interrupt flag bits
 	if (regval & mask) {
-		// clear flag
-		regval &= ~mask;
+		// clear flag, writing ones keeps flags that latched after the read
+		regval = (regval | (1 << GFRTC_BIT_OSF) | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F)) & ~mask;
 		writeRegister(GFRTC_REG_STATUS, regval);
 		return true;
 	} else {
@@ -384,43 +821,500 @@ bool GFRTCClass::getAlarmInterruptFlag(enum gfrtc_alarms alarm)
 	}
 }
 
+void GFRTCClass::setAlarmHandler(enum gfrtc_alarms alarm, gfrtc_alarm_handler handler)
+{
+	if (alarm <= E_ALARM_2)
+		_alarmHandlers[alarm] = handler;
+}
+
+uint8_t GFRTCClass::serviceAlarms(bool * result)
+{
+	uint8_t regval, fired = 0, clear = 0;
+	bool res = false;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_FLAGS);
+
+	if (result != NULL)
+		*result = false;
+	if (!hasDS3231Registers())
+		return 0;
+
+	// single read of the status register
+	regval = readRegister(GFRTC_REG_STATUS, &res);
+	if (!res)
+		return 0;
+	if (regval & (1 << GFRTC_BIT_A1F)) {
+		fired |= 1 << E_ALARM_1;
+		clear |= 1 << GFRTC_BIT_A1F;
+	}
+	if (regval & (1 << GFRTC_BIT_A2F)) {
+		fired |= 1 << E_ALARM_2;
+		clear |= 1 << GFRTC_BIT_A2F;
+	}
+
+	// clear only the flags seen set, the others are written as ones
+	if (fired != 0) {
+		regval = (regval | (1 << GFRTC_BIT_OSF) | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F)) & ~clear;
+		if (!writeRegister(GFRTC_REG_STATUS, regval))
+			return 0;
+	}
+	if (result != NULL)
+		*result = true;
+
+	// handlers run after the flags are cleared, so they can program the
+	// next alarm
+	if ((fired & (1 << E_ALARM_1)) && _alarmHandlers[E_ALARM_1] != NULL)
+		_alarmHandlers[E_ALARM_1](E_ALARM_1);
+	if ((fired & (1 << E_ALARM_2)) && _alarmHandlers[E_ALARM_2] != NULL)
+		_alarmHandlers[E_ALARM_2](E_ALARM_2);
+	return fired;
+}
+
+bool GFRTCClass::wake(struct gfrtc_wake & state, const struct gfrtc_alarm * next, bool battery)
+{
+	const uint8_t flags = (1 << GFRTC_BIT_OSF) | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F);
+	uint8_t regs[GFRTC_REG_LSB_TEMP + GFRTC_REG_YEAR + 2], prev[GFRTC_REG_STATUS + 1];
+	uint8_t alarm[4], clear = 0, known, enable, r, end, stop;
+	uint16_t dirty = 0;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_ALARM);
+
+	state.alarms = 0;
+	if (!hasDS3231Registers())
+		return false;
+
+	// control, status and time in one burst: the DS3231 register pointer
+	// wraps from 0x12 to 0x00, on other chips the alarms are read too
+	if (_chip == E_CHIP_DS3231) {
+		if (!readRegister(GFRTC_REG_CONTROL, &regs[GFRTC_REG_CONTROL], GFRTC_REG_LSB_TEMP - GFRTC_REG_CONTROL + GFRTC_REG_YEAR + 2))
+			return false;
+		memcpy(regs, &regs[GFRTC_REG_LSB_TEMP + 1], GFRTC_REG_YEAR + 1);
+		known = GFRTC_REG_CONTROL;
+	} else {
+		if (!readRegister(GFRTC_REG_SECONDS, regs, GFRTC_REG_STATUS + 1))
+			return false;
+		known = GFRTC_REG_ALM1_SECONDS;
+	}
+	state.time = gfrtc_regs2time(regs);
+	publish(state.time);
+	state.oscillatorStopped = (regs[GFRTC_REG_STATUS] & (1 << GFRTC_BIT_OSF)) ? true : false;
+	if (regs[GFRTC_REG_STATUS] & (1 << GFRTC_BIT_A1F)) {
+		state.alarms |= 1 << E_ALARM_1;
+		clear |= 1 << GFRTC_BIT_A1F;
+	}
+	if (regs[GFRTC_REG_STATUS] & (1 << GFRTC_BIT_A2F)) {
+		state.alarms |= 1 << E_ALARM_2;
+		clear |= 1 << GFRTC_BIT_A2F;
+	}
+
+	// new values of registers 0x07 to 0x0F, alarm registers that were not
+	// read are always written
+	regs[GFRTC_REG_CONTROL] &= ~(1 << GFRTC_BIT_CONV);
+	memcpy(prev, regs, sizeof(prev));
+	if (next != NULL) {
+		encodeAlarm(next->type, next->hour, next->minute, next->second, next->dow, alarm);
+		if (!(next->type & 0x80)) {
+			memcpy(&regs[GFRTC_REG_ALM1_SECONDS], alarm, 4);
+			dirty = 0x000F;
+			enable = 1 << GFRTC_BIT_A1IE;
+		} else {
+			memcpy(&regs[GFRTC_REG_ALM2_MINUTES], &alarm[1], 3);
+			dirty = 0x0070;
+			enable = 1 << GFRTC_BIT_A2IE;
+		}
+		if (next->interrupt)
+			regs[GFRTC_REG_CONTROL] |= enable | (1 << GFRTC_BIT_INTCN);
+		else
+			regs[GFRTC_REG_CONTROL] &= ~enable;
+	}
+	regs[GFRTC_REG_CONTROL] &= ~((1 << GFRTC_BIT_EOSC) | (1 << GFRTC_BIT_BBSQW));
+	if (battery)
+		regs[GFRTC_REG_CONTROL] |= 1 << GFRTC_BIT_BBSQW;
+	if (clear != 0)
+		regs[GFRTC_REG_STATUS] = (regs[GFRTC_REG_STATUS] | flags) & ~clear;
+	for (r = known; r <= GFRTC_REG_STATUS; r++) {
+		if (regs[r] != prev[r])
+			dirty |= 1 << (r - GFRTC_REG_ALM1_SECONDS);
+		else
+			dirty &= ~(1 << (r - GFRTC_REG_ALM1_SECONDS));
+	}
+
+	// one burst per run of changed registers, unchanged registers in between
+	// are written again when their value is known
+	for (r = GFRTC_REG_ALM1_SECONDS; r <= GFRTC_REG_STATUS; r = end) {
+		end = r + 1;
+		if (!(dirty & (1 << (r - GFRTC_REG_ALM1_SECONDS))))
+			continue;
+		for (stop = end; end <= GFRTC_REG_STATUS; end++) {
+			if (dirty & (1 << (end - GFRTC_REG_ALM1_SECONDS)))
+				stop = end + 1;
+			else if (end < known)
+				break;
+		}
+		if (!writeRegister(r, &regs[r], stop - r))
+			return false;
+		end = stop;
+	}
+
+	if ((state.alarms & (1 << E_ALARM_1)) && _alarmHandlers[E_ALARM_1] != NULL)
+		_alarmHandlers[E_ALARM_1](E_ALARM_1);
+	if ((state.alarms & (1 << E_ALARM_2)) && _alarmHandlers[E_ALARM_2] != NULL)
+		_alarmHandlers[E_ALARM_2](E_ALARM_2);
+	return true;
+}
+#endif
+
 bool GFRTCClass::getOscillatorStopFlag(bool clearosf)
 {
-	// read status register
-	uint8_t s = readRegister(GFRTC_REG_STATUS);
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_FLAGS);
+
+	if (!hasDS3231Registers())
+		return false;
+
+	// read status register, nothing is written if the read failed
+	bool res;
+	uint8_t s = readRegister(GFRTC_REG_STATUS, &res);
+	if (!res)
+		return false;
 
 	// extract flag value
 	bool ret = (s & (1 << GFRTC_BIT_OSF)) ? true : false;
 
-	// clear if needed
+	// clear if needed, writing ones keeps alarm flags that latched after the read
 	if (ret && clearosf) {
-		writeRegister(GFRTC_REG_STATUS, s & ~(1 << GFRTC_BIT_OSF));
+		writeRegister(GFRTC_REG_STATUS, (s | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F)) & ~(1 << GFRTC_BIT_OSF));
 	}
 
 	// return OSF flag status
 	return ret;
 }
 
+#if GFRTC_USE_DIAGNOSTICS
 int16_t GFRTCClass::getTemperature()
 {
-	int16_t rtctemp = 0;
-	// read data from registers
-	
-	rtctemp = (readRegister(GFRTC_REG_MSB_TEMP) << 8);
-	rtctemp |= (readRegister(GFRTC_REG_LSB_TEMP));
+	int16_t quarters;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_TEMPERATURE);
+
+	if (!readTemperature(quarters))
+		return 0;
 
 	// convert to integer as celsius degrees, discards fractional part
-	return (rtctemp / 256);
+	return quarters / 4;
+}
+
+bool GFRTCClass::readTemperature(int16_t & quarters)
+{
+	uint8_t regs[2];
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_TEMPERATURE);
+
+	if (!hasDS3231Registers())
+		return false;
+
+	// MSB and LSB on the same burst, the chip latches them together
+	if (!busRead(GFRTC_REG_MSB_TEMP, regs, sizeof(regs)))
+		return false;
+
+	// 10 bit two's complement value, left aligned
+	quarters = (int16_t) (((uint16_t) regs[0] << 8) | regs[1]) >> 6;
+	recordTemperature(quarters);
+	return true;
+}
+
+uint8_t GFRTCClass::getTemperatureHistory(struct gfrtc_temp_sample * samples, uint8_t count)
+{
+#if GFRTC_TEMP_HISTORY_SIZE > 0
+	uint8_t i, index = _historyHead;
+
+	if (count > _historyCount)
+		count = _historyCount;
+
+	// walk back from the newest sample
+	for (i = 0; i < count; i++) {
+		index = (index == 0) ? GFRTC_TEMP_HISTORY_SIZE - 1 : index - 1;
+		samples[i] = _history[index];
+	}
+	return count;
+#else
+	(void) samples;
+	(void) count;
+	return 0;
+#endif
+}
+
+bool GFRTCClass::readSnapshot(struct gfrtc_snapshot & snapshot)
+{
+	uint8_t regs[GFRTC_REG_LSB_TEMP + 1], alm2[4];
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_SNAPSHOT);
+
+	if (!hasDS3231Registers())
+		return false;
+
+	// whole map in one burst, this also refreshes the shadow copy
+	if (!readRegister(GFRTC_REG_SECONDS, regs, sizeof(regs)))
+		return false;
+
+	snapshot.time = gfrtc_regs2time(regs);
+
+	// alarm 2 has no seconds register, its type has bit 7 set
+	decodeAlarm(&regs[GFRTC_REG_ALM1_SECONDS], 0x00, snapshot.alarm1);
+	alm2[0] = 0;
+	memcpy(&alm2[1], &regs[GFRTC_REG_ALM2_MINUTES], 3);
+	decodeAlarm(alm2, 0x80, snapshot.alarm2);
+
+	snapshot.control = regs[GFRTC_REG_CONTROL];
+	snapshot.status = regs[GFRTC_REG_STATUS];
+	snapshot.aging = (int8_t) regs[GFRTC_REG_AGING];
+	snapshot.alarm1.interrupt = (snapshot.control & (1 << GFRTC_BIT_A1IE)) ? true : false;
+	snapshot.alarm2.interrupt = (snapshot.control & (1 << GFRTC_BIT_A2IE)) ? true : false;
+
+	// 10 bit two's complement value, left aligned
+	snapshot.temperature = (int16_t) (((uint16_t) regs[GFRTC_REG_MSB_TEMP] << 8) | regs[GFRTC_REG_LSB_TEMP]) >> 6;
+	recordTemperature(snapshot.temperature);
+	return true;
 }
 
-bool GFRTCClass::readNVRAM(uint8_t address, void * buffer, uint16_t size)
+bool GFRTCClass::clearFlags(const struct gfrtc_snapshot & snapshot, uint8_t flags)
 {
-	return readRegister((uint8_t)address, buffer, size);
+	const uint8_t mask = (1 << GFRTC_BIT_OSF) | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F);
+	uint8_t value;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_FLAGS);
+
+	if (!hasDS3231Registers())
+		return false;
+
+	// flags can only be cleared, writing a one leaves them unchanged
+	value = (snapshot.status & ~mask & ~(1 << GFRTC_BIT_BSY)) | (mask & ~flags);
+	return busWrite(GFRTC_REG_STATUS, &value, 1);
 }
+#endif
 
-bool GFRTCClass::writeNVRAM(uint8_t address, const void * buffer, uint16_t size)
+#if GFRTC_USE_NVRAM
+bool GFRTCClass::readNVRAM(uint8_t offset, void * buffer, uint16_t size)
 {
-	return writeRegister((uint8_t)address, buffer, size);
+	uint8_t addr;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ_NVRAM);
+
+	if (!nvramAddress(offset, size, addr))
+		return false;
+
+	// the range check guarantees that the size fits 8 bits
+	return busRead(addr, buffer, (uint8_t) size);
+}
+
+bool GFRTCClass::writeNVRAM(uint8_t offset, const void * buffer, uint16_t size)
+{
+	uint8_t chunk, addr;
+	const uint8_t * src = (const uint8_t *) buffer;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_WRITE_NVRAM);
+
+	if (!nvramAddress(offset, size, addr))
+		return false;
+
+	// every burst carries its own address byte
+	while (size > 0) {
+		chunk = (size > GFRTC_WIRE_BUFFER_SIZE - 1) ? GFRTC_WIRE_BUFFER_SIZE - 1 : (uint8_t) size;
+		if (!busWrite(addr, src, chunk))
+			return false;
+		addr += chunk;
+		src += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+uint8_t GFRTCClass::getNVRAMSize()
+{
+	switch (_chip) {
+	case E_CHIP_DS1307:
+		return DS1307_RAM_SIZE;
+	case E_CHIP_DS3232:
+		return SRAM_SIZE;
+	default:
+		return 0;
+	}
+}
+#endif
+
+void GFRTCClass::setTimeout(uint32_t timeout)
+{
+	GFRTC_LOCK_SCOPE();
+
+	_timeout = timeout;
+#ifdef WIRE_HAS_TIMEOUT
+	_wire->setWireTimeout(timeout, true);
+#endif
+}
+
+void GFRTCClass::setRetryPolicy(uint8_t retries, uint16_t backoff)
+{
+	// keep the backoff shift inside 32 bits
+	_retries = (retries > 16) ? 16 : retries;
+	_backoff = backoff;
+}
+
+void GFRTCClass::setRecoveryPins(uint8_t sda, uint8_t scl)
+{
+	_sdaPin = sda;
+	_sclPin = scl;
+}
+
+bool GFRTCClass::recoverBus()
+{
+	uint8_t i;
+	bool released;
+	GFRTC_LOCK_SCOPE();
+
+	if (_sdaPin == GFRTC_NO_PIN)
+		return false;
+
+	// take the pins from the I2C controller, lines are open drain
+	_wire->end();
+	pinMode(_sdaPin, INPUT_PULLUP);
+	pinMode(_sclPin, INPUT_PULLUP);
+	delayMicroseconds(GFRTC_RECOVERY_DELAY_US);
+
+	// clock SCL until the device finishes the byte it is sending
+	for (i = 0; i < GFRTC_RECOVERY_CLOCKS && digitalRead(_sdaPin) == LOW; i++) {
+		digitalWrite(_sclPin, LOW);
+		pinMode(_sclPin, OUTPUT);
+		delayMicroseconds(GFRTC_RECOVERY_DELAY_US);
+		pinMode(_sclPin, INPUT_PULLUP);
+		delayMicroseconds(GFRTC_RECOVERY_DELAY_US);
+	}
+
+	// STOP condition, SDA goes high while SCL is high
+	digitalWrite(_sdaPin, LOW);
+	pinMode(_sdaPin, OUTPUT);
+	delayMicroseconds(GFRTC_RECOVERY_DELAY_US);
+	pinMode(_sdaPin, INPUT_PULLUP);
+	delayMicroseconds(GFRTC_RECOVERY_DELAY_US);
+	released = (digitalRead(_sdaPin) == HIGH);
+
+	// give the pins back to the I2C controller
+	_wire->begin();
+#ifdef WIRE_HAS_TIMEOUT
+	_wire->setWireTimeout(_timeout, true);
+#endif
+	return released;
+}
+
+uint32_t GFRTCClass::getMaxLatency(uint16_t size)
+{
+#ifdef WIRE_HAS_TIMEOUT
+	uint32_t recovery = (2UL * GFRTC_RECOVERY_CLOCKS + 3) * GFRTC_RECOVERY_DELAY_US;
+	uint32_t mux = (_muxAddress != GFRTC_NO_MUX) ? 1 : 0;
+	uint32_t reads, writes;
+	uint64_t waits, read, write;
+
+	if (_timeout == 0)
+		return 0;
+	if (size == 0)
+		size = 1;
+
+	// the backoff doubles on each retry of a transfer
+	waits = _retries * (uint64_t) recovery + (((uint64_t) _backoff << _retries) - _backoff);
+
+	// a read retries the mux selection, the register pointer and every burst
+	reads = (size + GFRTC_WIRE_BUFFER_SIZE - 1) / GFRTC_WIRE_BUFFER_SIZE;
+	read = (_retries + 1ULL) * (mux + 1 + reads) * _timeout + waits;
+
+	// each burst of a write is retried on its own with the mux selection
+	writes = (size + GFRTC_WIRE_BUFFER_SIZE - 2) / (GFRTC_WIRE_BUFFER_SIZE - 1);
+	write = writes * ((_retries + 1ULL) * (mux + 1) * _timeout + waits);
+
+	if (write > read)
+		read = write;
+	return (read > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t) read;
+#else
+	(void) size;
+	return 0;
+#endif
+}
+
+#if GFRTC_LOCKING
+void GFRTCClass::setLockHooks(gfrtc_lock_hook lock, gfrtc_lock_hook unlock, void * context)
+{
+	_lockHook = lock;
+	_unlockHook = unlock;
+	_lockContext = context;
+}
+#endif
+
+void GFRTCClass::setMux(uint8_t address, uint8_t channel)
+{
+	GFRTCClass * rtc;
+
+	_muxAddress = address;
+	_muxChannel = channel & 0x07;
+	_muxSelected = false;
+
+	// other instances on the bus have to find this mux to deselect it
+	for (rtc = _muxList; rtc != NULL && rtc != this; rtc = rtc->_muxNext)
+		;
+	if (rtc == NULL && address != GFRTC_NO_MUX) {
+		_muxNext = _muxList;
+		_muxList = this;
+	}
+}
+
+uint8_t GFRTCClass::readAll(GFRTCClass * const * rtcs, timelib_t * times, uint8_t count)
+{
+	uint8_t i, valid = 0;
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_READ);
+
+	// registers are decoded straight to a timestamp, keeping the gap between
+	// transfers to different chips short
+	for (i = 0; i < count; i++) {
+		if (rtcs[i]->readTimestamp(times[i])) {
+			valid++;
+		} else {
+			times[i] = 0;
+		}
+	}
+	return valid;
+}
+
+bool GFRTCClass::muxSelect()
+{
+	GFRTCClass * rtc;
+
+	if (_muxSelected)
+		return true;
+
+	// a channel left open on another mux of this bus may have a chip with
+	// the same address, writing the same mux again replaces its channel
+	for (rtc = _muxList; rtc != NULL; rtc = rtc->_muxNext) {
+		if (rtc == this || rtc->_wire != _wire || !rtc->_muxSelected)
+			continue;
+		if (_muxAddress == GFRTC_NO_MUX && rtc->_address != _address)
+			continue;
+		if (rtc->_muxAddress != _muxAddress) {
+			_wire->beginTransmission(rtc->_muxAddress);
+			_wire->write((uint8_t) 0);
+			if (GFRTC_STATS_WRITE(_wire->endTransmission(), 1) != 0)
+				return false;
+		}
+		rtc->_muxSelected = false;
+	}
+
+	if (_muxAddress == GFRTC_NO_MUX)
+		return true;
+
+	// a single byte selects the channels that are connected
+	_wire->beginTransmission(_muxAddress);
+	_wire->write((uint8_t) (1 << _muxChannel));
+	if (GFRTC_STATS_WRITE(_wire->endTransmission(), 1) != 0)
+		return false;
+	_muxSelected = true;
+	return true;
 }
 
 bool GFRTCClass::isPresent()
@@ -428,21 +1322,300 @@ bool GFRTCClass::isPresent()
 	return _isPresent;
 }
 
+enum gfrtc_chips GFRTCClass::getChip()
+{
+	return _chip;
+}
+
 /*-------------------------------------------------------------*
  *		Private members					*
  *-------------------------------------------------------------*/
 
+#if GFRTC_STATS
+bool GFRTCClass::getStats(enum gfrtc_stats_ops op, struct gfrtc_stats & stats)
+{
+	if (op >= E_STATS_OPS)
+		return false;
+	noInterrupts();
+	stats = _stats[op];
+	interrupts();
+	return true;
+}
+
+void GFRTCClass::resetStats()
+{
+	noInterrupts();
+	memset(_stats, 0, sizeof(_stats));
+	interrupts();
+}
+#endif
+
 uint8_t GFRTCClass::dec2bcd(uint8_t num)
 {
-	return((num / 10 * 16) + (num % 10));
+	return gfrtc_dec2bcd(num);
 }
 
 uint8_t GFRTCClass::bcd2dec(uint8_t num)
 {
-	return((num / 16 * 10) + (num % 16));
+	return gfrtc_bcd2dec(num);
+}
+
+#if GFRTC_USE_NVRAM
+bool GFRTCClass::nvramAddress(uint8_t offset, uint16_t size, uint8_t & addr)
+{
+	// DS3231 has no general purpose memory
+	if ((uint16_t) offset + size > getNVRAMSize())
+		return false;
+	addr = ((_chip == E_CHIP_DS1307) ? DS1307_RAM_START_ADDR : SRAM_START_ADDR) + offset;
+	return true;
+}
+#endif
+
+void GFRTCClass::publish(timelib_t t)
+{
+	uint32_t now = millis();
+
+	// readers use the copy that is not being written
+	_published.sequence++;
+	GFRTC_MEMORY_BARRIER();
+	_published.time[0] = t;
+	_published.millis[0] = now;
+	GFRTC_MEMORY_BARRIER();
+	_published.sequence++;
+	GFRTC_MEMORY_BARRIER();
+	_published.time[1] = t;
+	_published.millis[1] = now;
+	_published.valid = true;
+}
+
+bool GFRTCClass::readTimestamp(timelib_t & t)
+{
+	uint8_t regs[7];
+
+	// time registers are never shadowed
+	if (!busRead(GFRTC_REG_SECONDS, regs, sizeof(regs)))
+		return false;
+
+	// If clock is halted, return false (DS1307 only)
+	if ((regs[0] & 0x80) && _chip != E_CHIP_DS3231 && _chip != E_CHIP_DS3232) {
+		GFRTC_STATS_HALTED();
+		return false;
+	}
+
+	t = gfrtc_regs2time(regs);
+	publish(t);
+	return true;
+}
+
+#if GFRTC_USE_DIAGNOSTICS
+void GFRTCClass::recordTemperature(int16_t quarters)
+{
+#if GFRTC_TEMP_HISTORY_SIZE > 0
+	_history[_historyHead].millis = millis();
+	_history[_historyHead].quarters = quarters;
+	if (++_historyHead == GFRTC_TEMP_HISTORY_SIZE)
+		_historyHead = 0;
+	if (_historyCount < GFRTC_TEMP_HISTORY_SIZE)
+		_historyCount++;
+#else
+	(void) quarters;
+#endif
+}
+#endif
+
+enum gfrtc_chips GFRTCClass::detectChip()
+{
+	uint8_t time[5], check[5], probe[6];
+	uint8_t attempt;
+	enum gfrtc_chips chip;
+
+	for (attempt = 0; attempt < 3; attempt++) {
+		// seconds to date, used as reference to detect pointer wrap around. Day
+		// of week and date are never zero, so a cleared SRAM cannot match them
+		if (!busRead(GFRTC_REG_SECONDS, time, sizeof(time)))
+			return E_CHIP_UNKNOWN;
+
+		// DS3231 wraps from the temperature LSB to seconds, the unused bits of
+		// the temperature LSB are always zero
+		if (!busRead(GFRTC_REG_LSB_TEMP, probe, sizeof(probe)))
+			return E_CHIP_UNKNOWN;
+		if (!(probe[0] & 0x3F) && !memcmp(&probe[1], time, sizeof(time))) {
+			chip = E_CHIP_DS3231;
+		} else {
+			// DS1307 wraps from the last RAM byte to seconds
+			if (!busRead(0x3F, probe, sizeof(probe)))
+				return E_CHIP_UNKNOWN;
+			if (!memcmp(&probe[1], time, sizeof(time))) {
+				chip = E_CHIP_DS1307;
+			} else {
+				chip = E_CHIP_DS3232;
+			}
+		}
+
+		// repeat if the time changed while probing
+		if (!busRead(GFRTC_REG_SECONDS, check, sizeof(check)))
+			return E_CHIP_UNKNOWN;
+		if (!memcmp(check, time, sizeof(time)))
+			return chip;
+	}
+	return E_CHIP_UNKNOWN;
+}
+
+bool GFRTCClass::hasDS3231Registers()
+{
+	return _chip != E_CHIP_DS1307;
+}
+
+#if GFRTC_USE_ALARMS
+void GFRTCClass::encodeAlarm(enum gfrtc_alarm_types type, uint8_t hour, uint8_t minute, uint8_t second, uint8_t dow, uint8_t * regs)
+{
+	regs[0] = dec2bcd(second);
+	regs[1] = dec2bcd(minute);
+	regs[2] = dec2bcd(hour);
+	regs[3] = dec2bcd(dow);
+
+	if (type & 0x01) regs[0] |= 1 << GFRTC_BIT_A1M1;
+	if (type & 0x02) regs[1] |= 1 << GFRTC_BIT_A1M2;
+	if (type & 0x04) regs[2] |= 1 << GFRTC_BIT_A1M3;
+	if (type & 0x10) regs[3] |= 1 << GFRTC_BIT_DYDT;
+	if (type & 0x08) regs[3] |= 1 << GFRTC_BIT_A1M4;
 }
 
-bool GFRTCClass::_isPresent = false;
+void GFRTCClass::decodeAlarm(const uint8_t * regs, uint8_t type, struct gfrtc_alarm & alarm)
+{
+	if (regs[0] & (1 << GFRTC_BIT_A1M1)) type |= 0x01;
+	if (regs[1] & (1 << GFRTC_BIT_A1M2)) type |= 0x02;
+	if (regs[2] & (1 << GFRTC_BIT_A1M3)) type |= 0x04;
+	if (regs[3] & (1 << GFRTC_BIT_A1M4)) type |= 0x08;
+	if (regs[3] & (1 << GFRTC_BIT_DYDT)) type |= 0x10;
+
+	alarm.type = (enum gfrtc_alarm_types) type;
+	alarm.second = bcd2dec(regs[0] & 0x7f);
+	alarm.minute = bcd2dec(regs[1] & 0x7f);
+	alarm.hour = bcd2dec(regs[2] & 0x3f); // mask assumes 24hr clock
+	alarm.dow = bcd2dec(regs[3] & 0x3f);
+}
+
+bool GFRTCClass::shadowLoad()
+{
+	uint8_t i;
+	uint8_t regs[GFRTC_SHADOW_SIZE];
+	const uint16_t all = (1 << GFRTC_SHADOW_SIZE) - 1;
+
+	if (_shadow.valid == all)
+		return true;
+
+	// read the whole block in a single transaction
+	if (!busRead(GFRTC_SHADOW_START, regs, sizeof(regs)))
+		return false;
+	for (i = 0; i < GFRTC_SHADOW_SIZE; i++) {
+		if (!(_shadow.dirty & (1 << i)))
+			_shadow.regs[i] = regs[i];
+	}
+	_shadow.valid = all;
+	return true;
+}
+
+bool GFRTCClass::shadowCovers(uint8_t addr, uint8_t size)
+{
+	// every register must be on the shadow and the status register is volatile
+	if (addr < GFRTC_SHADOW_START || addr + size > GFRTC_SHADOW_START + GFRTC_SHADOW_SIZE)
+		return false;
+	return !(addr <= GFRTC_REG_STATUS && addr + size > GFRTC_REG_STATUS);
+}
+
+bool GFRTCClass::shadowOverlaps(uint8_t addr, uint8_t size)
+{
+	return size != 0 && addr < GFRTC_SHADOW_START + GFRTC_SHADOW_SIZE && addr + size > GFRTC_SHADOW_START;
+}
+#endif
+
+#if GFRTC_STATS
+bool GFRTCClass::statsBegin(enum gfrtc_stats_ops op)
+{
+	// nested calls are accounted on the method called by the user
+	if (_statsOp != E_STATS_OPS)
+		return false;
+	_statsOp = op;
+	_statsStart = micros();
+	_stats[op].calls++;
+	return true;
+}
+
+void GFRTCClass::statsEnd()
+{
+	struct gfrtc_stats * s = &_stats[_statsOp];
+	uint32_t elapsed = micros() - _statsStart;
+	uint32_t scaled = elapsed >> 4;
+	uint8_t bucket = 0;
+
+	// logarithmic buckets, the limit doubles on each one
+	while (scaled != 0 && bucket < GFRTC_STATS_BUCKETS - 1) {
+		scaled >>= 1;
+		bucket++;
+	}
+	if (s->latency[bucket] != 0xFFFF)
+		s->latency[bucket]++;
+	s->time += elapsed;
+	_statsOp = E_STATS_OPS;
+}
+
+uint8_t GFRTCClass::statsWrite(uint8_t result, uint8_t bytes)
+{
+	struct gfrtc_stats * s = &_stats[(_statsOp == E_STATS_OPS) ? (uint8_t) E_STATS_OTHER : _statsOp];
+
+	s->transactions++;
+	s->bytes += bytes;
+	if (result != 0)
+		s->nacks++;
+	return result;
+}
+
+int GFRTCClass::statsRead(int available, uint8_t size)
+{
+	struct gfrtc_stats * s = &_stats[(_statsOp == E_STATS_OPS) ? (uint8_t) E_STATS_OTHER : _statsOp];
+
+	s->transactions++;
+	s->bytes += available;
+	if (available < size)
+		s->shortReads++;
+	return available;
+}
+
+void GFRTCClass::statsHalted()
+{
+	_stats[(_statsOp == E_STATS_OPS) ? (uint8_t) E_STATS_OTHER : _statsOp].halted++;
+}
+
+void GFRTCClass::statsRetry(bool recovered)
+{
+	struct gfrtc_stats * s = &_stats[(_statsOp == E_STATS_OPS) ? (uint8_t) E_STATS_OTHER : _statsOp];
+
+	s->retries++;
+	if (recovered)
+		s->recoveries++;
+}
+#endif
+
+GFRTCClass * GFRTCClass::_muxList = NULL;
+
+#if GFRTC_LOCKING
+gfrtc_lock_hook GFRTCClass::_lockHook = NULL;
+
+gfrtc_lock_hook GFRTCClass::_unlockHook = NULL;
+
+void * GFRTCClass::_lockContext = NULL;
+#endif
+
+uint8_t GFRTCClass::_busEpoch = 0;
+
+#if GFRTC_STATS
+struct gfrtc_stats GFRTCClass::_stats[E_STATS_OPS];
+
+uint8_t GFRTCClass::_statsOp = E_STATS_OPS;
+
+uint32_t GFRTCClass::_statsStart = 0;
+#endif
 
 /**
  * Create an instance for the user
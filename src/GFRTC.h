@@ -25,6 +25,7 @@
  *-------------------------------------------------------------*/
 #include <Wire.h>
 #include <TimeLib.h>
+#include "GFRTCCodec.h"
 
 /*-------------------------------------------------------------*
  *		Library configuration				*
@@ -35,6 +36,130 @@
  */
 #define GFRTC_VERSION_STRING	"3.0.0"
 
+/**
+ * Footprint tiers, each one adds features to the previous one: time keeping,
+ * alarms / INT/SQW / shadow registers, NVRAM and finally temperature and
+ * diagnostics (snapshot, flags and temperature history). Set GFRTC_TIER as a
+ * compiler flag so it applies to every file of the library
+ */
+#define GFRTC_TIER_TIME	0
+#define GFRTC_TIER_ALARMS	1
+#define GFRTC_TIER_NVRAM	2
+#define GFRTC_TIER_FULL	3
+
+#ifndef GFRTC_TIER
+#define GFRTC_TIER	GFRTC_TIER_FULL
+#endif
+
+#define GFRTC_USE_ALARMS	(GFRTC_TIER >= GFRTC_TIER_ALARMS)
+#define GFRTC_USE_NVRAM	(GFRTC_TIER >= GFRTC_TIER_NVRAM)
+#define GFRTC_USE_DIAGNOSTICS	(GFRTC_TIER >= GFRTC_TIER_FULL)
+
+/**
+ * Default maximum time in seconds between synchronizations with the RTC chip
+ * when the cached clock is enabled
+ */
+#define GFRTC_CACHE_DEFAULT_INTERVAL	3600UL
+
+/**
+ * Default maximum estimated error in milliseconds allowed on the cached clock
+ * before a new synchronization is forced
+ */
+#define GFRTC_CACHE_DEFAULT_MAX_ERROR	500
+
+/**
+ * Milliseconds between synchronization attempts while the RTC does not answer
+ * and the cached clock holds no valid time
+ */
+#define GFRTC_CACHE_RETRY_INTERVAL	1000UL
+
+/**
+ * Milliseconds over which the drift rate of the cached clock is measured
+ * before the measurement restarts, must be below the overflow of millis()
+ */
+#define GFRTC_CACHE_DRIFT_SPAN	0x40000000UL
+
+/**
+ * Number of temperature samples kept in RAM for trend logging, set to 0 to
+ * disable the history
+ */
+#ifndef GFRTC_TEMP_HISTORY_SIZE
+#define GFRTC_TEMP_HISTORY_SIZE	4
+#endif
+#if !GFRTC_USE_DIAGNOSTICS
+#undef GFRTC_TEMP_HISTORY_SIZE
+#define GFRTC_TEMP_HISTORY_SIZE	0
+#endif
+
+/**
+ * Default maximum time in microseconds of each bus phase, passed to
+ * Wire.setWireTimeout() on cores that support it
+ */
+#define GFRTC_DEFAULT_TIMEOUT_US	25000UL
+
+/**
+ * Default number of times a failed transfer is retried
+ */
+#define GFRTC_DEFAULT_RETRIES	2
+
+/**
+ * Default wait in microseconds before the first retry, doubled on each retry
+ */
+#define GFRTC_DEFAULT_BACKOFF_US	100
+
+/**
+ * Half period in microseconds of the SCL clocks generated by bus recovery
+ */
+#define GFRTC_RECOVERY_DELAY_US	5
+
+/**
+ * Set to 1 to serialize access to the bus with the functions passed to
+ * setLockHooks(). Enabled by default except on AVR chips, where the library
+ * only runs from the main loop.
+ */
+#ifndef GFRTC_LOCKING
+#if defined(__AVR__)
+#define GFRTC_LOCKING	0
+#else
+#define GFRTC_LOCKING	1
+#endif
+#endif
+
+/**
+ * Number of times getPublishedTime() tries to get a consistent copy of the
+ * published time before giving up
+ */
+#define GFRTC_PUBLISH_RETRIES	4
+
+/**
+ * Orders the accesses to the published time. A compiler barrier is enough on
+ * single core AVR chips, other targets also need a hardware fence.
+ */
+#ifndef GFRTC_MEMORY_BARRIER
+#if defined(__AVR__)
+#define GFRTC_MEMORY_BARRIER()	__asm__ __volatile__("" ::: "memory")
+#else
+#define GFRTC_MEMORY_BARRIER()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+#endif
+
+/**
+ * Set to 1 to count bus transfers, errors and latency of each operation, the
+ * instrumentation is compiled out when set to 0
+ */
+#ifndef GFRTC_STATS
+#define GFRTC_STATS	0
+#endif
+
+/**
+ * Number of buckets of the latency histogram, bucket 0 holds operations that
+ * took less than 16 us and each following bucket doubles the limit, the last
+ * one holds everything above
+ */
+#ifndef GFRTC_STATS_BUCKETS
+#define GFRTC_STATS_BUCKETS	12
+#endif
+
 /*-------------------------------------------------------------*
  *		Macros and definitions				*
  *-------------------------------------------------------------*/
@@ -73,6 +198,42 @@
 #define SRAM_START_ADDR 0x14
 #define SRAM_SIZE 236
 
+/**
+ * size for DS1307 RAM
+ */
+#define DS1307_RAM_START_ADDR 0x08
+#define DS1307_RAM_SIZE 56
+
+/**
+ * Size of the transmit and receive buffers of the Wire library, the register
+ * address takes one byte of the transmit buffer
+ */
+#ifndef GFRTC_WIRE_BUFFER_SIZE
+#define GFRTC_WIRE_BUFFER_SIZE 32
+#endif
+
+/**
+ * Pin value used when bus recovery is not possible
+ */
+#define GFRTC_NO_PIN	0xFF
+
+/**
+ * Mux address used when the chip is connected directly to the bus
+ */
+#define GFRTC_NO_MUX	0xFF
+
+/**
+ * Maximum number of SCL clocks needed to make a device release SDA, a device
+ * stuck in a read shifts out the rest of its byte (8 bits) and the ACK bit
+ */
+#define GFRTC_RECOVERY_CLOCKS	9
+
+/**
+ * range of registers kept on the shadow copy (alarms, control, status and aging)
+ */
+#define GFRTC_SHADOW_START GFRTC_REG_ALM1_SECONDS
+#define GFRTC_SHADOW_SIZE 10
+
 /**
  * alarm bits
  */
@@ -148,6 +309,16 @@ enum gfrtc_intsqw_modes {
 	E_INTERRUPT_OUTPUT,
 };
 
+/**
+ * RTC chips detected by begin()
+ */
+enum gfrtc_chips {
+	E_CHIP_UNKNOWN = 0,
+	E_CHIP_DS1307,
+	E_CHIP_DS3231,
+	E_CHIP_DS3232,
+};
+
 /**
  * Defines the available alarms available on the RTC
  */
@@ -156,23 +327,235 @@ enum gfrtc_alarms {
 	E_ALARM_2
 };
 
+/**
+ * Function called by serviceAlarms() for each alarm that fired
+ */
+typedef void (*gfrtc_alarm_handler)(enum gfrtc_alarms alarm);
+
+/**
+ * Function that takes or releases the bus lock, see setLockHooks()
+ */
+typedef void (*gfrtc_lock_hook)(void * context);
+
+/**
+ * Configuration of one alarm, used to program both alarms at once
+ */
+struct gfrtc_alarm {
+	/** The type of alarm according to gfrtc_alarm_types enumeration */
+	enum gfrtc_alarm_types type;
+	/** The hour of the alarm */
+	uint8_t hour;
+	/** The minute of the alarm */
+	uint8_t minute;
+	/** The second of the alarm, ignored by alarm 2 */
+	uint8_t second;
+	/** The day of the week or date for the alarm */
+	uint8_t dow;
+	/** Enable the interrupt output for this alarm */
+	bool interrupt;
+};
+
+/**
+ * State of the chip captured by wake()
+ */
+struct gfrtc_wake {
+	/** Time registers as a unix timestamp */
+	timelib_t time;
+	/** Alarms that fired, (1 << E_ALARM_1) and / or (1 << E_ALARM_2) */
+	uint8_t alarms;
+	/** The oscillator stop flag was set, the time may be invalid. The flag
+	is not cleared, see getOscillatorStopFlag() */
+	bool oscillatorStopped;
+};
+
+/**
+ * Policies for the shadow copy of the alarm, control, status and aging registers
+ */
+enum gfrtc_shadow_policies {
+	E_SHADOW_DISABLED = 0,
+	E_SHADOW_WRITE_THROUGH,
+	E_SHADOW_WRITE_BACK,
+};
+
+/**
+ * Shadow copy of registers 0x07 to 0x10
+ */
+struct gfrtc_shadow {
+	/** Policy selected by the user */
+	uint8_t policy;
+	/** Bitmask of registers holding the same value as the chip */
+	uint16_t valid;
+	/** Bitmask of registers modified but not yet written to the chip */
+	uint16_t dirty;
+	/** Copy of the registers */
+	uint8_t regs[GFRTC_SHADOW_SIZE];
+};
+
+/**
+ * Time published by every successful access to the time registers. There are
+ * two copies: while one is being updated readers use the other one, selected
+ * by the lowest bit of the sequence, so an interrupt handler that preempts
+ * the update still gets a consistent time without waiting.
+ */
+struct gfrtc_published {
+	/** Incremented before the update of each copy, one byte so that it is
+	read atomically on 8 bit chips */
+	volatile uint8_t sequence;
+	/** A time was published */
+	volatile bool valid;
+	/** Time read from the RTC */
+	volatile timelib_t time[2];
+	/** Value of millis() when the time was read */
+	volatile uint32_t millis[2];
+};
+
+/**
+ * State of the cached software clock
+ */
+struct gfrtc_clock_cache {
+	/** Cached clock enabled by the user */
+	bool enabled;
+	/** The cached clock holds valid data from the RTC */
+	bool valid;
+	/** Current cached time */
+	timelib_t time;
+	/** Value of millis() corresponding to the start of the current second */
+	uint32_t millis;
+	/** Value of millis() when the measurement of the drift rate started */
+	uint32_t rebase;
+	/** Seconds corrected since the measurement of the drift rate started */
+	int32_t corrected;
+	/** Value of millis() when the last synchronization was performed */
+	uint32_t sync;
+	/** Milliseconds after the last synchronization to perform a new one */
+	uint32_t period;
+	/** Maximum interval between synchronizations in milliseconds */
+	uint32_t interval;
+	/** Maximum estimated error in milliseconds */
+	uint16_t maxError;
+	/** RTC time read on the last synchronization */
+	timelib_t lastSync;
+	/** Seconds corrected on the last synchronization */
+	int32_t correction;
+	/** Milliseconds the cached clock runs for each second of error, 0 if no
+	error was seen yet */
+	uint32_t drift;
+	/** The last synchronization failed */
+	bool failed;
+};
+
+/**
+ * State of the chip read by readSnapshot(), registers 0x00 to 0x12
+ */
+struct gfrtc_snapshot {
+	/** Time registers as a unix timestamp */
+	timelib_t time;
+	/** Alarm 1 configuration, interrupt holds the A1IE bit */
+	struct gfrtc_alarm alarm1;
+	/** Alarm 2 configuration, interrupt holds the A2IE bit */
+	struct gfrtc_alarm alarm2;
+	/** Control register, test bits with GFRTC_BIT_EOSC to GFRTC_BIT_A1IE */
+	uint8_t control;
+	/** Status register, test bits with GFRTC_BIT_OSF to GFRTC_BIT_A1F */
+	uint8_t status;
+	/** Aging offset register */
+	int8_t aging;
+	/** Temperature in quarters of celsius degree */
+	int16_t temperature;
+};
+
+/**
+ * Operations accounted separately by the instrumentation
+ */
+enum gfrtc_stats_ops {
+	E_STATS_BEGIN = 0,
+	E_STATS_GET,
+	E_STATS_SET,
+	E_STATS_READ,
+	E_STATS_WRITE,
+	E_STATS_SYNC,
+	E_STATS_READ_REGISTER,
+	E_STATS_WRITE_REGISTER,
+	E_STATS_FLUSH,
+	E_STATS_ALARM,
+	E_STATS_FLAGS,
+	E_STATS_TEMPERATURE,
+	E_STATS_SNAPSHOT,
+	E_STATS_READ_NVRAM,
+	E_STATS_WRITE_NVRAM,
+	E_STATS_ASYNC,
+	E_STATS_OTHER,
+	E_STATS_OPS,
+};
+
+/**
+ * Counters of one operation
+ */
+struct gfrtc_stats {
+	/** Number of calls, calls made by other methods of the library are
+	accounted on the outermost one */
+	uint32_t calls;
+	/** Number of bus transactions (write phases and read phases) */
+	uint32_t transactions;
+	/** Number of bytes moved, register addresses included */
+	uint32_t bytes;
+	/** Total time spent on the operation in microseconds */
+	uint32_t time;
+	/** Number of write phases not acknowledged by the chip */
+	uint16_t nacks;
+	/** Number of read phases that returned less bytes than requested */
+	uint16_t shortReads;
+	/** Number of time reads that found the clock halted */
+	uint16_t halted;
+	/** Number of transfers retried */
+	uint16_t retries;
+	/** Number of bus recoveries */
+	uint16_t recoveries;
+	/** Latency histogram, see GFRTC_STATS_BUCKETS */
+	uint16_t latency[GFRTC_STATS_BUCKETS];
+};
+
+/**
+ * Temperature sample kept on the history
+ */
+struct gfrtc_temp_sample {
+	/** Value of millis() when the sample was read */
+	uint32_t millis;
+	/** Temperature in quarters of celsius degree */
+	int16_t quarters;
+};
+
 /*-------------------------------------------------------------*
  *		Class declaration				*
  *-------------------------------------------------------------*/
 class GFRTCClass {
 public:
-	GFRTCClass();
+	/**
+	 * Creates a driver for one RTC chip. Each instance keeps its own detected
+	 * chip type, cached clock, shadow registers and retry policy, so several
+	 * chips can be used on different buses or behind an I2C mux. The GFRTC
+	 * global drives the chip at the default address on Wire.
+	 *
+	 * @param wire The bus where the chip is connected.
+	 * @param address The I2C address of the chip.
+	 */
+	GFRTCClass(TwoWire & wire = Wire, uint8_t address = GFRTC_I2C_ADDRESS);
 
 	/**
 	 * Prepares the GFRTC library for use, if parameter is set to true, also
 	 * initializes the underying I2C interface.
+	 *
+	 * The type of chip is detected on this call by probing the register map:
+	 * the DS3231 register pointer wraps to 0x00 after the temperature
+	 * registers and the DS1307 pointer wraps after the last byte of RAM (0x3F),
+	 * while the DS3232 keeps going through its SRAM.
 	 * 
 	 * @param begini2c Parameter that indicates if we want to intialize the Wire
 	 * library on this call (calls Wire.begin() if set to true).
 	 * 
 	 * @return Returns true if communication with I2C RTC is successfull.
 	 */
-	static bool begin(bool beginI2C = true);
+	bool begin(bool beginI2C = true);
 
 	/**
 	 * Reads the RTC time/date registers and converts the value to a unix timestamp.
@@ -183,10 +566,14 @@ public:
 	 * 
 	 * If the library fails to obtain date/time from RTC, this will return 0.
 	 *
+	 * When the cached clock is enabled with setCachedMode() the time is
+	 * extrapolated from millis() and the RTC is only read when a new
+	 * synchronization is due.
+	 *
 	 * @return A Unix timestamp representing the number of seconds elapsed since
 	 * 00:00 hours, Jan 1, 1970 UTC to the present date.
 	 */
-	static timelib_t get();
+	timelib_t get();
 
 	/**
 	 * Writes the RTC time/date registers with the value provided as unix timestamp.
@@ -195,11 +582,15 @@ public:
 	 * from a 32 bit integer value representing the number of seconds elapsed since
 	 * 00:00 hours, Jan 1, 1970 UTC (a unix timestamp).
 	 *
+	 * On DS3231 and DS3232 chips this is a single write transaction, on DS1307
+	 * or unknown chips the registers are written twice to set and then clear
+	 * the clock halt bit.
+	 *
 	 * @param t The timestamp corresponding to current time.
 	 *
 	 * @return Return true if successfully written data to RTC chip.
 	 */
-	static bool set(timelib_t t);
+	bool set(timelib_t t);
 
 	/**
 	 * Read the RTC time/date registers to structure.
@@ -211,7 +602,19 @@ public:
 	 *
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool read(struct timelib_tm &dt);
+	bool read(struct timelib_tm &dt);
+
+	/**
+	 * Reads the RTC time/date registers and decodes them straight to a
+	 * timestamp with the codec. Unlike get(), the time is never served from
+	 * the cached clock.
+	 *
+	 * @param t Reference to variable where the time is stored.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the clock is halted.
+	 */
+	bool read(timelib_t & t);
 
 	/**
 	 * Write the RTC time/date registers from structure.
@@ -224,7 +627,101 @@ public:
 	 *
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool write(struct timelib_tm &dt);
+	bool write(struct timelib_tm &dt);
+
+	/**
+	 * Enables or disables the cached software clock used by get().
+	 *
+	 * When enabled, the RTC is read once and the time is then extrapolated from
+	 * millis(), so get() does not generate traffic on the I2C bus. The clock is
+	 * synchronized again with the RTC when the interval expires or earlier if
+	 * the drift measured on previous synchronizations predicts an error larger
+	 * than the maximum error allowed. The drift rate is averaged over all the
+	 * synchronizations since the clock was loaded and kept while no error is
+	 * seen. While the RTC does not answer and there is no time to serve, get()
+	 * tries again every GFRTC_CACHE_RETRY_INTERVAL milliseconds.
+	 *
+	 * @param enable Set to true to enable the cached clock.
+	 * @param interval Maximum time in seconds between synchronizations.
+	 * @param maxerror Maximum estimated error in milliseconds, 0 disables the
+	 * drift based synchronization.
+	 */
+	void setCachedMode(bool enable, uint32_t interval = GFRTC_CACHE_DEFAULT_INTERVAL, uint16_t maxerror = GFRTC_CACHE_DEFAULT_MAX_ERROR);
+
+	/**
+	 * Synchronizes the cached software clock with the RTC chip.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	bool sync();
+
+	/**
+	 * Gets the RTC time read on the last synchronization of the cached clock.
+	 *
+	 * @return A Unix timestamp of the last synchronization, 0 if the cached
+	 * clock was never synchronized.
+	 */
+	timelib_t getLastSync();
+
+	/**
+	 * Gets the correction applied to the cached clock on the last
+	 * synchronization.
+	 *
+	 * @return The number of seconds the cached clock was behind the RTC,
+	 * negative if the cached clock was ahead.
+	 */
+	int32_t getLastCorrection();
+
+	/**
+	 * Gets the last time read from the chip, advanced by the milliseconds
+	 * elapsed since then. The bus is not used and no lock is taken, so this
+	 * method can be called from interrupt handlers and from any thread while
+	 * another one is talking to the chip. The time is published by get(),
+	 * read(), set(), write(), sync(), readAll(), wake() and the time transfers
+	 * of GFRTCAsync.
+	 *
+	 * @param t Reference to variable where the time is stored.
+	 *
+	 * @return Returns true if a time was published, false if none was or if
+	 * a consistent copy could not be taken.
+	 */
+	bool getPublishedTime(timelib_t & t);
+
+#if GFRTC_USE_ALARMS
+	/**
+	 * Enables or disables the shadow copy of the alarm, control and aging
+	 * registers (0x07 to 0x10).
+	 *
+	 * With the shadow copy enabled, read-modify-write operations such as
+	 * writeBit(), setAlarmInterrupt() and setIntSqwMode() are served from RAM
+	 * and only generate the write transaction. The status register is always
+	 * read from the chip because the A1F, A2F, OSF and BSY flags are changed by
+	 * the hardware.
+	 *
+	 * With the write-back policy, writes to the shadowed registers are stored in
+	 * RAM and sent to the chip on the next call to flush(). Writes that set the
+	 * CONV bit and writes to the status register always go to the chip.
+	 *
+	 * @param policy The policy to use, changing policy writes pending data.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	bool setShadowMode(enum gfrtc_shadow_policies policy);
+
+	/**
+	 * Writes the registers modified on the shadow copy to the chip using the
+	 * minimum number of transactions.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	bool flush();
+
+	/**
+	 * Discards the shadow copy, the next access reads the registers again.
+	 * Pending writes are lost.
+	 */
+	void invalidate();
+#endif
 
 	/**
 	 * Reads a register on the indicated address.
@@ -235,7 +732,7 @@ public:
 	 * 
 	 * @return Returns the value of the indicated register.
 	 */
-	static uint8_t readRegister(uint8_t addr, bool * result = NULL);
+	uint8_t readRegister(uint8_t addr, bool * result = NULL);
 
 	/**
 	 * Reads multiple registers starting at the indicated address storing the
@@ -247,7 +744,7 @@ public:
 	 * 
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool readRegister(uint8_t addr, void * data, uint8_t size);
+	bool readRegister(uint8_t addr, void * data, uint8_t size);
 
 	/**
 	 * Writes a register on the indicated address with the given value.
@@ -257,7 +754,7 @@ public:
 	 * 
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool writeRegister(uint8_t addr, uint8_t value);
+	bool writeRegister(uint8_t addr, uint8_t value);
 
 	/**
 	 * Writes multiple registers starting at the indicated address with the
@@ -269,7 +766,7 @@ public:
 	 * 
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool writeRegister(uint8_t addr, const void * data, uint8_t size);
+	bool writeRegister(uint8_t addr, const void * data, uint8_t size);
 	
 	/**
 	 * Reads the status of a bit on an specific register.
@@ -280,7 +777,7 @@ public:
 	 * 
          * @return The status of the requested bit.
          */
-	static bool readBit(uint8_t addr, uint8_t bit, bool * result = NULL);
+	bool readBit(uint8_t addr, uint8_t bit, bool * result = NULL);
 	
 	/**
 	 * Sets or clears a bit on the indicated register.
@@ -291,8 +788,9 @@ public:
 	 * 
          * @return Returns true if communication is successfull, false otherwise.
          */
-	static bool writeBit(uint8_t addr, uint8_t bit, bool value);
+	bool writeBit(uint8_t addr, uint8_t bit, bool value);
 
+#if GFRTC_USE_ALARMS
 	/**
 	 * Configures an alarm on the RTC, this method writes to the Alarm 1 or Alarm 2
 	 * registers according to the type paramter.
@@ -305,7 +803,20 @@ public:
 	 * 
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool setAlarm(enum gfrtc_alarm_types type, uint8_t hour, uint8_t minute, uint8_t second, uint8_t dow);
+	bool setAlarm(enum gfrtc_alarm_types type, uint8_t hour, uint8_t minute, uint8_t second, uint8_t dow);
+
+	/**
+	 * Configures both alarms and their interrupt enable bits with a single
+	 * write transaction to registers 0x07 to 0x0E. The INTCN bit is set if any
+	 * of the interrupts is enabled. The control register is read first to keep
+	 * its other bits unless it is available on the shadow copy.
+	 *
+	 * @param alarm1 Configuration for alarm 1, type must be one of E_ALM1_*.
+	 * @param alarm2 Configuration for alarm 2, type must be one of E_ALM2_*.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	bool setAlarms(const struct gfrtc_alarm & alarm1, const struct gfrtc_alarm & alarm2);
 
 	/**
 	 * Configures the interrupt to drive the corresponding pin on the RTC chip.
@@ -315,7 +826,7 @@ public:
 	 * 
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool setAlarmInterrupt(enum gfrtc_alarms alarm, bool enable);
+	bool setAlarmInterrupt(enum gfrtc_alarms alarm, bool enable);
 
 	/**
 	 * Enables the square wave output on the RTC.
@@ -324,7 +835,7 @@ public:
 	 * 
 	 * @return Returns true if communication is successfull, false otherwise.
 	 */
-	static bool setIntSqwMode(enum gfrtc_intsqw_modes frequency);
+	bool setIntSqwMode(enum gfrtc_intsqw_modes frequency);
 
 	/**
 	 * Determines the alarm that generated an interrupt.
@@ -334,7 +845,56 @@ public:
 	 * 
 	 * @return The number of the alarm that requested an interrupt.
 	 */
-	static bool getAlarmInterruptFlag(enum gfrtc_alarms alarm);
+	bool getAlarmInterruptFlag(enum gfrtc_alarms alarm);
+
+	/**
+	 * Sets the function called by serviceAlarms() when an alarm fires.
+	 *
+	 * @param alarm The alarm.
+	 * @param handler The function to call, NULL to remove it.
+	 */
+	void setAlarmHandler(enum gfrtc_alarms alarm, gfrtc_alarm_handler handler);
+
+	/**
+	 * Services the INT/SQW interrupt: reads the status register once, clears
+	 * only the alarm flags that were seen set with a single write and calls
+	 * the handler of each alarm that fired. A flag that latches between the
+	 * read and the write is kept for the next call. Call it from the main
+	 * loop, not from the interrupt handler.
+	 *
+	 * @param result Optional pointer to bool variable where the result of the
+	 * operation is stored, the method writes true of operation successful.
+	 *
+	 * @return Bitmask of the alarms that fired, (1 << E_ALARM_1) and / or
+	 * (1 << E_ALARM_2).
+	 */
+	uint8_t serviceAlarms(bool * result = NULL);
+
+	/**
+	 * Fast path for a device that sleeps until an alarm wakes it up. Reads the
+	 * control, status and time registers in one burst (the alarm registers too
+	 * on chips other than the DS3231), then arms the next alarm, updates the
+	 * control register and clears only the alarm flags that were seen set.
+	 * Only the registers that change are written, so a wake with nothing to
+	 * change costs one read. On the DS3232 the alarm, control and status
+	 * registers are written in one burst. The DS3231 does not read the alarm
+	 * registers, so arming alarm 1 writes them and the control and status
+	 * registers in separate bursts. The oscillator is always kept running on
+	 * battery (EOSC cleared) and OSF is only reported, it stays set until the
+	 * time is set again and getOscillatorStopFlag(true) clears it. The
+	 * handlers set with setAlarmHandler() are called after the write.
+	 *
+	 * @param state Reference to structure where time and flags are stored.
+	 * @param next Optional alarm to program, its interrupt field enables the
+	 * interrupt output for that alarm. NULL leaves the alarms unchanged.
+	 * @param battery Keep the INT/SQW output active when the chip runs from
+	 * the backup battery (BBSQW), needed when the alarm switches on the power
+	 * supply of the device.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	bool wake(struct gfrtc_wake & state, const struct gfrtc_alarm * next = NULL, bool battery = false);
+#endif
 
 	/**
 	 * Reads the flag that indicates that the oscillator failed. If this flag is 
@@ -347,38 +907,107 @@ public:
 	 * @return Returns true if oscillator stopped at some time, false if oscillator
 	 * operation is normal.
 	 */
-	static bool getOscillatorStopFlag(bool clearosf = false);
+	bool getOscillatorStopFlag(bool clearosf = false);
 
+#if GFRTC_USE_DIAGNOSTICS
 	/**
 	 * Reads the RTCs internal temperature sensor.
 	 * 
 	 * @return The temperature measured by internal temperature sensor.
 	 */
-	static int16_t getTemperature();
+	int16_t getTemperature();
 
+	/**
+	 * Reads the temperature with the full 0.25 degree resolution of the sensor.
+	 * Both temperature registers are read in a single burst so the MSB and LSB
+	 * always belong to the same conversion. The value is also stored on the
+	 * temperature history.
+	 *
+	 * @param quarters Reference to variable where the temperature is stored,
+	 * in quarters of celsius degree (divide by 4.0 to get degrees).
+	 *
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the chip has no temperature sensor.
+	 */
+	bool readTemperature(int16_t & quarters);
+
+	/**
+	 * Gets the most recent temperature samples read from the chip by this
+	 * class or by GFRTCAsync, no bus transfer is performed.
+	 *
+	 * @param samples Pointer to array where samples are copied, newest first.
+	 * @param count Maximum number of samples to copy.
+	 *
+	 * @return The number of samples copied.
+	 */
+	uint8_t getTemperatureHistory(struct gfrtc_temp_sample * samples, uint8_t count);
+
+	/**
+	 * Reads the whole register map of the DS3231 / DS3232 (time, alarms,
+	 * control, status, aging offset and temperature, 19 bytes) in a single
+	 * burst and decodes it. Flags are not cleared, use clearFlags() for that.
+	 *
+	 * @param snapshot Reference to structure where the state is stored.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the chip does not have these registers.
+	 */
+	bool readSnapshot(struct gfrtc_snapshot & snapshot);
+
+	/**
+	 * Clears status flags with a single write. Flags that are not on the mask
+	 * are left untouched even if the chip set them after the snapshot was read,
+	 * configuration bits of the status register are taken from the snapshot.
+	 *
+	 * @param snapshot Snapshot read with readSnapshot().
+	 * @param flags Mask of flags to clear, any combination of
+	 * (1 << GFRTC_BIT_OSF), (1 << GFRTC_BIT_A2F) and (1 << GFRTC_BIT_A1F).
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	bool clearFlags(const struct gfrtc_snapshot & snapshot, uint8_t flags);
+#endif
+
+#if GFRTC_USE_NVRAM
 	/**
 	 * Reads from general purpose NVRAM on the RTC chip. This only works on RTC chips
-	 * that have built-in NVRAM.
+	 * that have built-in NVRAM (56 bytes on DS1307, 236 bytes on DS3232).
 	 *
-	 * @param address The address to read from.
+	 * The register pointer is set once and the data is read in back to back
+	 * bursts that fit the Wire buffer, the chip keeps incrementing the pointer
+	 * between them.
+	 *
+	 * @param offset The offset from the first byte of NVRAM to read from.
 	 * @param buffer Pointer where data from NVRAM should be stored.
 	 * @param size Size of the data to transfer.
 	 *
-	 * @return Returns true if communication is successfull, false otherwise.
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the range exceeds the NVRAM size.
 	 */
-	static bool readNVRAM(uint8_t address, void * buffer, uint16_t size);
+	bool readNVRAM(uint8_t offset, void * buffer, uint16_t size);
 
 	/**
 	 * Writes general purpose NVRAM on the RTC chip. This only works on RTC chips
-	 * that have built-in NVRAM.
+	 * that have built-in NVRAM (56 bytes on DS1307, 236 bytes on DS3232).
 	 *
-	 * @param address The address to write to.
+	 * The data is split in bursts that fit the Wire buffer.
+	 *
+	 * @param offset The offset from the first byte of NVRAM to write to.
 	 * @param buffer Pointer to buffer containing data to write on NVRAM.
 	 * @param size Size of the data to transfer.
 	 *
-	 * @return Returns true if communication is successfull, false otherwise.
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the range exceeds the NVRAM size.
+	 */
+	bool writeNVRAM(uint8_t offset, const void * buffer, uint16_t size);
+
+	/**
+	 * Gets the size of the general purpose NVRAM of the detected chip.
+	 *
+	 * @return The size in bytes, 0 if the chip has no NVRAM.
 	 */
-	static bool writeNVRAM(uint8_t address, const void * buffer, uint16_t size);
+	uint8_t getNVRAMSize();
+#endif
 
 	/**
 	 * Checks if the library is able to talk to the RTC chip over the I2C bus.
@@ -387,13 +1016,393 @@ public:
 	 * chip. If the chip doesnt responds or is not connected this will return
 	 * false.
 	 */
-	static bool isPresent();
+	bool isPresent();
+
+	/**
+	 * Gets the type of chip detected by begin().
+	 *
+	 * @return The chip type, E_CHIP_UNKNOWN if begin() was not called or the
+	 * chip did not respond.
+	 */
+	enum gfrtc_chips getChip();
+
+	/**
+	 * Sets the maximum time of each bus phase. Only effective on cores where
+	 * the Wire library supports timeouts (WIRE_HAS_TIMEOUT), on other cores a
+	 * device holding the bus can block a transfer forever.
+	 *
+	 * @param timeout Timeout in microseconds, 0 disables it.
+	 */
+	void setTimeout(uint32_t timeout);
+
+	/**
+	 * Sets how failed transfers are retried. Before each retry the bus is
+	 * recovered if a timeout occurred or SDA is held low, then the library
+	 * waits for the backoff time, which doubles on each retry.
+	 *
+	 * @param retries Number of retries, 0 disables retries.
+	 * @param backoff Wait before the first retry in microseconds.
+	 */
+	void setRetryPolicy(uint8_t retries, uint16_t backoff = GFRTC_DEFAULT_BACKOFF_US);
+
+	/**
+	 * Sets the pins used to recover the bus. By default the pins of the Wire
+	 * library are used when the core defines PIN_WIRE_SDA and PIN_WIRE_SCL.
+	 *
+	 * @param sda Pin connected to SDA, GFRTC_NO_PIN disables bus recovery.
+	 * @param scl Pin connected to SCL.
+	 */
+	void setRecoveryPins(uint8_t sda, uint8_t scl);
+
+	/**
+	 * Releases a bus held by a device that was reset or lost power in the
+	 * middle of a transfer. The I2C controller is stopped, SCL is clocked up
+	 * to 9 times until the device releases SDA, a STOP condition is generated
+	 * and the Wire library is started again.
+	 *
+	 * @return Returns true if SDA is released, false if it is still held low
+	 * or recovery pins are not known.
+	 */
+	bool recoverBus();
+
+	/**
+	 * Gets the worst case time of a call that reads or writes a number of
+	 * consecutive registers, including the selection of the multiplexer,
+	 * every burst the transfer is split into and every retry, backoff and bus
+	 * recovery allowed by the current policy. Calls that make several
+	 * transfers, like wake() or the companion classes, take the sum of them.
+	 *
+	 * @param size Bytes transferred, up to 236 for an NVRAM burst. The
+	 * default covers any transfer that fits one burst.
+	 *
+	 * @return The bound in microseconds, 0 if the Wire library has no timeout
+	 * and the time is unbounded.
+	 */
+	uint32_t getMaxLatency(uint16_t size = GFRTC_WIRE_BUFFER_SIZE - 1);
+
+	/**
+	 * Declares that the chip sits behind a TCA9548A compatible I2C mux on the
+	 * same bus. The channel is selected before each transfer, the selection
+	 * is skipped while no other instance changed it. When another instance
+	 * on the same bus left a channel open on a different mux, that mux is
+	 * deselected first so chips with the same address never answer together,
+	 * the same is done before talking to a chip connected directly to the
+	 * bus. The instance is linked to a list and must not be destroyed.
+	 *
+	 * @param address The I2C address of the mux, GFRTC_NO_MUX if the chip is
+	 * connected directly to the bus.
+	 * @param channel The mux channel where the chip is connected (0 to 7).
+	 */
+	void setMux(uint8_t address, uint8_t channel);
+
+	/**
+	 * Reads the time of several chips back to back, for cross-checking
+	 * redundant clocks. Each chip is read with a single burst and the cached
+	 * clock is bypassed, so the values are taken as close as possible.
+	 *
+	 * @param rtcs Array of pointers to the instances to read.
+	 * @param times Array where the timestamps are stored, 0 for each chip
+	 * that could not be read.
+	 * @param count Number of instances.
+	 *
+	 * @return The number of chips read successfully.
+	 */
+	static uint8_t readAll(GFRTCClass * const * rtcs, timelib_t * times, uint8_t count);
+
+#if GFRTC_LOCKING
+	/**
+	 * Sets the functions that serialize access to the bus when the library is
+	 * used from several threads or tasks. The lock is shared by all the
+	 * instances and taken by every method that talks to the chip, it must be
+	 * recursive (xSemaphoreTakeRecursive() on FreeRTOS, std::recursive_mutex
+	 * on Linux) because methods call each other. Interrupt handlers must not
+	 * use the bus, they can use getPublishedTime() instead.
+	 *
+	 * @param lock Function that takes the lock, NULL to disable locking.
+	 * @param unlock Function that releases the lock.
+	 * @param context Pointer passed to both functions, usually the mutex.
+	 */
+	static void setLockHooks(gfrtc_lock_hook lock, gfrtc_lock_hook unlock, void * context = NULL);
+#endif
+
+#if GFRTC_STATS
+	/**
+	 * Gets the counters of an operation. Counters are shared by all the
+	 * instances.
+	 *
+	 * @param op The operation.
+	 * @param stats Reference to structure where counters are copied.
+	 *
+	 * @return Returns true if the operation exists, false otherwise.
+	 */
+	static bool getStats(enum gfrtc_stats_ops op, struct gfrtc_stats & stats);
+
+	/**
+	 * Clears the counters of all operations.
+	 */
+	static void resetStats();
+#endif
 
 private:
+	/**
+	 * Asynchronous transfers share the bus, the presence flag, the cached
+	 * clock and the temperature history of the GFRTC instance.
+	 */
+	friend class GFRTCAsyncClass;
+
+#if GFRTC_LOCKING
+	friend class GFRTCLockScope;
+
+	/**
+	 * Bus lock hooks set with setLockHooks().
+	 */
+	static gfrtc_lock_hook _lockHook;
+
+	static gfrtc_lock_hook _unlockHook;
+
+	static void * _lockContext;
+#endif
+
+	/**
+	 * Incremented on every transfer done by the instances, tells the
+	 * asynchronous transfers that the register pointer may have moved.
+	 */
+	static uint8_t _busEpoch;
+
+	/**
+	 * Time published for readers that cannot use the bus.
+	 */
+	struct gfrtc_published _published;
+
+	/**
+	 * Publishes a time read from or written to the chip.
+	 */
+	void publish(timelib_t t);
+
+	/**
+	 * Moves the cached clock forward by the whole seconds elapsed since the
+	 * start of its current second.
+	 */
+	void cacheAdvance(uint32_t now);
+
+#if GFRTC_STATS
+	friend class GFRTCStatsScope;
+
+	/**
+	 * Counters of each operation.
+	 */
+	static struct gfrtc_stats _stats[E_STATS_OPS];
+
+	/**
+	 * Operation in progress, E_STATS_OPS if none.
+	 */
+	static uint8_t _statsOp;
+
+	static uint32_t _statsStart;
+
+	/**
+	 * Starts accounting an operation.
+	 *
+	 * @return Returns true if this is the outermost operation.
+	 */
+	static bool statsBegin(enum gfrtc_stats_ops op);
+
+	static void statsEnd();
+
+	/**
+	 * Accounts a write phase, returns the result of endTransmission().
+	 */
+	static uint8_t statsWrite(uint8_t result, uint8_t bytes);
+
+	/**
+	 * Accounts a read phase, returns the result of available().
+	 */
+	static int statsRead(int available, uint8_t size);
+
+	static void statsHalted();
+
+	static void statsRetry(bool recovered);
+#endif
+
+	/**
+	 * Bus and address of the chip.
+	 */
+	TwoWire * _wire;
+
+	uint8_t _address;
+
+	/**
+	 * Mux where the chip is connected, GFRTC_NO_MUX if none.
+	 */
+	uint8_t _muxAddress;
+
+	uint8_t _muxChannel;
+
+	/**
+	 * True while the mux channel of this instance is known to be selected.
+	 */
+	bool _muxSelected;
+
+	/**
+	 * Instances behind a mux, the channel of another mux on the same bus is
+	 * closed before selecting this one.
+	 */
+	GFRTCClass * _muxNext;
+
+	static GFRTCClass * _muxList;
+
+	/**
+	 * Selects the mux channel of this instance if needed.
+	 */
+	bool muxSelect();
+
 	/**
 	 * This variable is set to true when the communication is successful.
 	 */
-	static bool _isPresent;
+	bool _isPresent;
+
+#if GFRTC_USE_ALARMS
+	/**
+	 * Functions called by serviceAlarms().
+	 */
+	gfrtc_alarm_handler _alarmHandlers[2];
+#endif
+
+	/**
+	 * Type of chip detected by begin().
+	 */
+	enum gfrtc_chips _chip;
+
+	/**
+	 * Probes the register map to find the chip type.
+	 */
+	enum gfrtc_chips detectChip();
+
+	/**
+	 * Checks if the detected chip has the DS3231 register set (alarms, control,
+	 * status and temperature), unknown chips are assumed to have it.
+	 */
+	bool hasDS3231Registers();
+
+	/**
+	 * State of the cached software clock.
+	 */
+	struct gfrtc_clock_cache _cache;
+
+#if GFRTC_USE_ALARMS
+	/**
+	 * Shadow copy of alarm, control, status and aging registers.
+	 */
+	struct gfrtc_shadow _shadow;
+#endif
+
+	/**
+	 * Maximum time of each bus phase.
+	 */
+	uint32_t _timeout;
+
+	/**
+	 * Retry policy.
+	 */
+	uint8_t _retries;
+
+	uint16_t _backoff;
+
+	/**
+	 * Pins used by bus recovery.
+	 */
+	uint8_t _sdaPin;
+
+	uint8_t _sclPin;
+
+	/**
+	 * Reads registers from the chip, bypassing the shadow copy. Reads longer
+	 * than the Wire buffer are done in back to back bursts. Failed transfers
+	 * are retried.
+	 */
+	bool busRead(uint8_t addr, void * data, uint8_t size);
+
+	/**
+	 * Writes registers on the chip, bypassing the shadow copy. Failed
+	 * transfers are retried.
+	 */
+	bool busWrite(uint8_t addr, const void * data, uint8_t size);
+
+	/**
+	 * Single attempt of busRead().
+	 */
+	bool busReadOnce(uint8_t addr, uint8_t * data, uint8_t size);
+
+	/**
+	 * Single attempt of busWrite().
+	 */
+	bool busWriteOnce(uint8_t addr, const uint8_t * data, uint8_t size);
+
+	/**
+	 * Decides if a failed transfer is retried, recovers the bus if needed and
+	 * waits for the backoff time.
+	 *
+	 * @param attempt Number of the attempt that failed, starting at 0.
+	 */
+	bool retry(uint8_t attempt);
+
+#if GFRTC_USE_NVRAM
+	/**
+	 * Translates an NVRAM offset to a register address, checking that the
+	 * range fits the NVRAM of the detected chip.
+	 */
+	bool nvramAddress(uint8_t offset, uint16_t size, uint8_t & addr);
+#endif
+
+	/**
+	 * Reads the time registers and decodes them straight to a timestamp.
+	 */
+	bool readTimestamp(timelib_t & t);
+
+#if GFRTC_USE_DIAGNOSTICS
+	/**
+	 * Stores a temperature sample on the history.
+	 */
+	void recordTemperature(int16_t quarters);
+#endif
+
+#if GFRTC_TEMP_HISTORY_SIZE > 0
+	/**
+	 * Ring buffer of temperature samples.
+	 */
+	struct gfrtc_temp_sample _history[GFRTC_TEMP_HISTORY_SIZE];
+
+	uint8_t _historyHead;
+
+	uint8_t _historyCount;
+#endif
+
+#if GFRTC_USE_ALARMS
+	/**
+	 * Encodes the alarm registers (seconds, minutes, hours, day/date).
+	 */
+	void encodeAlarm(enum gfrtc_alarm_types type, uint8_t hour, uint8_t minute, uint8_t second, uint8_t dow, uint8_t * regs);
+
+	/**
+	 * Decodes the alarm registers (seconds, minutes, hours, day/date).
+	 */
+	void decodeAlarm(const uint8_t * regs, uint8_t type, struct gfrtc_alarm & alarm);
+
+	/**
+	 * Reads all the shadowed registers that are not valid.
+	 */
+	bool shadowLoad();
+
+	/**
+	 * Checks if a group of registers can be served from the shadow copy.
+	 */
+	bool shadowCovers(uint8_t addr, uint8_t size);
+
+	/**
+	 * Checks if a group of registers includes a shadowed register.
+	 */
+	bool shadowOverlaps(uint8_t addr, uint8_t size);
+#endif
 
 	/**
 	 * Used internally to convert from binary to BCD.
@@ -411,5 +1420,63 @@ private:
  */
 extern GFRTCClass GFRTC;
 
+#if GFRTC_LOCKING
+/**
+ * Holds the bus lock from construction to destruction.
+ */
+class GFRTCLockScope {
+public:
+	GFRTCLockScope()
+	{
+		if (GFRTCClass::_lockHook != NULL)
+			GFRTCClass::_lockHook(GFRTCClass::_lockContext);
+	}
+
+	~GFRTCLockScope()
+	{
+		if (GFRTCClass::_unlockHook != NULL)
+			GFRTCClass::_unlockHook(GFRTCClass::_lockContext);
+	}
+};
+
+#define GFRTC_LOCK_SCOPE()	GFRTCLockScope _lockScope
+#else
+#define GFRTC_LOCK_SCOPE()
+#endif
+
+#if GFRTC_STATS
+/**
+ * Accounts the time spent on a method from construction to destruction.
+ */
+class GFRTCStatsScope {
+public:
+	GFRTCStatsScope(enum gfrtc_stats_ops op)
+	{
+		_outer = GFRTCClass::statsBegin(op);
+	}
+
+	~GFRTCStatsScope()
+	{
+		if (_outer)
+			GFRTCClass::statsEnd();
+	}
+
+private:
+	bool _outer;
+};
+
+#define GFRTC_STATS_SCOPE(op)	GFRTCStatsScope _statsScope(op)
+#define GFRTC_STATS_WRITE(result, bytes)	GFRTCClass::statsWrite((result), (bytes))
+#define GFRTC_STATS_READ(available, size)	GFRTCClass::statsRead((available), (size))
+#define GFRTC_STATS_HALTED()	GFRTCClass::statsHalted()
+#define GFRTC_STATS_RETRY(recovered)	GFRTCClass::statsRetry(recovered)
+#else
+#define GFRTC_STATS_SCOPE(op)
+#define GFRTC_STATS_WRITE(result, bytes)	(result)
+#define GFRTC_STATS_READ(available, size)	(available)
+#define GFRTC_STATS_HALTED()
+#define GFRTC_STATS_RETRY(recovered)
+#endif
+
 #endif
 // End of Header file
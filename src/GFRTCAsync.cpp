@@ -0,0 +1,379 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTCAsync.h"
+
+/*-------------------------------------------------------------*
+ *		Private definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Bus phases of a request
+ */
+enum gfrtc_async_phases {
+	E_ASYNC_PHASE_POINTER = 0,
+	E_ASYNC_PHASE_READ,
+	E_ASYNC_PHASE_WRITE,
+	E_ASYNC_PHASE_WAIT,
+};
+
+/**
+ * Steps of a forced temperature conversion
+ */
+enum gfrtc_async_conv_steps {
+	E_ASYNC_CONV_IDLE = 0,
+	E_ASYNC_CONV_CHECK,
+	E_ASYNC_CONV_START,
+	E_ASYNC_CONV_WAIT,
+	E_ASYNC_CONV_READ,
+};
+
+/*-------------------------------------------------------------*
+ *		Class implementation				*
+ *-------------------------------------------------------------*/
+GFRTCAsyncClass::GFRTCAsyncClass()
+{
+}
+
+bool GFRTCAsyncClass::beginReadTime(gfrtc_async_handler handler)
+{
+	return start(E_ASYNC_READ_TIME, GFRTC_REG_SECONDS, _regs, sizeof(_regs), false, handler);
+}
+
+bool GFRTCAsyncClass::beginWriteTime(timelib_t t, gfrtc_async_handler handler)
+{
+	uint8_t chip = GFRTC.getChip();
+
+	if (_state == E_ASYNC_BUSY)
+		return false;
+
+	// encode register values straight from the timestamp
+	gfrtc_time2regs(t, _regs);
+
+	// DS1307 needs the clock halted while the time is written
+	_clearHalt = (chip != E_CHIP_DS3231 && chip != E_CHIP_DS3232);
+	if (_clearHalt)
+		_regs[0] |= 0x80;
+	return start(E_ASYNC_WRITE_TIME, GFRTC_REG_SECONDS, _regs, sizeof(_regs), true, handler);
+}
+
+bool GFRTCAsyncClass::beginReadTemperature(gfrtc_async_handler handler)
+{
+	if (GFRTC.getChip() == E_CHIP_DS1307)
+		return false;
+	return start(E_ASYNC_READ_TEMPERATURE, GFRTC_REG_MSB_TEMP, _regs, 2, false, handler);
+}
+
+bool GFRTCAsyncClass::beginConvertTemperature(gfrtc_async_handler handler)
+{
+	if (GFRTC.getChip() == E_CHIP_DS1307)
+		return false;
+	// control and status registers first, to check the BSY bit
+	if (!start(E_ASYNC_CONVERT_TEMPERATURE, GFRTC_REG_CONTROL, _regs, 2, false, handler))
+		return false;
+	_convStep = E_ASYNC_CONV_CHECK;
+	_convStart = millis();
+	return true;
+}
+
+#if GFRTC_USE_NVRAM
+bool GFRTCAsyncClass::beginReadNVRAM(uint8_t offset, void * buffer, uint16_t size, gfrtc_async_handler handler)
+{
+	uint8_t addr;
+
+	if (!GFRTC.nvramAddress(offset, size, addr))
+		return false;
+	return start(E_ASYNC_READ_NVRAM, addr, (uint8_t *) buffer, size, false, handler);
+}
+
+bool GFRTCAsyncClass::beginWriteNVRAM(uint8_t offset, const void * buffer, uint16_t size, gfrtc_async_handler handler)
+{
+	uint8_t addr;
+
+	if (!GFRTC.nvramAddress(offset, size, addr))
+		return false;
+	return start(E_ASYNC_WRITE_NVRAM, addr, (uint8_t *) buffer, size, true, handler);
+}
+#endif
+
+enum gfrtc_async_states GFRTCAsyncClass::poll()
+{
+	uint8_t i, size;
+
+	if (_state != E_ASYNC_BUSY)
+		return _state;
+
+	GFRTC_LOCK_SCOPE();
+	GFRTC_STATS_SCOPE(E_STATS_ASYNC);
+	TwoWire & wire = *GFRTC._wire;
+	// another transfer moved the register pointer since it was set
+	if (_phase == E_ASYNC_PHASE_READ && _epoch != GFRTCClass::_busEpoch)
+		_phase = E_ASYNC_PHASE_POINTER;
+	if ((_phase == E_ASYNC_PHASE_POINTER || _phase == E_ASYNC_PHASE_WRITE) && !GFRTC.muxSelect())
+		return finish(false);
+
+	switch (_phase) {
+	case E_ASYNC_PHASE_POINTER:
+		// set register pointer, the bus is released after this phase
+		wire.beginTransmission(GFRTC._address);
+		wire.write(_address);
+		if (GFRTC_STATS_WRITE(wire.endTransmission(), 1) != 0)
+			return finish(false);
+		_epoch = GFRTCClass::_busEpoch;
+		_phase = E_ASYNC_PHASE_READ;
+		break;
+
+	case E_ASYNC_PHASE_READ:
+		size = (_remaining > GFRTC_ASYNC_READ_CHUNK) ? GFRTC_ASYNC_READ_CHUNK : (uint8_t) _remaining;
+		wire.requestFrom(GFRTC._address, size);
+		if (GFRTC_STATS_READ(wire.available(), size) < size)
+			return finish(false);
+		for (i = 0; i < size; i++) {
+			_data[i] = wire.read();
+		}
+		_data += size;
+		_address += size;
+		_remaining -= size;
+		if (_remaining == 0)
+			return (_op == E_ASYNC_CONVERT_TEMPERATURE) ? stepConversion() : finish(true);
+		// next chunk needs the register pointer again
+		_phase = E_ASYNC_PHASE_POINTER;
+		break;
+
+	case E_ASYNC_PHASE_WRITE:
+		size = (_remaining > GFRTC_ASYNC_WRITE_CHUNK) ? GFRTC_ASYNC_WRITE_CHUNK : (uint8_t) _remaining;
+		wire.beginTransmission(GFRTC._address);
+		wire.write(_address);
+		for (i = 0; i < size; i++) {
+			wire.write(_data[i]);
+		}
+		if (GFRTC_STATS_WRITE(wire.endTransmission(), size + 1) != 0)
+			return finish(false);
+		_data += size;
+		_address += size;
+		_remaining -= size;
+		if (_remaining == 0) {
+			if (_op == E_ASYNC_CONVERT_TEMPERATURE)
+				return stepConversion();
+			if (!_clearHalt)
+				return finish(true);
+			// time written with the clock halted, now start the oscillator
+			_clearHalt = false;
+			_halted = true;
+			_regs[0] &= 0x7f;
+			_data = _regs;
+			_address = GFRTC_REG_SECONDS;
+			_remaining = sizeof(_regs);
+		}
+		break;
+
+	case E_ASYNC_PHASE_WAIT:
+		// the conversion takes a while, leave the bus alone until next check
+		if ((uint32_t) (millis() - _convCheck) < GFRTC_ASYNC_CONV_POLL_MS)
+			break;
+		if ((uint32_t) (millis() - _convStart) >= GFRTC_ASYNC_CONV_TIMEOUT_MS)
+			return finish(false);
+		_phase = E_ASYNC_PHASE_POINTER;
+		break;
+	}
+	return _state;
+}
+
+enum gfrtc_async_states GFRTCAsyncClass::getState()
+{
+	return _state;
+}
+
+bool GFRTCAsyncClass::isBusy()
+{
+	return _state == E_ASYNC_BUSY;
+}
+
+void GFRTCAsyncClass::cancel()
+{
+	GFRTC_LOCK_SCOPE();
+
+	if (_state != E_ASYNC_BUSY)
+		return;
+
+	// the DS1307 must not be left with the clock halted, finish the write
+	if (_halted) {
+		GFRTC_STATS_SCOPE(E_STATS_ASYNC);
+		if (GFRTC.busWrite(GFRTC_REG_SECONDS, _regs, sizeof(_regs))) {
+			GFRTC._cache.valid = false;
+			GFRTC.publish(gfrtc_regs2time(_regs));
+		}
+		_halted = false;
+	}
+	_state = E_ASYNC_IDLE;
+}
+
+timelib_t GFRTCAsyncClass::getTime()
+{
+	return _time;
+}
+
+int16_t GFRTCAsyncClass::getTemperature()
+{
+	// convert to integer as celsius degrees, discards fractional part
+	return _temperature / 4;
+}
+
+int16_t GFRTCAsyncClass::getTemperatureQuarters()
+{
+	return _temperature;
+}
+
+/*-------------------------------------------------------------*
+ *		Private members					*
+ *-------------------------------------------------------------*/
+
+bool GFRTCAsyncClass::start(enum gfrtc_async_ops op, uint8_t address, uint8_t * data, uint16_t size, bool write, gfrtc_async_handler handler)
+{
+	if (_state == E_ASYNC_BUSY || size == 0)
+		return false;
+
+	_op = op;
+	_address = address;
+	_data = data;
+	_remaining = size;
+	_handler = handler;
+	_phase = write ? E_ASYNC_PHASE_WRITE : E_ASYNC_PHASE_POINTER;
+	if (op != E_ASYNC_WRITE_TIME)
+		_clearHalt = false;
+	_halted = false;
+	_convStep = E_ASYNC_CONV_IDLE;
+	_state = E_ASYNC_BUSY;
+	return true;
+}
+
+enum gfrtc_async_states GFRTCAsyncClass::finish(bool success)
+{
+	uint8_t chip = GFRTC.getChip();
+
+	// the chip answered if the transfer completed, as on the blocking API
+	GFRTC._isPresent = success;
+	_halted = false;
+	if (success) {
+		switch (_op) {
+		case E_ASYNC_READ_TIME:
+			// If clock is halted, the time is not valid (DS1307 only), the
+			// request fails like read() does
+			if ((_regs[0] & 0x80) && chip != E_CHIP_DS3231 && chip != E_CHIP_DS3232) {
+				GFRTC_STATS_HALTED();
+				success = false;
+			} else {
+				_time = gfrtc_regs2time(_regs);
+				GFRTC.publish(_time);
+			}
+			break;
+		case E_ASYNC_WRITE_TIME:
+			// cached clock should read the new time from the RTC
+			GFRTC._cache.valid = false;
+			GFRTC.publish(gfrtc_regs2time(_regs));
+			break;
+		case E_ASYNC_READ_TEMPERATURE:
+		case E_ASYNC_CONVERT_TEMPERATURE:
+			// 10 bit two's complement value, left aligned
+			_temperature = (int16_t) (((uint16_t) _regs[0] << 8) | _regs[1]) >> 6;
+#if GFRTC_USE_DIAGNOSTICS
+			GFRTC.recordTemperature(_temperature);
+#endif
+			break;
+		default:
+			break;
+		}
+	}
+
+	_state = success ? E_ASYNC_DONE : E_ASYNC_ERROR;
+	if (_handler != NULL)
+		_handler(_op, success);
+	return _state;
+}
+
+enum gfrtc_async_states GFRTCAsyncClass::stepConversion()
+{
+	switch (_convStep) {
+	case E_ASYNC_CONV_CHECK:
+		// an automatic conversion is running, CONV would be ignored
+		if (_regs[1] & (1 << GFRTC_BIT_BSY)) {
+			waitConversion();
+			break;
+		}
+		_regs[0] |= (1 << GFRTC_BIT_CONV);
+		_data = _regs;
+		_address = GFRTC_REG_CONTROL;
+		_remaining = 1;
+		_phase = E_ASYNC_PHASE_WRITE;
+		_convStep = E_ASYNC_CONV_START;
+		break;
+
+	case E_ASYNC_CONV_START:
+		_convStep = E_ASYNC_CONV_WAIT;
+		waitConversion();
+		break;
+
+	case E_ASYNC_CONV_WAIT:
+		if ((_regs[0] & (1 << GFRTC_BIT_CONV)) || (_regs[1] & (1 << GFRTC_BIT_BSY))) {
+			waitConversion();
+			break;
+		}
+		_data = _regs;
+		_address = GFRTC_REG_MSB_TEMP;
+		_remaining = 2;
+		_phase = E_ASYNC_PHASE_POINTER;
+		_convStep = E_ASYNC_CONV_READ;
+		break;
+
+	default:
+		return finish(true);
+	}
+	return _state;
+}
+
+void GFRTCAsyncClass::waitConversion()
+{
+	_data = _regs;
+	_address = GFRTC_REG_CONTROL;
+	_remaining = 2;
+	_phase = E_ASYNC_PHASE_WAIT;
+	_convCheck = millis();
+}
+
+enum gfrtc_async_states GFRTCAsyncClass::_state = E_ASYNC_IDLE;
+enum gfrtc_async_ops GFRTCAsyncClass::_op = E_ASYNC_READ_TIME;
+gfrtc_async_handler GFRTCAsyncClass::_handler = NULL;
+uint8_t GFRTCAsyncClass::_phase = E_ASYNC_PHASE_POINTER;
+uint8_t GFRTCAsyncClass::_address = 0;
+uint8_t * GFRTCAsyncClass::_data = NULL;
+uint16_t GFRTCAsyncClass::_remaining = 0;
+bool GFRTCAsyncClass::_clearHalt = false;
+bool GFRTCAsyncClass::_halted = false;
+uint8_t GFRTCAsyncClass::_regs[7];
+timelib_t GFRTCAsyncClass::_time = 0;
+int16_t GFRTCAsyncClass::_temperature = 0;
+uint8_t GFRTCAsyncClass::_convStep = E_ASYNC_CONV_IDLE;
+uint32_t GFRTCAsyncClass::_convStart = 0;
+uint32_t GFRTCAsyncClass::_convCheck = 0;
+uint8_t GFRTCAsyncClass::_epoch = 0;
+
+/**
+ * Create an instance for the user
+ */
+GFRTCAsyncClass GFRTCAsync = GFRTCAsyncClass();
@@ -0,0 +1,279 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCASYNC_H
+#define GFRTCASYNC_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+/*-------------------------------------------------------------*
+ *		Library configuration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Maximum number of bytes moved on a single read phase, limited by the receive
+ * buffer of the Wire library
+ */
+#define GFRTC_ASYNC_READ_CHUNK	GFRTC_WIRE_BUFFER_SIZE
+
+/**
+ * Maximum number of bytes moved on a single write phase, the register address
+ * takes one byte of the transmit buffer of the Wire library
+ */
+#define GFRTC_ASYNC_WRITE_CHUNK	(GFRTC_WIRE_BUFFER_SIZE - 1)
+
+/**
+ * Milliseconds between status checks while a temperature conversion is in
+ * progress, poll() does not touch the bus in between
+ */
+#ifndef GFRTC_ASYNC_CONV_POLL_MS
+#define GFRTC_ASYNC_CONV_POLL_MS	20
+#endif
+
+/**
+ * Milliseconds to wait for a temperature conversion before giving up
+ */
+#ifndef GFRTC_ASYNC_CONV_TIMEOUT_MS
+#define GFRTC_ASYNC_CONV_TIMEOUT_MS	1000
+#endif
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Operations that can be requested asynchronously
+ */
+enum gfrtc_async_ops {
+	E_ASYNC_READ_TIME = 0,
+	E_ASYNC_WRITE_TIME,
+	E_ASYNC_READ_TEMPERATURE,
+	E_ASYNC_READ_NVRAM,
+	E_ASYNC_WRITE_NVRAM,
+	E_ASYNC_CONVERT_TEMPERATURE,
+};
+
+/**
+ * States of an asynchronous request
+ */
+enum gfrtc_async_states {
+	E_ASYNC_IDLE = 0,
+	E_ASYNC_BUSY,
+	E_ASYNC_DONE,
+	E_ASYNC_ERROR,
+};
+
+/**
+ * Function called when an asynchronous request completes.
+ *
+ * @param op The operation that completed.
+ * @param success True if the transfer was successful, false otherwise.
+ */
+typedef void (*gfrtc_async_handler)(enum gfrtc_async_ops op, bool success);
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Non blocking front end for the most common RTC transfers.
+ *
+ * A request is split in bus phases (register pointer write, data read or data
+ * write) and every call to poll() performs at most one of them, so loop() is
+ * never stalled for more than a single phase. The phase itself is still a
+ * blocking Wire transfer: poll() returns once it completes, nothing runs in
+ * the background. Longer NVRAM transfers are split
+ * in chunks that fit the Wire buffers. Every phase ends with a STOP condition
+ * and reads always set the register pointer first, so the blocking GFRTC
+ * methods and other devices on the bus can be used between calls to poll().
+ *
+ * Only one request can be active at a time, transfers go to the chip driven
+ * by the GFRTC instance.
+ */
+class GFRTCAsyncClass {
+public:
+	GFRTCAsyncClass();
+
+	/**
+	 * Starts reading the time registers, the result is available through
+	 * getTime() when the request completes.
+	 *
+	 * @param handler Function called on completion, can be NULL.
+	 *
+	 * @return Returns true if the request was accepted, false if another
+	 * request is in progress.
+	 */
+	static bool beginReadTime(gfrtc_async_handler handler = NULL);
+
+	/**
+	 * Starts writing the time registers from a unix timestamp.
+	 *
+	 * @param t The unix timestamp to write.
+	 * @param handler Function called on completion, can be NULL.
+	 *
+	 * @return Returns true if the request was accepted, false if another
+	 * request is in progress.
+	 */
+	static bool beginWriteTime(timelib_t t, gfrtc_async_handler handler = NULL);
+
+	/**
+	 * Starts reading the temperature registers, the result is available
+	 * through getTemperature() when the request completes. Only DS3231 and
+	 * DS3232 chips.
+	 *
+	 * @param handler Function called on completion, can be NULL.
+	 *
+	 * @return Returns true if the request was accepted, false otherwise.
+	 */
+	static bool beginReadTemperature(gfrtc_async_handler handler = NULL);
+
+	/**
+	 * Forces a new temperature conversion and reads the result, the value is
+	 * available through getTemperature() when the request completes. Waits for
+	 * any automatic conversion in progress, sets the CONV bit and checks the
+	 * CONV and BSY bits every GFRTC_ASYNC_CONV_POLL_MS milliseconds. Only
+	 * DS3231 and DS3232 chips.
+	 *
+	 * @param handler Function called on completion, can be NULL.
+	 *
+	 * @return Returns true if the request was accepted, false otherwise.
+	 */
+	static bool beginConvertTemperature(gfrtc_async_handler handler = NULL);
+
+#if GFRTC_USE_NVRAM
+	/**
+	 * Starts reading general purpose NVRAM, the buffer must remain valid until
+	 * the request completes.
+	 *
+	 * @param offset The offset from the first byte of NVRAM to read.
+	 * @param buffer Pointer where data from NVRAM should be stored.
+	 * @param size Number of bytes to read.
+	 * @param handler Function called on completion, can be NULL.
+	 *
+	 * @return Returns true if the request was accepted, false otherwise.
+	 */
+	static bool beginReadNVRAM(uint8_t offset, void * buffer, uint16_t size, gfrtc_async_handler handler = NULL);
+
+	/**
+	 * Starts writing general purpose NVRAM, the buffer must remain valid until
+	 * the request completes.
+	 *
+	 * @param offset The offset from the first byte of NVRAM to write.
+	 * @param buffer Pointer to buffer containing data to write on NVRAM.
+	 * @param size Number of bytes to write.
+	 * @param handler Function called on completion, can be NULL.
+	 *
+	 * @return Returns true if the request was accepted, false otherwise.
+	 */
+	static bool beginWriteNVRAM(uint8_t offset, const void * buffer, uint16_t size, gfrtc_async_handler handler = NULL);
+#endif
+
+	/**
+	 * Drives the active request, call this method often from the main loop.
+	 * Performs at most one bus phase per call.
+	 *
+	 * @return The state of the request after this call.
+	 */
+	static enum gfrtc_async_states poll();
+
+	/**
+	 * Gets the state of the last request without accessing the bus.
+	 */
+	static enum gfrtc_async_states getState();
+
+	/**
+	 * Checks if a request is in progress.
+	 */
+	static bool isBusy();
+
+	/**
+	 * Abandons the active request. The bus is always released between phases
+	 * so no cleanup is needed on the bus. A time write to a DS1307 that
+	 * already wrote the time with the clock halted is finished with a blocking
+	 * write, so the oscillator is never left stopped.
+	 */
+	static void cancel();
+
+	/**
+	 * Gets the timestamp obtained by the last completed time read.
+	 */
+	static timelib_t getTime();
+
+	/**
+	 * Gets the temperature in celsius degrees obtained by the last completed
+	 * temperature read.
+	 */
+	static int16_t getTemperature();
+
+	/**
+	 * Gets the temperature in quarters of celsius degree obtained by the last
+	 * completed temperature read.
+	 */
+	static int16_t getTemperatureQuarters();
+
+private:
+	/**
+	 * Prepares the state shared by all requests.
+	 */
+	static bool start(enum gfrtc_async_ops op, uint8_t address, uint8_t * data, uint16_t size, bool write, gfrtc_async_handler handler);
+
+	/**
+	 * Ends the active request and invokes the completion handler.
+	 */
+	static enum gfrtc_async_states finish(bool success);
+
+	/**
+	 * Decides the next phase of a temperature conversion after a transfer.
+	 */
+	static enum gfrtc_async_states stepConversion();
+
+	/**
+	 * Schedules a read of the control and status registers after the poll
+	 * interval.
+	 */
+	static void waitConversion();
+
+	static enum gfrtc_async_states _state;
+	static enum gfrtc_async_ops _op;
+	static gfrtc_async_handler _handler;
+	static uint8_t _phase;
+	static uint8_t _address;
+	static uint8_t * _data;
+	static uint16_t _remaining;
+	static bool _clearHalt;
+	static bool _halted;
+	static uint8_t _regs[7];
+	static timelib_t _time;
+	static int16_t _temperature;
+	static uint8_t _convStep;
+	static uint32_t _convStart;
+	static uint32_t _convCheck;
+	static uint8_t _epoch;
+};
+
+/**
+ * Instance of the GFRTCAsyncClass as declared in GFRTCAsync.cpp
+ */
+extern GFRTCAsyncClass GFRTCAsync;
+
+#endif
+// End of Header file
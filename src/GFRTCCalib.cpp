@@ -0,0 +1,334 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTC.h"
+
+// not compiled unless the tier includes it
+#if GFRTC_USE_DIAGNOSTICS
+#include "GFRTCCalib.h"
+#include "GFRTCSqw.h"
+
+/*-------------------------------------------------------------*
+ *		Private definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * First byte of the state kept on NVRAM
+ */
+#define CALIB_MAGIC	0xCA
+
+/**
+ * Samples that gained more than this (ppm) are discarded, the RTC time or the
+ * reference must have been changed between them
+ */
+#define CALIB_MAX_PPM	50
+
+/**
+ * The measurement of a bin is halved before it reaches this span (24 days), so
+ * the estimate follows the aging of the crystal and the offset never overflows
+ */
+#define CALIB_MAX_SPAN	(1UL << 21)
+
+/*-------------------------------------------------------------*
+ *		Class implementation				*
+ *-------------------------------------------------------------*/
+GFRTCCalibClass::GFRTCCalibClass()
+{
+}
+
+bool GFRTCCalibClass::begin(enum gfrtc_calib_sources source, uint8_t offset, uint32_t interval)
+{
+	uint8_t buf[GFRTC_CALIB_NVRAM_SIZE];
+	uint8_t chip = GFRTC.getChip();
+	bool res;
+
+	if (chip != E_CHIP_DS3231 && chip != E_CHIP_DS3232)
+		return false;
+
+	// samples further apart are discarded, this also keeps the interval in
+	// milliseconds within 32 bits
+	if (interval >= CALIB_MAX_SPAN)
+		interval = CALIB_MAX_SPAN - 1;
+
+	_source = source;
+	_offset = offset;
+	_interval = interval;
+	_hasPrevious = false;
+	_bin = 0;
+	_ppsCount = 0;
+	_micros = 0;
+	_lastMicros = micros();
+	// first sample on the next call to update()
+	_lastSample = millis() - interval * 1000UL;
+
+	_aging = (int8_t) GFRTC.readRegister(GFRTC_REG_AGING, &res);
+	if (!res)
+		return false;
+
+	memset(_bins, 0, sizeof(_bins));
+	if (offset == GFRTC_CALIB_NO_NVRAM)
+		return true;
+
+	if (!GFRTC.readNVRAM(offset, buf, sizeof(buf)))
+		return false;
+
+	// start from scratch if the state was never saved or is corrupted
+	memcpy(_bins, &buf[1], sizeof(_bins));
+	if (buf[0] != CALIB_MAGIC || buf[sizeof(buf) - 1] != checksum())
+		return reset();
+	return true;
+}
+
+bool GFRTCCalibClass::addReference(timelib_t seconds, uint16_t fraction)
+{
+	uint32_t now = micros();
+	uint32_t edge;
+	timelib_t t;
+	int64_t ref;
+
+	if (!findEdge(t, edge))
+		return false;
+
+	// move the reference to the start of the RTC second
+	ref = (int64_t) seconds * 1000000 + (((uint32_t) fraction * 15625UL) >> 10);
+	ref += (int32_t) (edge - now);
+	return addSample(t, ref);
+}
+
+void GFRTCCalibClass::setTimeout(uint16_t timeout)
+{
+	_timeout = timeout;
+}
+
+void GFRTCCalibClass::ppsEdge()
+{
+	_ppsMicros = micros();
+	_ppsCount++;
+}
+
+bool GFRTCCalibClass::update()
+{
+	uint32_t now, edge, count, pulse;
+	timelib_t t;
+	int64_t ref;
+
+	// extend micros() to 64 bits, it wraps every 71 minutes
+	now = micros();
+	_micros += (uint32_t) (now - _lastMicros);
+	_lastMicros = now;
+
+	if (_source == E_CALIB_HOST)
+		return false;
+	if ((uint32_t) (millis() - _lastSample) < _interval * 1000UL)
+		return false;
+
+	if (_source == E_CALIB_PPS) {
+		noInterrupts();
+		count = _ppsCount;
+		pulse = _ppsMicros;
+		interrupts();
+		if (count == 0)
+			return false;
+		if (!findEdge(t, edge))
+			return false;
+		ref = (int64_t) count * 1000000 + (int32_t) (edge - pulse);
+	} else {
+		if (!findEdge(t, edge))
+			return false;
+		ref = (int64_t) (_micros + (int32_t) (edge - _lastMicros));
+	}
+
+	_lastSample = millis();
+	return addSample(t, ref);
+}
+
+int16_t GFRTCCalibClass::getDrift()
+{
+	if (_bins[_bin].span == 0)
+		return 0;
+	// offset is in 0.1 us, per second that is 0.1 ppm
+	return (int16_t) ((int64_t) _bins[_bin].offset * 10 / (int32_t) _bins[_bin].span);
+}
+
+uint32_t GFRTCCalibClass::getSpan()
+{
+	return _bins[_bin].span;
+}
+
+int8_t GFRTCCalibClass::getAging()
+{
+	return _aging;
+}
+
+bool GFRTCCalibClass::reset()
+{
+	memset(_bins, 0, sizeof(_bins));
+	_hasPrevious = false;
+	return save();
+}
+
+/*-------------------------------------------------------------*
+ *		Private members					*
+ *-------------------------------------------------------------*/
+
+bool GFRTCCalibClass::findEdge(timelib_t & t, uint32_t & edge)
+{
+	struct gfrtc_precise_time p;
+	uint32_t start = millis();
+	timelib_t first;
+
+	// the square wave engine already knows the phase of the second
+	if (GFRTCSqw.isSynchronized() && GFRTCSqw.getPrecise(p)) {
+		edge = micros() - (((uint32_t) p.fraction * 15625UL) >> 10);
+		t = p.seconds;
+		return true;
+	}
+
+	// poll the time registers until the seconds change
+	if (!GFRTC.read(first))
+		return false;
+	do {
+		if ((uint32_t) (millis() - start) > _timeout)
+			return false;
+		edge = micros();
+		if (!GFRTC.read(t))
+			return false;
+	} while (t == first);
+	return true;
+}
+
+bool GFRTCCalibClass::addSample(timelib_t t, int64_t ref)
+{
+	struct gfrtc_calib_bin * b;
+	uint8_t bin = 0;
+	uint32_t elapsed;
+	int64_t gained;
+#if GFRTC_CALIB_TEMP_BINS > 1
+	int16_t quarters, index;
+
+	if (!GFRTC.readTemperature(quarters))
+		return false;
+	index = (quarters / 4 - GFRTC_CALIB_TEMP_MIN) / GFRTC_CALIB_TEMP_STEP;
+	if (index < 0)
+		index = 0;
+	if (index >= GFRTC_CALIB_TEMP_BINS)
+		index = GFRTC_CALIB_TEMP_BINS - 1;
+	bin = (uint8_t) index;
+#endif
+
+	// an interval counts only if the temperature stayed on the same bin
+	if (_hasPrevious && bin == _prevBin && t > _prevTime && t - _prevTime < CALIB_MAX_SPAN) {
+		elapsed = (uint32_t) (t - _prevTime);
+		gained = (int64_t) elapsed * 1000000 - (ref - _prevRef);
+		if (gained < (int64_t) elapsed * CALIB_MAX_PPM && gained > -(int64_t) elapsed * CALIB_MAX_PPM) {
+			// remove the aging offset, one LSB slows the clock by 0.1 ppm
+			b = &_bins[bin];
+			while (b->span + elapsed >= CALIB_MAX_SPAN) {
+				b->offset /= 2;
+				b->span /= 2;
+			}
+			b->offset += (int32_t) (gained * 10) + (int32_t) _aging * (int32_t) elapsed;
+			b->span += elapsed;
+			if (!save())
+				return false;
+		}
+	}
+
+	_hasPrevious = true;
+	_prevTime = t;
+	_prevRef = ref;
+	_prevBin = bin;
+	_bin = bin;
+	return apply(bin);
+}
+
+bool GFRTCCalibClass::apply(uint8_t bin)
+{
+	struct gfrtc_calib_bin * b = &_bins[bin];
+	int32_t aging;
+
+	if (b->span < GFRTC_CALIB_MIN_SPAN)
+		return true;
+
+	// aging offset that cancels the drift of the crystal, rounded
+	if (b->offset >= 0)
+		aging = (int32_t) (((int64_t) b->offset + b->span / 2) / b->span);
+	else
+		aging = (int32_t) (((int64_t) b->offset - b->span / 2) / b->span);
+	if (aging > 127)
+		aging = 127;
+	if (aging < -127)
+		aging = -127;
+	if (aging == _aging)
+		return true;
+
+	if (!GFRTC.writeRegister(GFRTC_REG_AGING, (uint8_t) aging) || !GFRTC.flush())
+		return false;
+	_aging = (int8_t) aging;
+
+	// the chip applies the new aging offset on the next temperature conversion
+	return GFRTC.writeBit(GFRTC_REG_CONTROL, GFRTC_BIT_CONV, true);
+}
+
+bool GFRTCCalibClass::save()
+{
+	uint8_t buf[GFRTC_CALIB_NVRAM_SIZE];
+
+	if (_offset == GFRTC_CALIB_NO_NVRAM)
+		return true;
+
+	buf[0] = CALIB_MAGIC;
+	memcpy(&buf[1], _bins, sizeof(_bins));
+	buf[sizeof(buf) - 1] = checksum();
+	return GFRTC.writeNVRAM(_offset, buf, sizeof(buf));
+}
+
+uint8_t GFRTCCalibClass::checksum()
+{
+	const uint8_t * p = (const uint8_t *) _bins;
+	uint8_t i, sum = CALIB_MAGIC;
+
+	for (i = 0; i < sizeof(_bins); i++) {
+		sum = (uint8_t) ((sum << 1) | (sum >> 7)) ^ p[i];
+	}
+	return sum;
+}
+
+enum gfrtc_calib_sources GFRTCCalibClass::_source = E_CALIB_HOST;
+uint8_t GFRTCCalibClass::_offset = GFRTC_CALIB_NO_NVRAM;
+uint32_t GFRTCCalibClass::_interval = GFRTC_CALIB_DEFAULT_INTERVAL;
+uint16_t GFRTCCalibClass::_timeout = GFRTC_CALIB_DEFAULT_TIMEOUT;
+int8_t GFRTCCalibClass::_aging = 0;
+uint8_t GFRTCCalibClass::_bin = 0;
+bool GFRTCCalibClass::_hasPrevious = false;
+timelib_t GFRTCCalibClass::_prevTime = 0;
+int64_t GFRTCCalibClass::_prevRef = 0;
+uint8_t GFRTCCalibClass::_prevBin = 0;
+uint32_t GFRTCCalibClass::_lastSample = 0;
+volatile uint32_t GFRTCCalibClass::_ppsCount = 0;
+volatile uint32_t GFRTCCalibClass::_ppsMicros = 0;
+uint64_t GFRTCCalibClass::_micros = 0;
+uint32_t GFRTCCalibClass::_lastMicros = 0;
+struct gfrtc_calib_bin GFRTCCalibClass::_bins[GFRTC_CALIB_TEMP_BINS];
+
+/**
+ * Create an instance for the user
+ */
+GFRTCCalibClass GFRTCCalib = GFRTCCalibClass();
+#endif
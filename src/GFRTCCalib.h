@@ -0,0 +1,278 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCCALIB_H
+#define GFRTCCALIB_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+#if !GFRTC_USE_DIAGNOSTICS
+#error "GFRTCCalib needs GFRTC_TIER GFRTC_TIER_FULL or higher"
+#endif
+
+/*-------------------------------------------------------------*
+ *		Library configuration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Number of temperature bins with their own drift estimate, with a single bin
+ * the temperature is not read
+ */
+#ifndef GFRTC_CALIB_TEMP_BINS
+#define GFRTC_CALIB_TEMP_BINS	1
+#endif
+
+/**
+ * Lower limit of the first temperature bin in celsius degrees
+ */
+#ifndef GFRTC_CALIB_TEMP_MIN
+#define GFRTC_CALIB_TEMP_MIN	(-40)
+#endif
+
+/**
+ * Width of each temperature bin in celsius degrees
+ */
+#ifndef GFRTC_CALIB_TEMP_STEP
+#define GFRTC_CALIB_TEMP_STEP	16
+#endif
+
+/**
+ * Seconds of measurement a bin needs before its estimate is written to the
+ * aging offset register. With 1 ms of error on each sample one day of
+ * measurement gives a resolution of about 0.02 ppm
+ */
+#ifndef GFRTC_CALIB_MIN_SPAN
+#define GFRTC_CALIB_MIN_SPAN	86400UL
+#endif
+
+/**
+ * Default seconds between samples taken by update() when the reference is a
+ * PPS signal or micros()
+ */
+#define GFRTC_CALIB_DEFAULT_INTERVAL	3600UL
+
+/**
+ * Default milliseconds the time registers are polled for the start of a
+ * second, just over one second so the edge is always found
+ */
+#define GFRTC_CALIB_DEFAULT_TIMEOUT	1100U
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Offset value that keeps the calibration state in RAM only, used on chips
+ * without NVRAM
+ */
+#define GFRTC_CALIB_NO_NVRAM	0xFF
+
+/**
+ * Bytes of NVRAM used to keep the calibration state
+ */
+#define GFRTC_CALIB_NVRAM_SIZE	(2 + 8 * GFRTC_CALIB_TEMP_BINS)
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Time references that can be used to measure the drift of the RTC
+ */
+enum gfrtc_calib_sources {
+	/** Timestamps passed to addReference(), usually from the network */
+	E_CALIB_HOST = 0,
+	/** Pulse per second signal, ppsEdge() called on every pulse */
+	E_CALIB_PPS,
+	/** micros() of the MCU, when it runs from a trusted oscillator */
+	E_CALIB_MICROS,
+};
+
+/**
+ * Drift accumulated on one temperature bin
+ */
+struct gfrtc_calib_bin {
+	/** Offset gained by the crystal in units of 0.1 us, aging offset removed */
+	int32_t offset;
+	/** Seconds measured */
+	uint32_t span;
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Aging offset calibration engine for the DS3231 and DS3232.
+ *
+ * Each sample compares the start of an RTC second against a reference clock.
+ * The offset gained between two samples, divided by the time between them,
+ * is the drift of the RTC. Drift observed with a given aging offset is
+ * converted to the drift of the bare crystal (one LSB of the aging register is
+ * about 0.1 ppm) and accumulated on the bin of the temperature measured by the
+ * chip, so changing the aging offset or the temperature never invalidates the
+ * measurement. Once a bin has GFRTC_CALIB_MIN_SPAN seconds of measurement, the
+ * value that cancels its drift is written to the aging register whenever the
+ * temperature is on that bin.
+ *
+ * The start of the RTC second is taken from GFRTCSqw when it is running,
+ * otherwise the time registers are polled until the seconds change, which
+ * blocks for up to the timeout set with setTimeout(). With a timeout shorter
+ * than one second a sample is only taken when the edge falls inside it, so
+ * update() retries on the following calls.
+ */
+class GFRTCCalibClass {
+public:
+	GFRTCCalibClass();
+
+	/**
+	 * Starts the calibration engine and loads the state kept on NVRAM.
+	 * GFRTC.begin() must be called first so the chip type is known.
+	 *
+	 * @param source The time reference.
+	 * @param offset Offset of GFRTC_CALIB_NVRAM_SIZE bytes of NVRAM used to
+	 * keep the state, GFRTC_CALIB_NO_NVRAM to keep it in RAM.
+	 * @param interval Seconds between samples for the PPS and micros()
+	 * references, longer intervals are reduced to just under 24 days (2^21 s)
+	 * because samples further apart are discarded.
+	 *
+	 * @return Returns true if the chip has an aging offset register and the
+	 * state could be loaded or initialized.
+	 */
+	static bool begin(enum gfrtc_calib_sources source, uint8_t offset = GFRTC_CALIB_NO_NVRAM, uint32_t interval = GFRTC_CALIB_DEFAULT_INTERVAL);
+
+	/**
+	 * Adds a sample against a timestamp from the host, call it right when the
+	 * timestamp is received. Only the time between calls matters, the
+	 * timestamp does not need to match the time on the RTC. If the RTC is set
+	 * with the timestamp, call this method again after setting it so the next
+	 * sample does not include the correction.
+	 *
+	 * @param seconds Reference time in seconds.
+	 * @param fraction Fraction of second in units of 1/65536 s.
+	 *
+	 * @return Returns true if the sample was taken, false if communication
+	 * failed or the start of the RTC second was not seen before the timeout.
+	 */
+	static bool addReference(timelib_t seconds, uint16_t fraction = 0);
+
+	/**
+	 * Sets the longest time addReference() and update() poll the time
+	 * registers for the start of a second when GFRTCSqw is not running.
+	 *
+	 * @param timeout Timeout in milliseconds, GFRTC_CALIB_DEFAULT_TIMEOUT by
+	 * default.
+	 */
+	static void setTimeout(uint16_t timeout);
+
+	/**
+	 * Counts a pulse of the PPS reference, call it from the interrupt handler
+	 * of the PPS pin.
+	 */
+	static void ppsEdge();
+
+	/**
+	 * Takes the periodic samples of the PPS and micros() references and
+	 * applies the aging offset, call this method often from the main loop.
+	 *
+	 * @return Returns true if a sample was taken on this call.
+	 */
+	static bool update();
+
+	/**
+	 * Gets the drift of the crystal measured on the current temperature bin,
+	 * without the aging offset.
+	 *
+	 * @return The drift in hundredths of ppm, positive if the RTC runs fast.
+	 */
+	static int16_t getDrift();
+
+	/**
+	 * Gets the seconds measured on the current temperature bin.
+	 */
+	static uint32_t getSpan();
+
+	/**
+	 * Gets the value of the aging offset register.
+	 */
+	static int8_t getAging();
+
+	/**
+	 * Clears the measurements of all bins, the aging register is kept.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool reset();
+
+private:
+	/**
+	 * Finds the start of the current RTC second.
+	 *
+	 * @param t The RTC time at the start of the second.
+	 * @param edge Value of micros() at the start of the second.
+	 *
+	 * @return Returns false if communication failed or the timeout expired.
+	 */
+	static bool findEdge(timelib_t & t, uint32_t & edge);
+
+	/**
+	 * Accumulates the offset gained since the previous sample.
+	 *
+	 * @param t RTC time at the start of the second.
+	 * @param ref Reference time in microseconds at the same instant.
+	 */
+	static bool addSample(timelib_t t, int64_t ref);
+
+	/**
+	 * Writes the aging offset for the bin if it has been measured long enough.
+	 */
+	static bool apply(uint8_t bin);
+
+	static bool save();
+
+	static uint8_t checksum();
+
+	static enum gfrtc_calib_sources _source;
+	static uint8_t _offset;
+	static uint32_t _interval;
+	static uint16_t _timeout;
+	static int8_t _aging;
+	static uint8_t _bin;
+	static bool _hasPrevious;
+	static timelib_t _prevTime;
+	static int64_t _prevRef;
+	static uint8_t _prevBin;
+	static uint32_t _lastSample;
+	static volatile uint32_t _ppsCount;
+	static volatile uint32_t _ppsMicros;
+	static uint64_t _micros;
+	static uint32_t _lastMicros;
+	static struct gfrtc_calib_bin _bins[GFRTC_CALIB_TEMP_BINS];
+};
+
+/**
+ * Instance of the GFRTCCalibClass as declared in GFRTCCalib.cpp
+ */
+extern GFRTCCalibClass GFRTCCalib;
+
+#endif
+// End of Header file
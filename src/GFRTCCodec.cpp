@@ -0,0 +1,128 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTCCodec.h"
+
+/*-------------------------------------------------------------*
+ *		Private data					*
+ *-------------------------------------------------------------*/
+
+/**
+ * Day of year of the first day of each month on a common year, the last entry
+ * is a sentinel used by the month search
+ */
+static const uint16_t codecMonthStart[13] = {
+	0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365
+};
+
+/*-------------------------------------------------------------*
+ *		Function implementation				*
+ *-------------------------------------------------------------*/
+timelib_t gfrtc_regs2time(const uint8_t * regs)
+{
+	uint8_t year, month;
+	uint16_t days;
+	uint16_t minutes;
+
+	year = gfrtc_bcd2dec(regs[6]);
+	if (regs[5] & 0x80)
+		year += 100;
+	month = gfrtc_bcd2dec(regs[5] & 0x1F);
+	if (month < 1 || month > 12)
+		month = 1;
+
+	// days since Jan 1, 2000: every year divisible by 4 is leap, except 2100
+	days = (uint16_t) year * 365U + ((year + 3) >> 2);
+	if (year > 100)
+		days--;
+	days += codecMonthStart[month - 1] + gfrtc_bcd2dec(regs[4] & 0x3F) - 1;
+	if (month > 2 && (year & 0x03) == 0 && year != 100)
+		days++;
+
+	// minutes of the day fit on 16 bits
+	minutes = (uint16_t) gfrtc_bcd2dec(regs[2] & 0x3F) * 60U + gfrtc_bcd2dec(regs[1] & 0x7F);
+
+	return GFRTC_CODEC_EPOCH + (uint32_t) days * 86400UL + (uint32_t) minutes * 60U + gfrtc_bcd2dec(regs[0] & 0x7F);
+}
+
+void gfrtc_time2regs(timelib_t t, uint8_t * regs)
+{
+	uint32_t secs;
+	uint16_t days, rem, quad;
+	uint8_t year, month, hour, minute;
+	bool leap;
+
+	if (t < GFRTC_CODEC_EPOCH)
+		t = GFRTC_CODEC_EPOCH;
+	secs = t - GFRTC_CODEC_EPOCH;
+
+	// the only 32 bit division, days since 2000 fit on 16 bits
+	days = (uint16_t) (secs / 86400UL);
+	rem = (uint16_t) ((secs - (uint32_t) days * 86400UL) >> 1);
+
+	// rem holds seconds of the day divided by 2 to fit on 16 bits
+	hour = (uint8_t) (rem / 1800U);
+	rem -= (uint16_t) hour * 1800U;
+	minute = (uint8_t) (rem / 30U);
+	regs[0] = gfrtc_dec2bcd((uint8_t) (((rem - minute * 30U) << 1) | (secs & 0x01)));
+	regs[1] = gfrtc_dec2bcd(minute);
+	regs[2] = gfrtc_dec2bcd(hour);
+
+	// Jan 1, 2000 was saturday, sunday is day 1
+	regs[3] = (uint8_t) ((days + 6) % 7) + 1;
+
+	// insert a virtual Feb 29, 2100 so every 4 years have 1461 days
+	if (days >= GFRTC_CODEC_MAR_2100)
+		days++;
+	quad = days / 1461U;
+	days -= quad * 1461U;
+	year = (uint8_t) (quad << 2);
+	leap = true;
+	if (days >= 366) {
+		days -= 366;
+		year += 1 + (uint8_t) (days / 365U);
+		days %= 365U;
+		leap = false;
+	}
+
+	// on leap years Feb 29 is handled apart and later days shifted by one
+	if (leap && days == 59) {
+		month = 2;
+		days = 28;
+	} else {
+		if (leap && days > 59)
+			days--;
+
+		// months have between 28 and 31 days, day / 32 is at most one month
+		// behind
+		month = (uint8_t) (days >> 5);
+		if (days >= codecMonthStart[month + 1])
+			month++;
+		days -= codecMonthStart[month];
+		month++;
+	}
+
+	regs[4] = gfrtc_dec2bcd((uint8_t) days + 1);
+	regs[5] = gfrtc_dec2bcd(month);
+	if (year >= 100) {
+		regs[5] |= 0x80;
+		year -= 100;
+	}
+	regs[6] = gfrtc_dec2bcd(year);
+}
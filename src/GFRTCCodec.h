@@ -0,0 +1,96 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCCODEC_H
+#define GFRTCCODEC_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include <stdint.h>
+#include <TimeLib.h>
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Unix timestamp of 00:00:00 Jan 1, 2000, the first instant the time registers
+ * can represent
+ */
+#define GFRTC_CODEC_EPOCH 946684800UL
+
+/**
+ * Days between Jan 1, 2000 and Mar 1, 2100 (2100 is not a leap year)
+ */
+#define GFRTC_CODEC_MAR_2100 36584U
+
+/*-------------------------------------------------------------*
+ *		Function prototypes				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Converts the image of the 7 time registers (0x00 to 0x06) to a unix
+ * timestamp without going through timelib_tm.
+ *
+ * Fields are decoded from BCD with shifts and multiplications only and the
+ * day of year comes from a cumulative table, so no divisions are performed.
+ * The clock halt bit of the DS1307 is ignored, hours must be in 24 hour mode
+ * and the century bit on the month register adds 100 years.
+ *
+ * @param regs Pointer to the 7 bytes read from the time registers.
+ *
+ * @return The unix timestamp, valid from 2000 to 2105.
+ */
+timelib_t gfrtc_regs2time(const uint8_t * regs);
+
+/**
+ * Converts a unix timestamp to the image of the 7 time registers in 24 hour
+ * mode, setting the century bit for years after 2099.
+ *
+ * A single 32 bit division splits days and seconds, the rest of the fields
+ * are computed with 16 bit arithmetic. Timestamps before 2000 are clamped to
+ * Jan 1, 2000.
+ *
+ * @param t The unix timestamp.
+ * @param regs Pointer to 7 bytes where the register image is stored.
+ */
+void gfrtc_time2regs(timelib_t t, uint8_t * regs);
+
+/**
+ * Converts a packed BCD byte to binary.
+ */
+static inline uint8_t gfrtc_bcd2dec(uint8_t num)
+{
+	// (num >> 4) * 10 as shifts, AVR has no divide instruction
+	return (uint8_t) (((num >> 4) << 3) + ((num >> 4) << 1) + (num & 0x0F));
+}
+
+/**
+ * Converts a binary value from 0 to 99 to packed BCD.
+ */
+static inline uint8_t gfrtc_dec2bcd(uint8_t num)
+{
+	// num / 10 for values below 100 computed as (num * 205) >> 11
+	uint8_t tens = (uint8_t) (((uint16_t) num * 205U) >> 11);
+	return (uint8_t) ((tens << 4) | (num - tens * 10));
+}
+
+#endif
+// End of Header file
@@ -0,0 +1,486 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCDRIVER_H
+#define GFRTCDRIVER_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Features of each supported chip, resolved at compile time.
+ */
+template <enum gfrtc_chips CHIP> struct gfrtc_chip_traits;
+
+template <> struct gfrtc_chip_traits<E_CHIP_DS1307> {
+	static const bool hasClockHalt = true;
+	static const bool hasCentury = false;
+	static const bool hasAlarms = false;
+	static const bool hasTemperature = false;
+	static const uint8_t nvramStart = DS1307_RAM_START_ADDR;
+	static const uint8_t nvramSize = DS1307_RAM_SIZE;
+};
+
+template <> struct gfrtc_chip_traits<E_CHIP_DS3231> {
+	static const bool hasClockHalt = false;
+	static const bool hasCentury = true;
+	static const bool hasAlarms = true;
+	static const bool hasTemperature = true;
+	static const uint8_t nvramStart = 0x00;
+	static const uint8_t nvramSize = 0;
+};
+
+template <> struct gfrtc_chip_traits<E_CHIP_DS3232> {
+	static const bool hasClockHalt = false;
+	static const bool hasCentury = true;
+	static const bool hasAlarms = true;
+	static const bool hasTemperature = true;
+	static const uint8_t nvramStart = SRAM_START_ADDR;
+	static const uint8_t nvramSize = SRAM_SIZE;
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Driver specialized at compile time for a chip, bus and address.
+ *
+ * The features of the chip are template constants, so branches that depend on
+ * them are removed by the compiler and methods for features the chip does not
+ * have fail to compile instead of failing at run time. Only the methods that
+ * are called get instantiated, which keeps the flash usage to a minimum on
+ * small AVR targets. The GFRTC object remains available for code that needs
+ * run time chip detection.
+ *
+ * Each method makes a single attempt on the bus. The timeouts, retries and bus
+ * recovery of GFRTCClass, the mux selection, the lock hooks, the statistics and
+ * the published time are not available, use the GFRTC object where they are
+ * needed.
+ *
+ * @tparam CHIP The chip connected to the bus.
+ * @tparam BUS The TwoWire object where the chip is connected.
+ * @tparam ADDRESS The I2C address of the chip.
+ * @tparam HOUR12 Set to true to decode the hours register in 12 hour mode if
+ * other software configured the chip that way. With the default (false) only
+ * 24 hour mode is supported, as written by this library.
+ */
+template <enum gfrtc_chips CHIP, TwoWire & BUS = Wire, uint8_t ADDRESS = GFRTC_I2C_ADDRESS, bool HOUR12 = false>
+class GFRTCDriver {
+public:
+	typedef gfrtc_chip_traits<CHIP> traits;
+
+	/**
+	 * Prepares the driver and checks for the presence of the chip.
+	 *
+	 * @param beginI2C Calls begin() on the bus if set to true.
+	 *
+	 * @return Returns true if communication with I2C RTC is successfull.
+	 */
+	static bool begin(bool beginI2C = true)
+	{
+		uint8_t reg;
+
+		if (beginI2C) {
+			BUS.begin();
+		}
+		return readRegister(GFRTC_REG_SECONDS, &reg, 1);
+	}
+
+	/**
+	 * Checks if the last operation on the bus was successful.
+	 */
+	static bool isPresent()
+	{
+		return _isPresent;
+	}
+
+	/**
+	 * Reads the time registers and converts them to a unix timestamp.
+	 *
+	 * @return The unix timestamp, 0 if the RTC cannot be read.
+	 */
+	static timelib_t get()
+	{
+		uint8_t regs[7];
+		uint8_t hour;
+
+		if (!readRegister(GFRTC_REG_SECONDS, regs, sizeof(regs)))
+			return 0;
+		if (traits::hasClockHalt && (regs[0] & (1 << GFRTC_BIT_DS1307_CH)))
+			return 0;
+		if (HOUR12 && (regs[2] & (1 << GFRTC_BIT_HR1224))) {
+			// the codec expects the hours register in 24 hour format
+			hour = bcd2dec(regs[2] & 0x1f) % 12;
+			if (regs[2] & 0x20)
+				hour += 12;
+			regs[2] = dec2bcd(hour);
+		}
+		if (!traits::hasCentury)
+			regs[5] &= 0x1f;
+		return gfrtc_regs2time(regs);
+	}
+
+	/**
+	 * Writes the time registers from a unix timestamp.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool set(timelib_t t)
+	{
+		uint8_t regs[7];
+
+		gfrtc_time2regs(t, regs);
+		if (!traits::hasCentury)
+			regs[5] &= 0x1f;
+		if (traits::hasClockHalt) {
+			// DS1307: write with clock halted, then start the oscillator
+			regs[0] |= 1 << GFRTC_BIT_DS1307_CH;
+			if (!writeRegister(GFRTC_REG_SECONDS, regs, sizeof(regs)))
+				return false;
+			regs[0] &= ~(1 << GFRTC_BIT_DS1307_CH);
+		}
+		return writeRegister(GFRTC_REG_SECONDS, regs, sizeof(regs));
+	}
+
+	/**
+	 * Reads the time registers in a single transaction.
+	 *
+	 * @return Returns true if communication is successfull and the clock is
+	 * running, false otherwise.
+	 */
+	static bool read(struct timelib_tm & dt)
+	{
+		uint8_t regs[7];
+		uint8_t year;
+
+		if (!readRegister(GFRTC_REG_SECONDS, regs, sizeof(regs)))
+			return false;
+
+		dt.tm_sec = bcd2dec(regs[0] & 0x7f);
+		dt.tm_min = bcd2dec(regs[1]);
+		if (HOUR12 && (regs[2] & (1 << GFRTC_BIT_HR1224))) {
+			dt.tm_hour = bcd2dec(regs[2] & 0x1f) % 12;
+			if (regs[2] & 0x20)
+				dt.tm_hour += 12;
+		} else {
+			dt.tm_hour = bcd2dec(regs[2] & 0x3f);
+		}
+		dt.tm_wday = bcd2dec(regs[3]);
+		dt.tm_mday = bcd2dec(regs[4]);
+		dt.tm_mon = bcd2dec(regs[5] & 0x1f);
+		year = bcd2dec(regs[6]);
+		if (traits::hasCentury && (regs[5] & (1 << GFRTC_BIT_CENTURY)))
+			year += 100;
+		dt.tm_year = timelib_y2k2tm(year);
+
+		if (traits::hasClockHalt && (regs[0] & (1 << GFRTC_BIT_DS1307_CH)))
+			return false;
+		return true;
+	}
+
+	/**
+	 * Writes the time registers in a single transaction, 24 hour mode.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool write(const struct timelib_tm & dt)
+	{
+		uint8_t regs[7];
+		uint8_t year = timelib_tm2y2k(dt.tm_year);
+
+		regs[0] = dec2bcd(dt.tm_sec & 0x7f) | (dt.tm_sec & 0x80);
+		regs[1] = dec2bcd(dt.tm_min);
+		regs[2] = dec2bcd(dt.tm_hour);
+		regs[3] = dec2bcd(dt.tm_wday);
+		regs[4] = dec2bcd(dt.tm_mday);
+		regs[5] = dec2bcd(dt.tm_mon);
+		if (traits::hasCentury && year >= 100) {
+			regs[5] |= 1 << GFRTC_BIT_CENTURY;
+			year -= 100;
+		}
+		regs[6] = dec2bcd(year);
+		return writeRegister(GFRTC_REG_SECONDS, regs, sizeof(regs));
+	}
+
+	/**
+	 * Reads multiple registers starting at the indicated address. The register
+	 * pointer is set once and the data is read in back to back bursts that fit
+	 * the Wire buffer.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool readRegister(uint8_t addr, void * data, uint16_t size)
+	{
+		uint8_t i, chunk;
+		uint8_t * dst = (uint8_t *) data;
+
+		_isPresent = false;
+		BUS.beginTransmission(ADDRESS);
+		BUS.write(addr);
+		if (BUS.endTransmission(false) != 0)
+			return false;
+		while (size > 0) {
+			chunk = (size > GFRTC_WIRE_BUFFER_SIZE) ? GFRTC_WIRE_BUFFER_SIZE : (uint8_t) size;
+			BUS.requestFrom(ADDRESS, chunk);
+			if (BUS.available() < chunk)
+				return false;
+			for (i = 0; i < chunk; i++) {
+				*dst++ = BUS.read();
+			}
+			size -= chunk;
+		}
+		_isPresent = true;
+		return true;
+	}
+
+	/**
+	 * Writes multiple registers starting at the indicated address.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the data does not fit the Wire buffer along with the address.
+	 */
+	static bool writeRegister(uint8_t addr, const void * data, uint8_t size)
+	{
+		uint8_t i;
+		const uint8_t * src = (const uint8_t *) data;
+
+		// limitation of wire library, the address takes one byte of the buffer
+		if (size > GFRTC_WIRE_BUFFER_SIZE - 1)
+			return false;
+
+		_isPresent = false;
+		BUS.beginTransmission(ADDRESS);
+		BUS.write(addr);
+		for (i = 0; i < size; i++) {
+			BUS.write(src[i]);
+		}
+		if (BUS.endTransmission() != 0)
+			return false;
+		_isPresent = true;
+		return true;
+	}
+
+	/**
+	 * Configures an alarm with a single write transaction.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool setAlarm(enum gfrtc_alarm_types type, uint8_t hour, uint8_t minute, uint8_t second, uint8_t dow)
+	{
+		static_assert(traits::hasAlarms, "This chip has no alarms");
+		uint8_t regs[4];
+
+		regs[0] = dec2bcd(second) | ((type & 0x01) ? (1 << GFRTC_BIT_A1M1) : 0);
+		regs[1] = dec2bcd(minute) | ((type & 0x02) ? (1 << GFRTC_BIT_A1M2) : 0);
+		regs[2] = dec2bcd(hour) | ((type & 0x04) ? (1 << GFRTC_BIT_A1M3) : 0);
+		regs[3] = dec2bcd(dow) | ((type & 0x08) ? (1 << GFRTC_BIT_A1M4) : 0) | ((type & 0x10) ? (1 << GFRTC_BIT_DYDT) : 0);
+		if (!(type & 0x80))
+			return writeRegister(GFRTC_REG_ALM1_SECONDS, regs, 4);
+		return writeRegister(GFRTC_REG_ALM2_MINUTES, &regs[1], 3);
+	}
+
+	/**
+	 * Enables or disables the interrupt of an alarm.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool setAlarmInterrupt(enum gfrtc_alarms alarm, bool enable)
+	{
+		static_assert(traits::hasAlarms, "This chip has no alarms");
+
+		return updateRegister(GFRTC_REG_CONTROL, (alarm == E_ALARM_1) ? (1 << GFRTC_BIT_A1IE) : (1 << GFRTC_BIT_A2IE), enable);
+	}
+
+	/**
+	 * Configures the INT/SQW output.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool setIntSqwMode(enum gfrtc_intsqw_modes frequency)
+	{
+		static_assert(traits::hasAlarms, "This chip has no INT/SQW control");
+		uint8_t reg;
+
+		if (!readRegister(GFRTC_REG_CONTROL, &reg, 1))
+			return false;
+		if (frequency >= E_INTERRUPT_OUTPUT) {
+			reg |= 1 << GFRTC_BIT_INTCN;
+		} else {
+			reg = (reg & 0xE3) | (frequency << GFRTC_BIT_RS1);
+		}
+		return writeRegister(GFRTC_REG_CONTROL, &reg, 1);
+	}
+
+	/**
+	 * Reads and clears the flag of an alarm.
+	 *
+	 * @return Returns true if the alarm flag was set.
+	 */
+	static bool getAlarmInterruptFlag(enum gfrtc_alarms alarm)
+	{
+		static_assert(traits::hasAlarms, "This chip has no alarms");
+		uint8_t reg;
+		uint8_t mask = (alarm == E_ALARM_1) ? (1 << GFRTC_BIT_A1F) : (1 << GFRTC_BIT_A2F);
+
+		if (!readRegister(GFRTC_REG_STATUS, &reg, 1) || !(reg & mask))
+			return false;
+		// writing ones keeps flags that latched after the read
+		reg = (reg | (1 << GFRTC_BIT_OSF) | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F)) & ~mask;
+		writeRegister(GFRTC_REG_STATUS, &reg, 1);
+		return true;
+	}
+
+	/**
+	 * Reads and optionally clears the oscillator stop flag.
+	 *
+	 * @return Returns true if the oscillator stopped at some time.
+	 */
+	static bool getOscillatorStopFlag(bool clearosf = false)
+	{
+		static_assert(traits::hasAlarms, "This chip has no status register");
+		uint8_t reg;
+
+		if (!readRegister(GFRTC_REG_STATUS, &reg, 1) || !(reg & (1 << GFRTC_BIT_OSF)))
+			return false;
+		if (clearosf) {
+			// writing ones keeps alarm flags that latched after the read
+			reg = (reg | (1 << GFRTC_BIT_A2F) | (1 << GFRTC_BIT_A1F)) & ~(1 << GFRTC_BIT_OSF);
+			writeRegister(GFRTC_REG_STATUS, &reg, 1);
+		}
+		return true;
+	}
+
+	/**
+	 * Reads the temperature sensor in a single transaction.
+	 *
+	 * @return The temperature in celsius degrees, fraction discarded.
+	 */
+	static int16_t getTemperature()
+	{
+		int16_t quarters;
+
+		if (!readTemperature(quarters))
+			return 0;
+		return quarters / 4;
+	}
+
+	/**
+	 * Reads the temperature sensor in a single transaction with the full 0.25
+	 * degree resolution.
+	 *
+	 * @param quarters Temperature in quarters of celsius degree.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool readTemperature(int16_t & quarters)
+	{
+		static_assert(traits::hasTemperature, "This chip has no temperature sensor");
+		uint8_t regs[2];
+
+		if (!readRegister(GFRTC_REG_MSB_TEMP, regs, sizeof(regs)))
+			return false;
+		quarters = (int16_t) (((uint16_t) regs[0] << 8) | regs[1]) >> 6;
+		return true;
+	}
+
+	/**
+	 * Reads general purpose memory, addressed from the first byte of memory.
+	 * The register pointer is set once and the data is read in back to back
+	 * bursts that fit the Wire buffer.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool readNVRAM(uint8_t offset, void * buffer, uint16_t size)
+	{
+		static_assert(traits::nvramSize != 0, "This chip has no general purpose memory");
+
+		if ((uint16_t) offset + size > traits::nvramSize)
+			return false;
+		return readRegister(traits::nvramStart + offset, buffer, size);
+	}
+
+	/**
+	 * Writes general purpose memory, addressed from the first byte of memory.
+	 * The data is split in bursts that fit the Wire buffer.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool writeNVRAM(uint8_t offset, const void * buffer, uint16_t size)
+	{
+		static_assert(traits::nvramSize != 0, "This chip has no general purpose memory");
+		uint8_t chunk;
+		uint8_t addr = traits::nvramStart + offset;
+		const uint8_t * src = (const uint8_t *) buffer;
+
+		if ((uint16_t) offset + size > traits::nvramSize)
+			return false;
+		while (size > 0) {
+			chunk = (size > GFRTC_WIRE_BUFFER_SIZE - 1) ? GFRTC_WIRE_BUFFER_SIZE - 1 : (uint8_t) size;
+			if (!writeRegister(addr, src, chunk))
+				return false;
+			addr += chunk;
+			src += chunk;
+			size -= chunk;
+		}
+		return true;
+	}
+
+private:
+	static bool updateRegister(uint8_t addr, uint8_t mask, bool set)
+	{
+		uint8_t reg;
+
+		if (!readRegister(addr, &reg, 1))
+			return false;
+		reg = set ? (reg | mask) : (reg & ~mask);
+		return writeRegister(addr, &reg, 1);
+	}
+
+	static uint8_t dec2bcd(uint8_t num)
+	{
+		return gfrtc_dec2bcd(num);
+	}
+
+	static uint8_t bcd2dec(uint8_t num)
+	{
+		return gfrtc_bcd2dec(num);
+	}
+
+	static bool _isPresent;
+};
+
+template <enum gfrtc_chips CHIP, TwoWire & BUS, uint8_t ADDRESS, bool HOUR12>
+bool GFRTCDriver<CHIP, BUS, ADDRESS, HOUR12>::_isPresent = false;
+
+/**
+ * Drivers for the supported chips on the default bus and address
+ */
+typedef GFRTCDriver<E_CHIP_DS1307> GFRTC_DS1307;
+typedef GFRTCDriver<E_CHIP_DS3231> GFRTC_DS3231;
+typedef GFRTCDriver<E_CHIP_DS3232> GFRTC_DS3232;
+
+#endif
+// End of Header file
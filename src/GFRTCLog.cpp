@@ -0,0 +1,514 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTC.h"
+
+// not compiled unless the tier includes it
+#if GFRTC_USE_NVRAM
+#include "GFRTCLog.h"
+
+/*-------------------------------------------------------------*
+ *		Private definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Marks a checkpoint slot that was written by this library
+ */
+#define LOG_MAGIC 0x4C
+
+/**
+ * Position used when there is no record
+ */
+#define LOG_NONE 0xFF
+
+/**
+ * First byte of the circular data area, after both checkpoint slots
+ */
+#define LOG_DATA_START (2 * GFRTC_LOG_SLOT_SIZE)
+
+/**
+ * Sequence numbers skipped by format() so records left by the previous
+ * format are never taken as part of the new log
+ */
+#define LOG_FORMAT_SEQ_GAP 0x100
+
+/*-------------------------------------------------------------*
+ *		Class implementation				*
+ *-------------------------------------------------------------*/
+GFRTCLogClass::GFRTCLogClass()
+{
+}
+
+bool GFRTCLogClass::begin(uint8_t offset, uint8_t size)
+{
+	uint8_t slots[2 * GFRTC_LOG_SLOT_SIZE];
+	uint8_t buf[GFRTC_LOG_MAX_RECORD];
+	uint8_t i, best, pos, n;
+	uint8_t * slot;
+	uint16_t seq, bestSeq = 0;
+
+	_valid = false;
+	_offset = offset;
+	_size = size;
+
+	// the data area must hold at least three records
+	if (size < LOG_DATA_START + 3 * GFRTC_LOG_RECORD_OVERHEAD)
+		return false;
+	if (!GFRTC.readNVRAM(offset, slots, sizeof(slots)))
+		return false;
+
+	// use the newest valid checkpoint
+	best = LOG_NONE;
+	for (i = 0; i < 2; i++) {
+		slot = &slots[i * GFRTC_LOG_SLOT_SIZE];
+		if (slot[0] != LOG_MAGIC || crc16(slot, 5) != (slot[5] | ((uint16_t) slot[6] << 8)))
+			continue;
+		seq = slot[3] | ((uint16_t) slot[4] << 8);
+		if (best == LOG_NONE || (int16_t) (seq - bestSeq) > 0) {
+			best = i;
+			bestSeq = seq;
+		}
+	}
+	if (best == LOG_NONE)
+		return false;
+
+	_slot = best;
+	slot = &slots[best * GFRTC_LOG_SLOT_SIZE];
+	_head = slot[1];
+	_headSize = slot[2];
+	_seq = bestSeq;
+
+	// follow the records appended after the checkpoint
+	_pending = 0;
+	while ((pos = findNext(_head, _headSize, _seq + 1, buf)) != LOG_NONE) {
+		n = buf[0] + GFRTC_LOG_RECORD_OVERHEAD;
+		if (_pending == 0) {
+			_first = pos;
+			_wrapped = false;
+		} else if (pos == LOG_DATA_START) {
+			_wrapped = true;
+		}
+		_head = pos;
+		_headSize = n;
+		_seq++;
+		_pending++;
+	}
+
+	// the newest record of each key is found once, append() and get() then
+	// never walk the log
+	if (!scan(buf))
+		return false;
+
+	_valid = true;
+	return true;
+}
+
+bool GFRTCLogClass::format()
+{
+	uint8_t slots[2 * GFRTC_LOG_SLOT_SIZE];
+	uint16_t seq, crc;
+
+	_valid = false;
+	if (_size < LOG_DATA_START + 3 * GFRTC_LOG_RECORD_OVERHEAD)
+		return false;
+
+	// continue the sequence of a previous store, records appended after its
+	// last checkpoint can be ahead of it
+	if (begin(_offset, _size)) {
+		seq = _seq + LOG_FORMAT_SEQ_GAP;
+	} else {
+		seq = (uint16_t) millis() ^ (uint16_t) GFRTC.get();
+	}
+
+	_head = LOG_NONE;
+	_headSize = 0;
+	_seq = seq;
+	_keyCount = 0;
+	slots[0] = LOG_MAGIC;
+	slots[1] = LOG_NONE;
+	slots[2] = 0;
+	slots[3] = (uint8_t) seq;
+	slots[4] = (uint8_t) (seq >> 8);
+	crc = crc16(slots, 5);
+	slots[5] = (uint8_t) crc;
+	slots[6] = (uint8_t) (crc >> 8);
+	memcpy(&slots[GFRTC_LOG_SLOT_SIZE], slots, GFRTC_LOG_SLOT_SIZE);
+	if (!GFRTC.writeNVRAM(_offset, slots, sizeof(slots)))
+		return false;
+
+	_slot = 0;
+	_pending = 0;
+	_valid = true;
+	return true;
+}
+
+bool GFRTCLogClass::append(uint8_t key, const void * data, uint8_t size)
+{
+	uint8_t buf[2][GFRTC_LOG_MAX_RECORD];
+	const uint8_t * src;
+	uint8_t i, n, k, len, which, limit;
+	bool ahead;
+
+	// records up to a third of the data area never overwrite the newest one
+	n = size + GFRTC_LOG_RECORD_OVERHEAD;
+	if (!_valid || size > GFRTC_LOG_MAX_DATA || n > (_size - LOG_DATA_START) / 3)
+		return false;
+	if (findKey(key) == GFRTC_LOG_MAX_KEYS && _keyCount == GFRTC_LOG_MAX_KEYS)
+		return false;
+
+	// the last value of other keys is copied forward before it is overwritten,
+	// looking one record ahead so a copy is never written over its original.
+	// A copy can overwrite the last value of yet another key, so the record
+	// written is the first one found that does not. Copies take the space of
+	// the records they replace, this only fails when the last values of all
+	// keys do not fit in the data area
+	limit = (_size - LOG_DATA_START) / GFRTC_LOG_RECORD_OVERHEAD;
+	for (i = 0; ; ) {
+		k = key;
+		src = (const uint8_t *) data;
+		len = size;
+		which = 0;
+		ahead = true;
+		while (findLost(len + GFRTC_LOG_RECORD_OVERHEAD, k, ahead, buf[which])) {
+			if (++i > limit)
+				return false;
+			k = buf[which][4];
+			src = &buf[which][5];
+			len = buf[which][0];
+			which ^= 1;
+			ahead = false;
+		}
+		if (!writeRecord(k, src, len))
+			return false;
+		if (src == data)
+			return true;
+	}
+}
+
+int16_t GFRTCLogClass::get(uint8_t key, void * data, uint8_t size)
+{
+	uint8_t buf[GFRTC_LOG_MAX_RECORD];
+	uint8_t i, pos;
+	uint16_t seq;
+
+	if (!_valid || (i = findKey(key)) == GFRTC_LOG_MAX_KEYS)
+		return -1;
+
+	pos = _keys[i].pos;
+	seq = _keys[i].seq;
+	if (!stepBack(pos, seq, buf))
+		return -1;
+	memcpy(data, &buf[5], (buf[0] < size) ? buf[0] : size);
+	return buf[0];
+}
+
+uint16_t GFRTCLogClass::walk(gfrtc_log_handler handler)
+{
+	uint8_t buf[GFRTC_LOG_MAX_RECORD];
+	uint8_t pos = _head;
+	uint16_t seq = _seq;
+	uint16_t count = 0;
+
+	if (!_valid)
+		return 0;
+
+	while (stepBack(pos, seq, buf)) {
+		count++;
+		if (!handler(buf[4], seq + 1, &buf[5], buf[0]))
+			break;
+	}
+	return count;
+}
+
+bool GFRTCLogClass::sync()
+{
+	if (!_valid)
+		return false;
+	if (_pending == 0)
+		return true;
+	return writeCheckpoint();
+}
+
+uint16_t GFRTCLogClass::getSequence()
+{
+	return (_head == LOG_NONE) ? 0 : _seq;
+}
+
+/*-------------------------------------------------------------*
+ *		Private members					*
+ *-------------------------------------------------------------*/
+
+uint8_t GFRTCLogClass::loadRecord(uint8_t pos, uint8_t * buf)
+{
+	uint8_t n, len;
+
+	if (pos >= _size)
+		return 0;
+	n = (_size - pos > GFRTC_LOG_MAX_RECORD) ? GFRTC_LOG_MAX_RECORD : _size - pos;
+	if (n < GFRTC_LOG_RECORD_OVERHEAD)
+		return 0;
+	if (!GFRTC.readNVRAM(_offset + pos, buf, n))
+		return 0;
+
+	len = buf[0];
+	if (len > GFRTC_LOG_MAX_DATA || len + GFRTC_LOG_RECORD_OVERHEAD > n)
+		return 0;
+	n = len + GFRTC_LOG_RECORD_OVERHEAD;
+	if (crc16(buf, n - 2) != (buf[n - 2] | ((uint16_t) buf[n - 1] << 8)))
+		return 0;
+	return n;
+}
+
+uint8_t GFRTCLogClass::findNext(uint8_t prev, uint8_t prevSize, uint16_t seq, uint8_t * buf)
+{
+	uint8_t pos;
+	uint8_t i;
+
+	// next record follows the previous one or wrapped to the start
+	pos = (prev == LOG_NONE) ? LOG_DATA_START : prev + prevSize;
+	for (i = 0; i < 2; i++) {
+		if (loadRecord(pos, buf) && buf[1] == prev && (buf[2] | ((uint16_t) buf[3] << 8)) == seq)
+			return pos;
+		if (pos == LOG_DATA_START)
+			break;
+		pos = LOG_DATA_START;
+	}
+	return LOG_NONE;
+}
+
+bool GFRTCLogClass::stepBack(uint8_t & pos, uint16_t & seq, uint8_t * buf)
+{
+	if (pos == LOG_NONE || !loadRecord(pos, buf))
+		return false;
+	// stale data can pass the CRC but not the sequence check
+	if ((buf[2] | ((uint16_t) buf[3] << 8)) != seq)
+		return false;
+	pos = buf[1];
+	seq--;
+	return true;
+}
+
+uint8_t GFRTCLogClass::place(uint8_t n)
+{
+	uint8_t pos;
+
+	// after the newest record, wrap if it does not fit
+	pos = (_head == LOG_NONE) ? LOG_DATA_START : _head + _headSize;
+	if ((uint16_t) pos + n > _size)
+		pos = LOG_DATA_START;
+	return pos;
+}
+
+uint8_t GFRTCLogClass::distance(uint8_t pos)
+{
+	uint8_t end = _head + _headSize;
+
+	// bytes from the end of the newest record, going around the data area
+	return (pos >= end) ? pos - end : _size - end + pos - LOG_DATA_START;
+}
+
+bool GFRTCLogClass::scan(uint8_t * buf)
+{
+	uint8_t pos = _head, rec = _head;
+	uint16_t seq = _seq;
+
+	// the first record seen of each key is its newest one
+	_keyCount = 0;
+	while (stepBack(pos, seq, buf)) {
+		if (findKey(buf[4]) == GFRTC_LOG_MAX_KEYS) {
+			if (_keyCount == GFRTC_LOG_MAX_KEYS)
+				return false;
+			_keys[_keyCount].key = buf[4];
+			_keys[_keyCount].pos = rec;
+			_keys[_keyCount].seq = seq + 1;
+			_keyCount++;
+		}
+		rec = pos;
+	}
+	return true;
+}
+
+uint8_t GFRTCLogClass::findKey(uint8_t key)
+{
+	uint8_t i;
+
+	for (i = 0; i < _keyCount; i++) {
+		if (_keys[i].key == key)
+			return i;
+	}
+	return GFRTC_LOG_MAX_KEYS;
+}
+
+bool GFRTCLogClass::findLost(uint8_t n, uint8_t key, bool ahead, uint8_t * buf)
+{
+	uint8_t pos, first, second, max, i, best, d, bestDistance = 0;
+	uint16_t seq, reach;
+
+	if (_head == LOG_NONE)
+		return false;
+
+	// the range of the record and optionally of a record of the largest size
+	// that could follow it
+	first = place(n);
+	max = 0;
+	if (ahead) {
+		max = (_size - LOG_DATA_START) / 3;
+		if (max > GFRTC_LOG_MAX_RECORD)
+			max = GFRTC_LOG_MAX_RECORD;
+	}
+	second = ((uint16_t) first + n + max > _size) ? LOG_DATA_START : first + n;
+
+	// the walk of the log stops at the first overwritten record, so records
+	// up to the end of the last range are lost even if they are not written,
+	// as those skipped when a record wraps to the start of the area
+	reach = (uint16_t) distance(first) + n;
+	if ((uint16_t) distance(second) + max > reach)
+		reach = (uint16_t) distance(second) + max;
+
+	// the newest record of every other key inside the range is lost, the
+	// oldest of them is copied first. Records fit in a third of the area so
+	// the newest record of the log is never overwritten
+	best = GFRTC_LOG_MAX_KEYS;
+	for (i = 0; i < _keyCount; i++) {
+		if (_keys[i].key == key || _keys[i].seq == _seq)
+			continue;
+		d = distance(_keys[i].pos);
+		if (d < reach && (best == GFRTC_LOG_MAX_KEYS || d < bestDistance)) {
+			best = i;
+			bestDistance = d;
+		}
+	}
+	if (best == GFRTC_LOG_MAX_KEYS)
+		return false;
+
+	pos = _keys[best].pos;
+	seq = _keys[best].seq;
+	return stepBack(pos, seq, buf);
+}
+
+bool GFRTCLogClass::writeRecord(uint8_t key, const void * data, uint8_t size)
+{
+	uint8_t buf[GFRTC_LOG_MAX_RECORD];
+	uint8_t pos, n, i;
+	uint16_t crc, seq = _seq + 1;
+
+	n = size + GFRTC_LOG_RECORD_OVERHEAD;
+	pos = place(n);
+
+	// begin() follows every record appended after the checkpoint, they go
+	// from _first to the end of the area and, once wrapped, from the start of
+	// the area to the newest record. Move the checkpoint before overwriting any
+	if (_pending >= GFRTC_LOG_CHECKPOINT_INTERVAL ||
+		(_pending != 0 && (_wrapped ? (pos == LOG_DATA_START || pos + n > _first) :
+		(pos == LOG_DATA_START && pos + n > _first)))) {
+		if (!writeCheckpoint())
+			return false;
+	}
+
+	buf[0] = size;
+	buf[1] = _head;
+	buf[2] = (uint8_t) seq;
+	buf[3] = (uint8_t) (seq >> 8);
+	buf[4] = key;
+	memcpy(&buf[5], data, size);
+	crc = crc16(buf, n - 2);
+	buf[n - 2] = (uint8_t) crc;
+	buf[n - 1] = (uint8_t) (crc >> 8);
+
+	// a burst interrupted by a power loss leaves a record that fails its CRC
+	if (!GFRTC.writeNVRAM(_offset + pos, buf, n))
+		return false;
+
+	if (_pending == 0) {
+		_first = pos;
+		_wrapped = false;
+	} else if (pos == LOG_DATA_START) {
+		_wrapped = true;
+	}
+	i = findKey(key);
+	if (i == GFRTC_LOG_MAX_KEYS) {
+		i = _keyCount++;
+		_keys[i].key = key;
+	}
+	_keys[i].pos = pos;
+	_keys[i].seq = seq;
+	_head = pos;
+	_headSize = n;
+	_seq = seq;
+	_pending++;
+	return true;
+}
+
+bool GFRTCLogClass::writeCheckpoint()
+{
+	uint8_t slot[GFRTC_LOG_SLOT_SIZE];
+	uint8_t next = _slot ^ 1;
+	uint16_t crc;
+
+	slot[0] = LOG_MAGIC;
+	slot[1] = _head;
+	slot[2] = _headSize;
+	slot[3] = (uint8_t) _seq;
+	slot[4] = (uint8_t) (_seq >> 8);
+	crc = crc16(slot, 5);
+	slot[5] = (uint8_t) crc;
+	slot[6] = (uint8_t) (crc >> 8);
+
+	// the other slot keeps the previous checkpoint if this write is torn
+	if (!GFRTC.writeNVRAM(_offset + next * GFRTC_LOG_SLOT_SIZE, slot, sizeof(slot)))
+		return false;
+	_slot = next;
+	_pending = 0;
+	return true;
+}
+
+uint16_t GFRTCLogClass::crc16(const uint8_t * data, uint8_t size)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+
+	// CRC-16/CCITT, a torn burst leaves a new header followed by old bytes so
+	// 8 bits would accept one torn record out of 256
+	while (size--) {
+		crc ^= (uint16_t) *data++ << 8;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+bool GFRTCLogClass::_valid = false;
+uint8_t GFRTCLogClass::_offset = 0;
+uint8_t GFRTCLogClass::_size = 0;
+uint8_t GFRTCLogClass::_head = LOG_NONE;
+uint8_t GFRTCLogClass::_headSize = 0;
+uint16_t GFRTCLogClass::_seq = 0;
+uint8_t GFRTCLogClass::_first = LOG_NONE;
+bool GFRTCLogClass::_wrapped = false;
+uint8_t GFRTCLogClass::_slot = 0;
+uint8_t GFRTCLogClass::_pending = 0;
+struct gfrtc_log_key GFRTCLogClass::_keys[GFRTC_LOG_MAX_KEYS];
+uint8_t GFRTCLogClass::_keyCount = 0;
+
+/**
+ * Create an instance for the user
+ */
+GFRTCLogClass GFRTCLog = GFRTCLogClass();
+#endif
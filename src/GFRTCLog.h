@@ -0,0 +1,303 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCLOG_H
+#define GFRTCLOG_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+#if !GFRTC_USE_NVRAM
+#error "GFRTCLog needs GFRTC_TIER GFRTC_TIER_NVRAM or higher"
+#endif
+
+/*-------------------------------------------------------------*
+ *		Library configuration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Number of appends between checkpoints, this bounds the number of records
+ * begin() must follow to find the newest one
+ */
+#ifndef GFRTC_LOG_CHECKPOINT_INTERVAL
+#define GFRTC_LOG_CHECKPOINT_INTERVAL	16
+#endif
+
+/**
+ * Number of different keys the store can hold, the newest record of each key
+ * is tracked on RAM (4 bytes per key)
+ */
+#ifndef GFRTC_LOG_MAX_KEYS
+#define GFRTC_LOG_MAX_KEYS	8
+#endif
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Bytes added to the data of each record: length, previous record, sequence
+ * number (2 bytes), key and CRC (2 bytes)
+ */
+#define GFRTC_LOG_RECORD_OVERHEAD	7
+
+/**
+ * Largest record, a record is always written in a single burst
+ */
+#define GFRTC_LOG_MAX_RECORD	(GFRTC_WIRE_BUFFER_SIZE - 1)
+
+/**
+ * Largest data payload of a record
+ */
+#define GFRTC_LOG_MAX_DATA	(GFRTC_LOG_MAX_RECORD - GFRTC_LOG_RECORD_OVERHEAD)
+
+/**
+ * Size of each of the two checkpoint slots at the start of the region: magic,
+ * position and size of the newest record, sequence number and CRC
+ */
+#define GFRTC_LOG_SLOT_SIZE	7
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Newest record of a key, kept on RAM
+ */
+struct gfrtc_log_key {
+	/** Key of the record */
+	uint8_t key;
+	/** Position of the record on the region */
+	uint8_t pos;
+	/** Sequence number of the record */
+	uint16_t seq;
+};
+
+/**
+ * Function called for each record by walk().
+ *
+ * @param key Key of the record.
+ * @param seq Sequence number of the record.
+ * @param data Pointer to the data of the record.
+ * @param size Size of the data.
+ *
+ * @return Return true to continue with the next (older) record, false to stop.
+ */
+typedef bool (*gfrtc_log_handler)(uint8_t key, uint16_t seq, const uint8_t * data, uint8_t size);
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Append-only record store on the battery backed NVRAM.
+ *
+ * The region starts with two checkpoint slots followed by a circular data
+ * area. Each record carries its key, a sequence number, the position of the
+ * previous record and a CRC-16, and is written in a single burst. A new record
+ * is placed right after the newest one and wraps to the start of the data
+ * area when it does not fit, overwriting the oldest records. Walking the log
+ * goes from the newest record to the older ones and stops at the first record
+ * that fails its CRC, sequence or link check, so a record torn by a power loss
+ * and everything it overwrote are simply no longer part of the log.
+ *
+ * The checkpoint holds the position, size and sequence number of a recent
+ * record and is written to the older of the two slots every
+ * GFRTC_LOG_CHECKPOINT_INTERVAL appends and before any record appended after
+ * it is overwritten. begin() reads the checkpoint and follows the
+ * records appended after it, so the newest record is found without probing
+ * every position of the region.
+ *
+ * The store can be used as a log (walk()) or as a key-value store where the
+ * newest record of a key holds its value (get()). Before a record is
+ * overwritten, the newest record of its key is copied forward unless a newer
+ * one survives, so a value is never lost because other keys were updated
+ * often. The newest records of all keys must fit together in half of the data
+ * area, append() fails when they do not.
+ *
+ * The position and sequence number of the newest record of each key are kept
+ * on RAM. begin() walks the log once to build this index, after that get()
+ * reads a single record and append() only reads the header of the records
+ * about to be overwritten, about one per append, to know whether they must be
+ * copied forward.
+ */
+class GFRTCLogClass {
+public:
+	GFRTCLogClass();
+
+	/**
+	 * Opens the store and finds the newest record. GFRTC.begin() must be
+	 * called first so the chip type is known.
+	 *
+	 * @param offset Offset from the first byte of NVRAM of the region.
+	 * @param size Size of the region.
+	 *
+	 * @return Returns true if a formatted store was found, false if the region
+	 * must be formatted, communication failed or the store holds more than
+	 * GFRTC_LOG_MAX_KEYS keys.
+	 */
+	static bool begin(uint8_t offset, uint8_t size);
+
+	/**
+	 * Erases the store on the region configured by begin(), even if begin()
+	 * failed because the region was not formatted.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool format();
+
+	/**
+	 * Appends a record. The records that the new one would overwrite are
+	 * checked against the index of newest records to find the values that
+	 * must be copied forward, the record is then written in a single burst,
+	 * preceded by the copies and by the checkpoint when it is due.
+	 *
+	 * @param key Key of the record, used by get().
+	 * @param data Pointer to the data to store.
+	 * @param size Size of the data, the record must fit in a third of the data
+	 * area and data is limited to GFRTC_LOG_MAX_DATA bytes.
+	 *
+	 * @return Returns true if the record was written, false if communication
+	 * failed, the key is new and GFRTC_LOG_MAX_KEYS keys are already stored or
+	 * the newest records of all keys do not fit in the data area.
+	 */
+	static bool append(uint8_t key, const void * data, uint8_t size);
+
+	/**
+	 * Gets the data of the newest record with a given key.
+	 *
+	 * @param key Key to search.
+	 * @param data Pointer where the data should be stored.
+	 * @param size Size of the buffer, data is truncated to this size.
+	 *
+	 * @return The size of the record data, -1 if there is no record with the
+	 * key or communication failed.
+	 */
+	static int16_t get(uint8_t key, void * data, uint8_t size);
+
+	/**
+	 * Calls a function for each record, from the newest to the oldest.
+	 *
+	 * @return The number of records visited.
+	 */
+	static uint16_t walk(gfrtc_log_handler handler);
+
+	/**
+	 * Writes a checkpoint pointing to the newest record, the next begin() will
+	 * not need to scan any record.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool sync();
+
+	/**
+	 * Gets the sequence number of the newest record, 0 if the store is empty.
+	 */
+	static uint16_t getSequence();
+
+private:
+	/**
+	 * Reads the record at a position of the region and checks its CRC.
+	 *
+	 * @return The size of the record, 0 if there is no valid record.
+	 */
+	static uint8_t loadRecord(uint8_t pos, uint8_t * buf);
+
+	/**
+	 * Looks for the record that follows the one at prev on the log.
+	 *
+	 * @return The position of the record, 0xFF if not found.
+	 */
+	static uint8_t findNext(uint8_t prev, uint8_t prevSize, uint16_t seq, uint8_t * buf);
+
+	/**
+	 * Loads the record at pos and moves pos to the previous record.
+	 *
+	 * @return Returns true if a valid record with the expected sequence number
+	 * was loaded.
+	 */
+	static bool stepBack(uint8_t & pos, uint16_t & seq, uint8_t * buf);
+
+	/**
+	 * Gets the position of the next record appended.
+	 */
+	static uint8_t place(uint8_t n);
+
+	/**
+	 * Gets the bytes from the end of the newest record to a position, going
+	 * around the data area.
+	 */
+	static uint8_t distance(uint8_t pos);
+
+	/**
+	 * Walks the whole log to find the newest record of each key.
+	 *
+	 * @return Returns false if the log holds more than GFRTC_LOG_MAX_KEYS keys.
+	 */
+	static bool scan(uint8_t * buf);
+
+	/**
+	 * Gets the entry of a key on the index, GFRTC_LOG_MAX_KEYS if the key has
+	 * no record.
+	 */
+	static uint8_t findKey(uint8_t key);
+
+	/**
+	 * Looks for the last value of a key that appending a record of n bytes
+	 * would remove from the log.
+	 *
+	 * @param ahead Also consider a record of the largest size appended next.
+	 *
+	 * @return Returns true if such a record was found and loaded on buf.
+	 */
+	static bool findLost(uint8_t n, uint8_t key, bool ahead, uint8_t * buf);
+
+	/**
+	 * Writes a record after the newest one, moving the checkpoint first if
+	 * needed.
+	 */
+	static bool writeRecord(uint8_t key, const void * data, uint8_t size);
+
+	static bool writeCheckpoint();
+
+	static uint16_t crc16(const uint8_t * data, uint8_t size);
+
+	static bool _valid;
+	static uint8_t _offset;
+	static uint8_t _size;
+	static uint8_t _head;
+	static uint8_t _headSize;
+	static uint16_t _seq;
+	static uint8_t _first;
+	static bool _wrapped;
+	static uint8_t _slot;
+	static uint8_t _pending;
+	static struct gfrtc_log_key _keys[GFRTC_LOG_MAX_KEYS];
+	static uint8_t _keyCount;
+};
+
+/**
+ * Instance of the GFRTCLogClass as declared in GFRTCLog.cpp
+ */
+extern GFRTCLogClass GFRTCLog;
+
+#endif
+// End of Header file
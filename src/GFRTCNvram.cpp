@@ -0,0 +1,214 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTC.h"
+
+// not compiled unless the tier includes it
+#if GFRTC_USE_NVRAM
+#include "GFRTCNvram.h"
+
+/*-------------------------------------------------------------*
+ *		Class implementation				*
+ *-------------------------------------------------------------*/
+GFRTCNvramClass::GFRTCNvramClass()
+{
+}
+
+bool GFRTCNvramClass::begin(uint8_t offset, uint8_t size, uint32_t interval)
+{
+	// writes of the previous window are flushed before it is replaced, the
+	// mirror is kept untouched if they cannot be written
+	if (!flush())
+		return false;
+
+	_valid = false;
+	_interval = interval;
+
+	if (size == 0 || size > GFRTC_NVRAM_CACHE_SIZE)
+		return false;
+
+	// initial load, the range is checked against the detected chip
+	if (!GFRTC.readNVRAM(offset, _data, size))
+		return false;
+
+	_offset = offset;
+	_size = size;
+	_valid = true;
+	return true;
+}
+
+bool GFRTCNvramClass::end()
+{
+	bool ret = flush();
+
+	_valid = false;
+	return ret;
+}
+
+bool GFRTCNvramClass::read(uint8_t offset, void * buffer, uint16_t size)
+{
+	if (covers(offset, size)) {
+		memcpy(buffer, &_data[offset - _offset], size);
+		return true;
+	}
+
+	// chip holds stale data where the window has unflushed writes
+	if (overlaps(offset, size) && !flush())
+		return false;
+	return GFRTC.readNVRAM(offset, buffer, size);
+}
+
+bool GFRTCNvramClass::write(uint8_t offset, const void * buffer, uint16_t size)
+{
+	uint8_t first, last;
+
+	if (covers(offset, size)) {
+		if (size == 0)
+			return true;
+		memcpy(&_data[offset - _offset], buffer, size);
+		markDirty(offset - _offset, offset - _offset + size);
+		return true;
+	}
+
+	if (!GFRTC.writeNVRAM(offset, buffer, size))
+		return false;
+
+	// keep the mirrored bytes coherent with the data just written
+	if (overlaps(offset, size)) {
+		first = (offset > _offset) ? offset : _offset;
+		last = ((uint16_t) offset + size < (uint16_t) _offset + _size) ? offset + size : _offset + _size;
+		memcpy(&_data[first - _offset], (const uint8_t *) buffer + (first - offset), last - first);
+	}
+	return true;
+}
+
+bool GFRTCNvramClass::flush()
+{
+	uint8_t i;
+	struct gfrtc_nvram_range * r;
+
+	// write ranges from the last one so failed ranges stay on the list
+	while (_rangeCount > 0) {
+		i = _rangeCount - 1;
+		r = &_ranges[i];
+		if (!GFRTC.writeNVRAM(_offset + r->start, &_data[r->start], r->end - r->start))
+			return false;
+		_rangeCount = i;
+	}
+	return true;
+}
+
+bool GFRTCNvramClass::update()
+{
+	if (_rangeCount == 0 || _interval == 0)
+		return true;
+	if ((uint32_t) (millis() - _dirtySince) < _interval)
+		return true;
+
+	// retry after a full interval if the flush fails
+	_dirtySince = millis();
+	return flush();
+}
+
+bool GFRTCNvramClass::isDirty()
+{
+	return _rangeCount != 0;
+}
+
+uint8_t GFRTCNvramClass::getDirtyRanges()
+{
+	return _rangeCount;
+}
+
+/*-------------------------------------------------------------*
+ *		Private members					*
+ *-------------------------------------------------------------*/
+
+void GFRTCNvramClass::markDirty(uint8_t start, uint8_t end)
+{
+	uint8_t i, best;
+	uint8_t gap, bestGap;
+	struct gfrtc_nvram_range * r;
+
+	if (_rangeCount == 0)
+		_dirtySince = millis();
+
+	for (;;) {
+		// absorb every range that overlaps or is close to the new one, the
+		// search restarts because the grown range can reach other ranges
+		for (i = 0; i < _rangeCount; i++) {
+			r = &_ranges[i];
+			if (start <= r->end + GFRTC_NVRAM_MERGE_GAP && r->start <= end + GFRTC_NVRAM_MERGE_GAP)
+				break;
+		}
+
+		if (i == _rangeCount) {
+			if (_rangeCount < GFRTC_NVRAM_MAX_RANGES) {
+				_ranges[_rangeCount].start = start;
+				_ranges[_rangeCount].end = end;
+				_rangeCount++;
+				return;
+			}
+			// list is full, merge with the closest range
+			best = 0;
+			bestGap = 0xFF;
+			for (i = 0; i < _rangeCount; i++) {
+				r = &_ranges[i];
+				gap = (r->start > end) ? r->start - end : start - r->end;
+				if (gap < bestGap) {
+					bestGap = gap;
+					best = i;
+				}
+			}
+			i = best;
+		}
+
+		r = &_ranges[i];
+		if (r->start < start)
+			start = r->start;
+		if (r->end > end)
+			end = r->end;
+		_ranges[i] = _ranges[--_rangeCount];
+	}
+}
+
+bool GFRTCNvramClass::covers(uint8_t offset, uint16_t size)
+{
+	return _valid && offset >= _offset && (uint16_t) offset + size <= (uint16_t) _offset + _size;
+}
+
+bool GFRTCNvramClass::overlaps(uint8_t offset, uint16_t size)
+{
+	return _valid && size != 0 && offset < (uint16_t) _offset + _size && (uint16_t) offset + size > _offset;
+}
+
+bool GFRTCNvramClass::_valid = false;
+uint8_t GFRTCNvramClass::_offset = 0;
+uint8_t GFRTCNvramClass::_size = 0;
+uint32_t GFRTCNvramClass::_interval = 0;
+uint32_t GFRTCNvramClass::_dirtySince = 0;
+uint8_t GFRTCNvramClass::_rangeCount = 0;
+struct gfrtc_nvram_range GFRTCNvramClass::_ranges[GFRTC_NVRAM_MAX_RANGES];
+uint8_t GFRTCNvramClass::_data[GFRTC_NVRAM_CACHE_SIZE];
+
+/**
+ * Create an instance for the user
+ */
+GFRTCNvramClass GFRTCNvram = GFRTCNvramClass();
+#endif
@@ -0,0 +1,199 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCNVRAM_H
+#define GFRTCNVRAM_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+#if !GFRTC_USE_NVRAM
+#error "GFRTCNvram needs GFRTC_TIER GFRTC_TIER_NVRAM or higher"
+#endif
+
+/*-------------------------------------------------------------*
+ *		Library configuration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Bytes of RAM reserved for the NVRAM mirror, reduce it on small AVRs and
+ * mirror only the part of the NVRAM that is updated often
+ */
+#ifndef GFRTC_NVRAM_CACHE_SIZE
+#define GFRTC_NVRAM_CACHE_SIZE	SRAM_SIZE
+#endif
+
+/**
+ * Maximum number of separate dirty ranges tracked, when exceeded the two
+ * closest ranges are merged
+ */
+#ifndef GFRTC_NVRAM_MAX_RANGES
+#define GFRTC_NVRAM_MAX_RANGES	4
+#endif
+
+/**
+ * Dirty ranges separated by this number of clean bytes or less are written
+ * in a single burst, rewriting a few clean bytes is cheaper than the START,
+ * address and register pointer of another transfer
+ */
+#ifndef GFRTC_NVRAM_MERGE_GAP
+#define GFRTC_NVRAM_MERGE_GAP	3
+#endif
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Range of bytes modified on the mirror and not yet written to the chip
+ */
+struct gfrtc_nvram_range {
+	/** First dirty byte, relative to the start of the mirror */
+	uint8_t start;
+	/** One past the last dirty byte */
+	uint8_t end;
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Write-back RAM mirror of the general purpose NVRAM.
+ *
+ * A window of the NVRAM is loaded once by begin(), after that reads inside the
+ * window never touch the bus and writes only update RAM and mark the bytes as
+ * dirty. Dirty ranges are merged when they overlap or are close to each other
+ * and are written to the chip by flush(), or by update() when the flush
+ * interval expires. Accesses outside the window go straight to the chip.
+ *
+ * Data not flushed is lost on a reset or power failure.
+ */
+class GFRTCNvramClass {
+public:
+	GFRTCNvramClass();
+
+	/**
+	 * Loads the window of NVRAM to mirror. GFRTC.begin() must be called first
+	 * so the chip type is known. When called again, the pending writes of the
+	 * current window are flushed before the new one is loaded.
+	 *
+	 * @param offset Offset from the first byte of NVRAM of the window.
+	 * @param size Size of the window, up to GFRTC_NVRAM_CACHE_SIZE.
+	 * @param interval Milliseconds between the first unflushed write and the
+	 * automatic flush performed by update(), 0 to flush only on request.
+	 *
+	 * @return Returns true if the window was loaded, false if the chip has no
+	 * NVRAM, the window does not fit or communication failed. If pending writes
+	 * could not be flushed false is returned and the current window is kept
+	 * with its dirty ranges.
+	 */
+	static bool begin(uint8_t offset = 0, uint8_t size = GFRTC_NVRAM_CACHE_SIZE, uint32_t interval = 0);
+
+	/**
+	 * Flushes pending data and stops mirroring.
+	 *
+	 * @return Returns true if pending data was written.
+	 */
+	static bool end();
+
+	/**
+	 * Reads NVRAM, served from RAM when the range is inside the window.
+	 *
+	 * @param offset The offset from the first byte of NVRAM to read from.
+	 * @param buffer Pointer where data should be stored.
+	 * @param size Size of the data to transfer.
+	 *
+	 * @return Returns true if successful, false otherwise.
+	 */
+	static bool read(uint8_t offset, void * buffer, uint16_t size);
+
+	/**
+	 * Writes NVRAM, stored in RAM until the next flush when the range is
+	 * inside the window.
+	 *
+	 * @param offset The offset from the first byte of NVRAM to write to.
+	 * @param buffer Pointer to buffer containing data to write.
+	 * @param size Size of the data to transfer.
+	 *
+	 * @return Returns true if successful, false otherwise.
+	 */
+	static bool write(uint8_t offset, const void * buffer, uint16_t size);
+
+	/**
+	 * Writes all dirty ranges to the chip, one burst per range.
+	 *
+	 * @return Returns true if all data was written, ranges that could not be
+	 * written are kept dirty.
+	 */
+	static bool flush();
+
+	/**
+	 * Flushes the mirror when the flush interval expires, call this method
+	 * often from the main loop.
+	 *
+	 * @return Returns false if a flush was attempted and failed.
+	 */
+	static bool update();
+
+	/**
+	 * Checks if there is data not yet written to the chip.
+	 */
+	static bool isDirty();
+
+	/**
+	 * Gets the number of dirty ranges waiting for the next flush.
+	 */
+	static uint8_t getDirtyRanges();
+
+private:
+	/**
+	 * Adds a range to the dirty list, merging it with close ranges.
+	 */
+	static void markDirty(uint8_t start, uint8_t end);
+
+	/**
+	 * Checks if a range of NVRAM is inside the mirrored window.
+	 */
+	static bool covers(uint8_t offset, uint16_t size);
+
+	/**
+	 * Checks if a range of NVRAM shares bytes with the mirrored window.
+	 */
+	static bool overlaps(uint8_t offset, uint16_t size);
+
+	static bool _valid;
+	static uint8_t _offset;
+	static uint8_t _size;
+	static uint32_t _interval;
+	static uint32_t _dirtySince;
+	static uint8_t _rangeCount;
+	static struct gfrtc_nvram_range _ranges[GFRTC_NVRAM_MAX_RANGES];
+	static uint8_t _data[GFRTC_NVRAM_CACHE_SIZE];
+};
+
+/**
+ * Instance of the GFRTCNvramClass as declared in GFRTCNvram.cpp
+ */
+extern GFRTCNvramClass GFRTCNvram;
+
+#endif
+// End of Header file
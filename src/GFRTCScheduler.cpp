@@ -0,0 +1,301 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTC.h"
+
+// not compiled unless the tier includes it
+#if GFRTC_USE_ALARMS
+#include "GFRTCScheduler.h"
+
+/*-------------------------------------------------------------*
+ *		Class implementation				*
+ *-------------------------------------------------------------*/
+GFRTCSchedulerClass::GFRTCSchedulerClass()
+{
+	uint8_t i;
+
+	for (i = 0; i < GFRTC_SCHED_SIZE; i++) {
+		_alarms[i].pos = GFRTC_SCHED_NONE;
+	}
+}
+
+bool GFRTCSchedulerClass::begin(uint8_t pin)
+{
+	if (GFRTC.getChip() == E_CHIP_DS1307)
+		return false;
+
+	// alarm interrupts on INT/SQW, the flag is cleared so the pin goes high
+	if (!GFRTC.setIntSqwMode(E_INTERRUPT_OUTPUT) || !GFRTC.setAlarmInterrupt(E_ALARM_1, true))
+		return false;
+	GFRTC.getAlarmInterruptFlag(E_ALARM_1);
+
+	_pin = pin;
+	_fired = false;
+	_reprogram = true;
+	_programmed = 0;
+	_running = true;
+	if (pin != GFRTC_NO_PIN) {
+		pinMode(pin, INPUT_PULLUP);
+		attachInterrupt(digitalPinToInterrupt(pin), isr, FALLING);
+	}
+	return update();
+}
+
+void GFRTCSchedulerClass::end()
+{
+	if (_pin != GFRTC_NO_PIN)
+		detachInterrupt(digitalPinToInterrupt(_pin));
+	GFRTC.setAlarmInterrupt(E_ALARM_1, false);
+	_running = false;
+}
+
+uint8_t GFRTCSchedulerClass::add(timelib_t time, uint32_t period, gfrtc_sched_handler handler)
+{
+	uint8_t id;
+
+	if (_count >= GFRTC_SCHED_SIZE)
+		return GFRTC_SCHED_NONE;
+
+	// find a free slot, the identifier is the index of the slot
+	for (id = 0; _alarms[id].pos != GFRTC_SCHED_NONE; id++)
+		;
+	_alarms[id].time = time;
+	_alarms[id].period = period;
+	_alarms[id].handler = handler;
+	push(id);
+	return id;
+}
+
+bool GFRTCSchedulerClass::remove(uint8_t id)
+{
+	if (id >= GFRTC_SCHED_SIZE || _alarms[id].pos == GFRTC_SCHED_NONE)
+		return false;
+
+	erase(_alarms[id].pos);
+	_alarms[id].pos = GFRTC_SCHED_NONE;
+	return true;
+}
+
+bool GFRTCSchedulerClass::update()
+{
+	struct gfrtc_sched_alarm * a;
+	timelib_t t;
+	uint8_t id, rounds;
+	bool fired;
+
+	if (!_running)
+		return false;
+
+	noInterrupts();
+	fired = _fired;
+	_fired = false;
+	interrupts();
+
+	// without interrupt pin the flag must be polled, with it the flag is only
+	// cleared to release the pin
+	if (_pin == GFRTC_NO_PIN) {
+		fired = GFRTC.getAlarmInterruptFlag(E_ALARM_1);
+	} else if (fired) {
+		GFRTC.getAlarmInterruptFlag(E_ALARM_1);
+	}
+	if (!fired && !_reprogram)
+		return true;
+
+	if (!now(t))
+		return false;
+	for (rounds = 0; rounds <= GFRTC_SCHED_SIZE; rounds++) {
+		// dispatch everything that is due
+		while (_count != 0 && _alarms[_heap[0]].time <= t) {
+			id = _heap[0];
+			a = &_alarms[id];
+			erase(0);
+			if (a->period != 0) {
+				// keep the same identifier and skip the missed repetitions
+				a->time += a->period;
+				if (a->time <= t)
+					a->time += ((t - a->time) / a->period + 1) * a->period;
+				push(id);
+			} else {
+				a->pos = GFRTC_SCHED_NONE;
+			}
+			if (a->handler != NULL)
+				a->handler(id);
+		}
+
+		_reprogram = false;
+		if (_count == 0)
+			return park();
+		// the chip may already hold the nearest deadline (the alarm fired early)
+		if (_alarms[_heap[0]].time == _programmed)
+			return true;
+		if (!program(t))
+			return false;
+
+		// the deadline may have passed while the alarm was written, a seconds
+		// match would then wait for the next minute
+		if (!now(t))
+			return false;
+		if (_alarms[_heap[0]].time > t)
+			return true;
+	}
+	return true;
+}
+
+timelib_t GFRTCSchedulerClass::getNext()
+{
+	return (_count != 0) ? _alarms[_heap[0]].time : 0;
+}
+
+uint8_t GFRTCSchedulerClass::getCount()
+{
+	return _count;
+}
+
+/*-------------------------------------------------------------*
+ *		Private members					*
+ *-------------------------------------------------------------*/
+void GFRTCSchedulerClass::isr()
+{
+	_fired = true;
+}
+
+bool GFRTCSchedulerClass::program(timelib_t now)
+{
+	struct timelib_tm dt;
+	enum gfrtc_alarm_types type;
+	timelib_t next = _alarms[_heap[0]].time;
+	uint32_t delta = next - now;
+
+	// use the match with less fields that has no other occurrence before the
+	// deadline. A date occurs again after 28 days at least, deadlines further
+	// away fire early and are programmed again
+	if (delta < 60UL) {
+		type = E_ALM1_MATCH_SECONDS;
+	} else if (delta < 3600UL) {
+		type = E_ALM1_MATCH_MINUTES;
+	} else if (delta < 86400UL) {
+		type = E_ALM1_MATCH_HOURS;
+	} else {
+		type = E_ALM1_MATCH_DATE;
+	}
+
+	timelib_break(next, &dt);
+	if (!GFRTC.setAlarm(type, dt.tm_hour, dt.tm_min, dt.tm_sec, dt.tm_mday))
+		return false;
+	_programmed = next;
+	return true;
+}
+
+bool GFRTCSchedulerClass::park()
+{
+	struct timelib_tm dt;
+
+	if (_programmed == 0)
+		return true;
+
+	// nothing scheduled, a date match on the last deadline fires once a month
+	// at most instead of every minute or hour
+	timelib_break(_programmed, &dt);
+	if (!GFRTC.setAlarm(E_ALM1_MATCH_DATE, dt.tm_hour, dt.tm_min, dt.tm_sec, dt.tm_mday))
+		return false;
+	_programmed = 0;
+	return true;
+}
+
+bool GFRTCSchedulerClass::now(timelib_t & t)
+{
+	return GFRTC.read(t);
+}
+
+void GFRTCSchedulerClass::push(uint8_t slot)
+{
+	place(_count, slot);
+	siftUp(_count++);
+	if (_heap[0] == slot)
+		_reprogram = true;
+}
+
+void GFRTCSchedulerClass::erase(uint8_t pos)
+{
+	uint8_t slot;
+
+	if (pos == 0)
+		_reprogram = true;
+
+	// move the last alarm to the hole and restore the heap order
+	if (--_count == pos)
+		return;
+	slot = _heap[_count];
+	place(pos, slot);
+	siftUp(pos);
+	if (_alarms[slot].pos == pos)
+		siftDown(pos);
+}
+
+void GFRTCSchedulerClass::siftUp(uint8_t pos)
+{
+	uint8_t slot = _heap[pos];
+	uint8_t parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (_alarms[_heap[parent]].time <= _alarms[slot].time)
+			break;
+		place(pos, _heap[parent]);
+		pos = parent;
+	}
+	place(pos, slot);
+}
+
+void GFRTCSchedulerClass::siftDown(uint8_t pos)
+{
+	uint8_t slot = _heap[pos];
+	uint8_t child;
+
+	while ((child = 2 * pos + 1) < _count) {
+		if (child + 1 < _count && _alarms[_heap[child + 1]].time < _alarms[_heap[child]].time)
+			child++;
+		if (_alarms[slot].time <= _alarms[_heap[child]].time)
+			break;
+		place(pos, _heap[child]);
+		pos = child;
+	}
+	place(pos, slot);
+}
+
+void GFRTCSchedulerClass::place(uint8_t pos, uint8_t slot)
+{
+	_heap[pos] = slot;
+	_alarms[slot].pos = pos;
+}
+
+struct gfrtc_sched_alarm GFRTCSchedulerClass::_alarms[GFRTC_SCHED_SIZE];
+uint8_t GFRTCSchedulerClass::_heap[GFRTC_SCHED_SIZE];
+uint8_t GFRTCSchedulerClass::_count = 0;
+uint8_t GFRTCSchedulerClass::_pin = GFRTC_NO_PIN;
+bool GFRTCSchedulerClass::_running = false;
+bool GFRTCSchedulerClass::_reprogram = false;
+timelib_t GFRTCSchedulerClass::_programmed = 0;
+volatile bool GFRTCSchedulerClass::_fired = false;
+
+/**
+ * Create an instance for the user
+ */
+GFRTCSchedulerClass GFRTCScheduler = GFRTCSchedulerClass();
+#endif
@@ -0,0 +1,208 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCSCHEDULER_H
+#define GFRTCSCHEDULER_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+#if !GFRTC_USE_ALARMS
+#error "GFRTCScheduler needs GFRTC_TIER GFRTC_TIER_ALARMS or higher"
+#endif
+
+/*-------------------------------------------------------------*
+ *		Library configuration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Maximum number of alarms that can be scheduled at the same time, each one
+ * takes 12 bytes of RAM on AVR
+ */
+#ifndef GFRTC_SCHED_SIZE
+#define GFRTC_SCHED_SIZE	16
+#endif
+
+/*-------------------------------------------------------------*
+ *		Macros and definitions				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Identifier returned when an alarm cannot be scheduled
+ */
+#define GFRTC_SCHED_NONE	0xFF
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Function called when a scheduled alarm is due, receives the identifier
+ * returned by add()
+ */
+typedef void (*gfrtc_sched_handler)(uint8_t id);
+
+/**
+ * Alarm kept by the scheduler
+ */
+struct gfrtc_sched_alarm {
+	/** Next time the alarm is due */
+	timelib_t time;
+	/** Seconds between repetitions, 0 for alarms that fire once */
+	uint32_t period;
+	/** Function called when the alarm is due */
+	gfrtc_sched_handler handler;
+	/** Position on the heap, GFRTC_SCHED_NONE if the slot is free */
+	uint8_t pos;
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Multiplexes many logical alarms onto alarm 1 of the DS3231 / DS3232.
+ *
+ * Alarms are kept on a binary heap ordered by time, so adding, removing and
+ * dispatching an alarm takes O(log n) and memory is fixed at compile time.
+ * The nearest deadline is always programmed on the chip using the match type
+ * with less fields that cannot fire before it, and the bus is only accessed
+ * when the alarm fires or the nearest deadline changes. Alarm 2 is left free
+ * for the application.
+ */
+class GFRTCSchedulerClass {
+public:
+	GFRTCSchedulerClass();
+
+	/**
+	 * Starts the scheduler, configures INT/SQW as interrupt output and enables
+	 * the alarm 1 interrupt. GFRTC.begin() must be called first.
+	 *
+	 * @param pin The MCU pin connected to the INT/SQW output of the RTC, must
+	 * support external interrupts. With GFRTC_NO_PIN update() polls the alarm
+	 * flag on every call instead.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise or
+	 * if the chip has no alarms.
+	 */
+	static bool begin(uint8_t pin = GFRTC_NO_PIN);
+
+	/**
+	 * Stops the scheduler and disables the alarm 1 interrupt, scheduled alarms
+	 * are kept.
+	 */
+	static void end();
+
+	/**
+	 * Schedules an alarm, the chip is programmed on the next call to update().
+	 *
+	 * @param time Time when the alarm is due as a unix timestamp.
+	 * @param period Seconds between repetitions, 0 for an alarm that fires
+	 * once.
+	 * @param handler Function called from update() when the alarm is due.
+	 *
+	 * @return The identifier of the alarm, GFRTC_SCHED_NONE if there is no
+	 * free slot.
+	 */
+	static uint8_t add(timelib_t time, uint32_t period, gfrtc_sched_handler handler);
+
+	/**
+	 * Removes an alarm, can be called from a handler.
+	 *
+	 * @param id The identifier returned by add().
+	 *
+	 * @return Returns true if the alarm was scheduled.
+	 */
+	static bool remove(uint8_t id);
+
+	/**
+	 * Dispatches the alarms that are due and programs the next deadline on the
+	 * chip, call this method often from the main loop or after waking up. It
+	 * only generates I2C traffic when the alarm fired or the nearest deadline
+	 * changed (or on every call if no interrupt pin is used).
+	 *
+	 * Periodic alarms that missed several repetitions fire once and continue
+	 * on the next repetition in the future.
+	 *
+	 * @return Returns true if communication is successfull, false otherwise.
+	 */
+	static bool update();
+
+	/**
+	 * Gets the time of the nearest deadline.
+	 *
+	 * @return A unix timestamp, 0 if no alarm is scheduled.
+	 */
+	static timelib_t getNext();
+
+	/**
+	 * Gets the number of scheduled alarms.
+	 */
+	static uint8_t getCount();
+
+private:
+	/**
+	 * Interrupt handler for the falling edge of INT/SQW.
+	 */
+	static void isr();
+
+	/**
+	 * Writes the nearest deadline to the alarm 1 registers.
+	 */
+	static bool program(timelib_t now);
+
+	/**
+	 * Leaves a harmless alarm on the chip when nothing is scheduled.
+	 */
+	static bool park();
+
+	/**
+	 * Reads the time from the chip, never from the cached clock.
+	 */
+	static bool now(timelib_t & t);
+
+	static void push(uint8_t slot);
+
+	static void erase(uint8_t pos);
+
+	static void siftUp(uint8_t pos);
+
+	static void siftDown(uint8_t pos);
+
+	static void place(uint8_t pos, uint8_t slot);
+
+	static struct gfrtc_sched_alarm _alarms[GFRTC_SCHED_SIZE];
+	static uint8_t _heap[GFRTC_SCHED_SIZE];
+	static uint8_t _count;
+	static uint8_t _pin;
+	static bool _running;
+	static bool _reprogram;
+	static timelib_t _programmed;
+	static volatile bool _fired;
+};
+
+/**
+ * Instance of the GFRTCSchedulerClass as declared in GFRTCScheduler.cpp
+ */
+extern GFRTCSchedulerClass GFRTCScheduler;
+
+#endif
+// End of Header file
@@ -0,0 +1,268 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#include "GFRTC.h"
+
+// not compiled unless the tier includes it
+#if GFRTC_USE_ALARMS
+#include "GFRTCSqw.h"
+
+/*-------------------------------------------------------------*
+ *		Class implementation				*
+ *-------------------------------------------------------------*/
+GFRTCSqwClass::GFRTCSqwClass()
+{
+}
+
+bool GFRTCSqwClass::begin(uint8_t pin, enum gfrtc_intsqw_modes frequency, uint32_t interval)
+{
+	uint32_t start;
+
+	// interrupt output mode cannot be used as time base
+	if (frequency >= E_INTERRUPT_OUTPUT)
+		return false;
+
+	_pin = pin;
+	_mode = frequency;
+	_interval = interval;
+	_corrections = 0;
+	_lastError = 0;
+	_valid = false;
+
+	// all square wave frequencies are powers of two, the fraction of second is
+	// computed with a shift instead of a division
+	switch (frequency) {
+	case E_SQRWAVE_1024_HZ:
+		_shift = 6;
+		break;
+	case E_SQRWAVE_4096_HZ:
+		_shift = 4;
+		break;
+	case E_SQRWAVE_8192_HZ:
+		_shift = 3;
+		break;
+	default:
+		_shift = 0;
+		break;
+	}
+
+	pinMode(pin, INPUT_PULLUP);
+	startSync();
+	attachInterrupt(digitalPinToInterrupt(pin), isr, FALLING);
+
+	// wait for the first synchronization
+	start = millis();
+	while (!update()) {
+		if ((uint32_t) (millis() - start) > 2000UL) {
+			return false;
+		}
+		delay(1);
+	}
+	return true;
+}
+
+void GFRTCSqwClass::end()
+{
+	detachInterrupt(digitalPinToInterrupt(_pin));
+	_state = E_SQW_STOPPED;
+	_valid = false;
+}
+
+bool GFRTCSqwClass::update()
+{
+	timelib_t t, s0, s1;
+	uint32_t edge, elapsed;
+	uint32_t ticks;
+
+	switch (_state) {
+	case E_SQW_SYNC_WAIT:
+		if (!_edge)
+			return false;
+		_edge = false;
+
+		// the falling edge of the 1 Hz output marks the start of a second
+		if (!GFRTC.read(t)) {
+			return false;
+		}
+
+		// the edges of the working frequency are also taken by the interrupt
+		// as edges of the 1 Hz output, keep the time of the last real one
+		noInterrupts();
+		edge = _edgeMicros;
+		interrupts();
+
+		// switch to working frequency, the output is derived from the same
+		// divider chain so its edges are aligned with the start of the second
+		if (!GFRTC.setIntSqwMode(_mode)) {
+			startSync();
+			return false;
+		}
+
+		// compute the edges elapsed since the start of the second
+		elapsed = micros() - edge;
+		if (elapsed > GFRTC_SQW_SYNC_WINDOW_US) {
+			// too late, wait for the next edge
+			startSync();
+			return false;
+		}
+		noInterrupts();
+		_seconds = t;
+		if (_mode == E_SQRWAVE_1_HZ) {
+			_ticks = 0;
+			_divider = 1;
+		} else {
+			// elapsed * frequency / 1000000 without overflow for the window
+			ticks = ((elapsed << (16 - _shift)) / 15625UL) >> 6;
+			_ticks = (uint16_t) ticks;
+			_divider = (uint16_t) 1 << (16 - _shift);
+		}
+		_edge = false;
+		_valid = true;
+		_state = E_SQW_RUNNING;
+		interrupts();
+
+		_lastCheck = t;
+		return true;
+
+	case E_SQW_RUNNING:
+		noInterrupts();
+		s0 = _seconds;
+		interrupts();
+		if ((uint32_t) (s0 - _lastCheck) < _interval)
+			return true;
+
+		// compare the edge count against the time registers
+		if (!GFRTC.read(t))
+			return true;
+		noInterrupts();
+		s1 = _seconds;
+		interrupts();
+
+		// a second boundary during the read makes the comparison ambiguous
+		if (s0 != s1)
+			return true;
+
+		_lastCheck = t;
+		if (t != s0) {
+			// edges were lost or spurious edges were counted, fix seconds and
+			// synchronize again to restore the phase of the fraction
+			_corrections++;
+			_lastError = (int32_t) (t - s0);
+			noInterrupts();
+			_seconds += _lastError;
+			interrupts();
+			startSync();
+		}
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool GFRTCSqwClass::getPrecise(struct gfrtc_precise_time & t)
+{
+	uint16_t ticks;
+	uint8_t state;
+
+	// copy the values updated by the interrupt handler
+	noInterrupts();
+	t.seconds = _seconds;
+	ticks = _ticks;
+	state = _state;
+	interrupts();
+
+	t.fraction = (uint16_t) (ticks << _shift);
+	return state != E_SQW_STOPPED && _valid;
+}
+
+timelib_t GFRTCSqwClass::get()
+{
+	struct gfrtc_precise_time t;
+
+	if (!getPrecise(t))
+		return 0;
+	return t.seconds;
+}
+
+bool GFRTCSqwClass::isSynchronized()
+{
+	return _state == E_SQW_RUNNING;
+}
+
+uint16_t GFRTCSqwClass::getCorrections()
+{
+	return _corrections;
+}
+
+int32_t GFRTCSqwClass::getLastError()
+{
+	return _lastError;
+}
+
+/*-------------------------------------------------------------*
+ *		Private members					*
+ *-------------------------------------------------------------*/
+void GFRTCSqwClass::isr()
+{
+	if (_state == E_SQW_SYNC_WAIT) {
+		// 1 Hz output during synchronization, each edge is a new second
+		_edgeMicros = micros();
+		_edge = true;
+		_ticks = 0;
+		_seconds++;
+		return;
+	}
+	if (++_ticks >= _divider) {
+		_ticks = 0;
+		_seconds++;
+	}
+}
+
+void GFRTCSqwClass::startSync()
+{
+	// changing the frequency can produce an edge that is not aligned with the
+	// start of a second, so edges are considered only after the switch
+	GFRTC.setIntSqwMode(E_SQRWAVE_1_HZ);
+	noInterrupts();
+	_edge = false;
+	_state = E_SQW_SYNC_WAIT;
+	interrupts();
+}
+
+volatile uint8_t GFRTCSqwClass::_state = E_SQW_STOPPED;
+volatile timelib_t GFRTCSqwClass::_seconds = 0;
+volatile uint16_t GFRTCSqwClass::_ticks = 0;
+volatile uint16_t GFRTCSqwClass::_divider = 1;
+volatile bool GFRTCSqwClass::_edge = false;
+volatile uint32_t GFRTCSqwClass::_edgeMicros = 0;
+bool GFRTCSqwClass::_valid = false;
+uint8_t GFRTCSqwClass::_pin = 0;
+uint8_t GFRTCSqwClass::_shift = 0;
+enum gfrtc_intsqw_modes GFRTCSqwClass::_mode = E_SQRWAVE_1_HZ;
+uint32_t GFRTCSqwClass::_interval = GFRTC_SQW_DEFAULT_CHECK_INTERVAL;
+timelib_t GFRTCSqwClass::_lastCheck = 0;
+uint16_t GFRTCSqwClass::_corrections = 0;
+int32_t GFRTCSqwClass::_lastError = 0;
+
+/**
+ * Create an instance for the user
+ */
+GFRTCSqwClass GFRTCSqw = GFRTCSqwClass();
+#endif
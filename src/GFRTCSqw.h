@@ -0,0 +1,177 @@
+/*	Geek Factory GFRTC Library
+	Copyright (C) 2018 Jesus Ruben Santa Anna Zamudio.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	Author website: https://www.geekfactory.mx
+	Author e-mail: ruben at geekfactory dot mx
+ */
+#ifndef GFRTCSQW_H
+#define GFRTCSQW_H
+
+/*-------------------------------------------------------------*
+ *		Includes and dependencies			*
+ *-------------------------------------------------------------*/
+#include "GFRTC.h"
+
+#if !GFRTC_USE_ALARMS
+#error "GFRTCSqw needs GFRTC_TIER GFRTC_TIER_ALARMS or higher"
+#endif
+
+/*-------------------------------------------------------------*
+ *		Library configuration				*
+ *-------------------------------------------------------------*/
+
+/**
+ * Default interval in seconds between checks of the edge count against the
+ * RTC time registers
+ */
+#define GFRTC_SQW_DEFAULT_CHECK_INTERVAL	60UL
+
+/**
+ * Maximum time in microseconds allowed between the 1 Hz synchronization edge
+ * and the switch to the working frequency, synchronization is restarted if
+ * this time is exceeded
+ */
+#define GFRTC_SQW_SYNC_WINDOW_US	400000UL
+
+/*-------------------------------------------------------------*
+ *		Typedefs enums & structs			*
+ *-------------------------------------------------------------*/
+
+/**
+ * Time with sub-second resolution
+ */
+struct gfrtc_precise_time {
+	/** Unix timestamp */
+	timelib_t seconds;
+	/** Fraction of second in units of 1/65536 s */
+	uint16_t fraction;
+};
+
+/**
+ * States of the square wave timestamp engine
+ */
+enum gfrtc_sqw_states {
+	E_SQW_STOPPED = 0,
+	E_SQW_SYNC_WAIT,
+	E_SQW_RUNNING,
+};
+
+/*-------------------------------------------------------------*
+ *		Class declaration				*
+ *-------------------------------------------------------------*/
+class GFRTCSqwClass {
+public:
+	GFRTCSqwClass();
+
+	/**
+	 * Starts the square wave timestamp engine.
+	 *
+	 * The INT/SQW pin is configured to output 1 Hz and the time registers are
+	 * read once right after a falling edge, which marks the start of a second.
+	 * The output is then switched to the requested frequency and every falling
+	 * edge advances the time kept on RAM. The INT/SQW pin is open drain and
+	 * needs a pull-up resistor.
+	 *
+	 * This call waits up to two seconds for the first synchronization.
+	 *
+	 * @param pin The MCU pin connected to the INT/SQW output of the RTC, must
+	 * support external interrupts.
+	 * @param frequency The square wave frequency, higher values give better
+	 * resolution at the cost of more interrupts.
+	 * @param interval Seconds between checks of the edge count against the RTC.
+	 *
+	 * @return Returns true if the engine is synchronized with the RTC.
+	 */
+	static bool begin(uint8_t pin, enum gfrtc_intsqw_modes frequency = E_SQRWAVE_1024_HZ, uint32_t interval = GFRTC_SQW_DEFAULT_CHECK_INTERVAL);
+
+	/**
+	 * Stops the engine and detaches the interrupt handler.
+	 */
+	static void end();
+
+	/**
+	 * Drives synchronization and the periodic check against the RTC, call this
+	 * method often from the main loop. It only generates I2C traffic while
+	 * synchronizing or when a check is due.
+	 *
+	 * @return Returns true if the engine is synchronized.
+	 */
+	static bool update();
+
+	/**
+	 * Gets the time with sub-second resolution, never accesses the I2C bus.
+	 *
+	 * @param t Reference to structure where the time is stored.
+	 *
+	 * @return Returns true if the engine is synchronized and the time is valid.
+	 */
+	static bool getPrecise(struct gfrtc_precise_time & t);
+
+	/**
+	 * Gets the time in seconds, never accesses the I2C bus.
+	 *
+	 * @return The unix timestamp kept by the engine, 0 if not synchronized.
+	 */
+	static timelib_t get();
+
+	/**
+	 * Checks if the engine is synchronized with the RTC.
+	 */
+	static bool isSynchronized();
+
+	/**
+	 * Gets the number of times the edge count disagreed with the RTC and the
+	 * time was corrected.
+	 */
+	static uint16_t getCorrections();
+
+	/**
+	 * Gets the error in seconds found on the last correction, positive if
+	 * edges were missed.
+	 */
+	static int32_t getLastError();
+
+private:
+	/**
+	 * Interrupt handler for the falling edge of INT/SQW.
+	 */
+	static void isr();
+
+	static void startSync();
+
+	static volatile uint8_t _state;
+	static volatile timelib_t _seconds;
+	static volatile uint16_t _ticks;
+	static volatile uint16_t _divider;
+	static volatile bool _edge;
+	static volatile uint32_t _edgeMicros;
+	static bool _valid;
+	static uint8_t _pin;
+	static uint8_t _shift;
+	static enum gfrtc_intsqw_modes _mode;
+	static uint32_t _interval;
+	static timelib_t _lastCheck;
+	static uint16_t _corrections;
+	static int32_t _lastError;
+};
+
+/**
+ * Instance of the GFRTCSqwClass as declared in GFRTCSqw.cpp
+ */
+extern GFRTCSqwClass GFRTCSqw;
+
+#endif
+// End of Header file